@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////
+/// Fleet
+///////////////////////////////////////////////////////////
+
+// hullhost fleet - runs a number of robots side by side on a thread pool
+// and reports how much simulated robot time the host gets through a second.
+// Robot n is sent file n modulo the number of files, so a folder of class
+// programs can be run together.
+//
+// The robots are kept in step: each slice of simulated time is run for every
+// robot before any robot starts the next one. Each robot gets its own seed
+// unless --same-seed is given, in which case they should all leave the same
+// trace, which checks that no robot shares anything with another.
+
+#pragma once
+
+#include <set>
+
+#include "Runner.h"
+#include "ThreadPool.h"
+
+int runFleet(const RunnerSettings & settings)
+{
+	std::vector<std::string> programs(settings.files.size());
+
+	for (size_t i = 0; i < settings.files.size(); i++)
+	{
+		if (!readFile(settings.files[i].c_str(), &programs[i]))
+			return 1;
+	}
+
+	if (programs.empty())
+		programs.push_back("");
+
+	int threads = settings.threads;
+
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+
+	if (threads <= 0)
+		threads = 1;
+
+	std::vector<Robot> robots(settings.robots);
+
+	double loadStart = wallSeconds();
+
+	for (int i = 0; i < settings.robots; i++)
+	{
+		if (!loadRobot(&robots[i], settings.library.c_str(), i))
+			return 1;
+
+		applySettings(settings, &robots[i].options);
+
+		if (!settings.sameSeed)
+			robots[i].options.seed += i;
+	}
+
+	ThreadPool pool(threads);
+
+	pool.forEach(settings.robots, [&](int i) {
+		Robot * robot = &robots[i];
+		const std::string & input = programs[i % programs.size()];
+		startRobot(robot);
+		robot->sketch.hostSend((const uint8_t *)input.data(), (int)input.size(),
+			robot->options.startMicros + secondsToMicros(settings.inputAt));
+	});
+
+	double runStart = wallSeconds();
+
+	// Every robot powers on at the same simulated time
+	uint64_t start = robots[0].options.startMicros;
+	uint64_t end = start + secondsToMicros(settings.inputAt + settings.seconds);
+	uint64_t slice = secondsToMicros(settings.slice);
+
+	for (uint64_t t = start + slice; t < end + slice; t += slice)
+	{
+		uint64_t until = t < end ? t : end;
+
+		pool.forEach(settings.robots, [&](int i) {
+			runRobot(&robots[i], until);
+		});
+	}
+
+	double runEnd = wallSeconds();
+
+	uint64_t passes = 0;
+	int stalled = 0;
+	std::set<uint64_t> digests;
+
+	for (int i = 0; i < settings.robots; i++)
+	{
+		HostStats stats;
+		robots[i].sketch.hostGetStats(&stats);
+
+		passes += stats.loopPasses;
+
+		if (robots[i].stalled)
+		{
+			stalled++;
+			printf("robot %d stalled running %s\n", i,
+				settings.files.empty() ? "nothing" : settings.files[i % settings.files.size()].c_str());
+		}
+
+		digests.insert(robots[i].digest);
+	}
+
+	double simulated = (end - start) / 1e6;
+	double wall = runEnd - runStart;
+
+	printf("robots %d, threads %d, %.1f simulated seconds each\n", settings.robots, pool.size(), simulated);
+	printf("loaded in %.2f s, ran in %.2f s\n", runStart - loadStart, wall);
+	printf("%.0f robot-seconds a second, %.2f million loop passes a second\n",
+		settings.robots * simulated / wall, passes / wall / 1e6);
+	printf("%d stalled, %d different traces\n", stalled, (int)digests.size());
+
+	if (settings.stats)
+		printStats(stdout, &robots[0]);
+
+	for (int i = 0; i < settings.robots; i++)
+		unloadRobot(&robots[i]);
+
+	if (settings.sameSeed && digests.size() != 1)
+		return 1;
+
+	return stalled ? 1 : 0;
+}
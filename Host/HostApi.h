@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////
+/// Host API
+///////////////////////////////////////////////////////////
+
+// The interface between a copy of the sketch built for the host (Sketch.cpp)
+// and the programs that drive it. Each robot is a separate copy of the shared
+// library, so everything the sketch keeps in globals, the simulated board
+// included, belongs to one robot. The runner reaches the functions below
+// through the HostSketch table filled in by Robot.h.
+//
+// All times are in microseconds of simulated time since the board was
+// powered on, plus the start time given in HostOptions.
+
+#pragma once
+
+#include <stdint.h>
+
+#define HOST_API_VERSION 3
+
+// Time for something that never happens
+#define HOST_NEVER UINT64_MAX
+
+// The ATmega328P has 1K of EEPROM
+#define HOST_EEPROM_SIZE 1024
+
+struct HostOptions
+{
+	// Simulated time at power on, used to start close to a clock wrap
+	uint64_t startMicros;
+	// Seed for random()
+	uint32_t seed;
+
+	// Time taken by one pass through loop(), not counting delays
+	uint32_t loopPassMicros;
+	// Time taken to handle each byte read from the serial port
+	uint32_t serialReadMicros;
+	// Time taken by each EEPROM write that changes a byte
+	uint32_t eepromWriteMicros;
+
+	// A pass through loop() that takes longer than this is a stall
+	uint32_t watchdogMicros;
+
+	// When true input bytes are sent no faster than the baud rate allows
+	// and the sender reacts to XON and XOFF from the robot. When false each
+	// byte arrives at exactly the time it was given, as in a replay.
+	bool pacedInput;
+	bool senderHonoursFlowControl;
+	// Time from the robot sending XOFF or XON to the sender acting on it
+	uint32_t flowControlReactionMicros;
+
+	// Distance in mm to whatever is in front of the distance sensor,
+	// zero for nothing in range. Not used if the world has walls.
+	uint32_t distanceInMM;
+	// The size of the robot, which moves in the world in HostWorld.h
+	double wheelDiameterMM;
+	double wheelSpacingMM;
+	// Value returned by analogRead()
+	uint16_t lightLevel;
+};
+
+struct HostStats
+{
+	uint64_t now;
+	uint64_t loopPasses;
+	uint64_t longestPassMicros;
+	uint64_t timerInterrupts;
+	uint64_t eepromReads;
+	uint64_t eepromWrites;
+	uint64_t bytesReceived;
+	uint64_t bytesDropped;
+	uint64_t bytesSent;
+	uint64_t xoffsSent;
+	uint64_t leftSteps;
+	uint64_t rightSteps;
+	uint64_t pixelFrames;
+	uint64_t tones;
+	// Bytes given to hostSend that have not arrived yet
+	uint64_t bytesWaiting;
+	bool stalled;
+};
+
+// A wall in the world, from x1,y1 to x2,y2 in mm
+struct HostWall
+{
+	double x1;
+	double y1;
+	double x2;
+	double y2;
+};
+
+// Where the robot is in the world, worked out from the steps of its wheels
+struct HostPose
+{
+	// mm from the point where the robot was powered on, x to the right
+	// and y ahead
+	double x;
+	double y;
+	// Radians, positive to the right
+	double heading;
+	// mm from the robot to the nearest wall, negative when touching it
+	double clearance;
+	double minClearance;
+	// Times the robot has run into a wall
+	uint32_t collisions;
+	// Readings taken by the distance sensor
+	uint32_t echoes;
+};
+
+// Things the board records as they happen
+enum HostTraceKind
+{
+	TRACE_SERIAL_IN,	// data[0] arrived in the receive buffer
+	TRACE_SERIAL_DROPPED,	// data[0] arrived with the receive buffer full
+	TRACE_SERIAL_OUT,	// data[0] was written to the serial port
+	TRACE_LEFT_STEP,	// data[0] is the new pattern on the left motor coils
+	TRACE_RIGHT_STEP,	// data[0] is the new pattern on the right motor coils
+	TRACE_PIXELS,		// data holds the red, green, blue of each pixel shown
+	TRACE_TONE,		// data[0..1] frequency, data[2..5] duration, zero for none
+	TRACE_EEPROM_WRITE,	// data[0..1] address, data[2] value
+	TRACE_STALL		// a pass through loop() ran past the watchdog
+};
+
+#define HOST_TRACE_DATA_LENGTH 48
+
+struct HostTraceEvent
+{
+	uint64_t time;
+	uint8_t kind;
+	uint8_t length;
+	uint8_t data[HOST_TRACE_DATA_LENGTH];
+};
+
+typedef void(*HostTraceHandler)(void * context, const HostTraceEvent * event);
+
+// The functions exported by the sketch library, each with a pointer type
+// for the runner to load it into
+
+#define HOST_API_FUNCTIONS(X) \
+	X(int, hostApiVersion, (void)) \
+	X(void, hostDefaultOptions, (HostOptions * options)) \
+	X(void, hostPowerOn, (const HostOptions * options)) \
+	X(void, hostSetTrace, (HostTraceHandler handler, void * context)) \
+	X(void, hostLoadEEPROM, (const uint8_t * image, int length)) \
+	X(void, hostReadEEPROM, (uint8_t * image, int length)) \
+	X(void, hostSend, (const uint8_t * bytes, int length, uint64_t atMicros)) \
+	X(void, hostSetDistance, (uint32_t distanceInMM)) \
+	X(void, hostSetWorld, (const HostWall * walls, int count)) \
+	X(void, hostGetPose, (HostPose * pose)) \
+	X(int, hostSetup, (void)) \
+	X(int, hostRunUntil, (uint64_t micros)) \
+	X(uint64_t, hostNow, (void)) \
+	X(bool, hostRobotIdle, (void)) \
+	X(void, hostGetStats, (HostStats * stats)) \
+	X(int, hostStoredStatements, (void))
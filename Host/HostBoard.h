@@ -0,0 +1,736 @@
+///////////////////////////////////////////////////////////
+/// Host board
+///////////////////////////////////////////////////////////
+
+// A simulated Arduino Uno for the host build of the sketch. The stand-in
+// libraries in stubs/ hand everything that touches the hardware to the
+// single HostBoard in this copy of the sketch, which keeps a simulated clock
+// and moves it on when the sketch waits for something:
+//
+// delay(), delayMicroseconds() and each read of the clock
+// EEPROM writes, which keep the next EEPROM access waiting until done
+// serial writes when the transmit buffer is full
+// serial reads and each pass through loop(), see HostOptions
+// strip.show(), with interrupts held off while the pixels are sent
+//
+// The steps of the motors move the robot in the world in HostWorld.h, which
+// gives the distance sensor its echoes if it has any walls.
+//
+// As the clock moves on the board fires the Timer1 interrupt, the echo pin
+// interrupt and the arrival of serial bytes in time order. Interrupts never
+// nest and are held while the sketch has them turned off.
+//
+// This file is only included into Sketch.cpp, so nothing here is inline.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+
+#include "HostApi.h"
+
+// The Arduino serial buffers hold one byte less than their size
+#define HOST_SERIAL_BUFFER_SIZE 64
+
+#define HOST_MAX_PIXELS (HOST_TRACE_DATA_LENGTH / 3)
+
+// Time taken by each call of millis() or micros(), so that code which waits
+// for the clock without calling delay() still sees it move on
+#define HOST_CLOCK_READ_MICROS 2
+
+// Echo timing of an HC-SR04 distance sensor
+#define HOST_ECHO_DELAY_MICROS 450
+#define HOST_ECHO_MICROS_PER_MM 5.8
+#define HOST_ECHO_TIMEOUT_MICROS 38000
+
+#define HOST_XON 0x11
+#define HOST_XOFF 0x13
+
+#include "HostWorld.h"
+
+// Thrown out of the board when a pass through loop() runs past the watchdog
+// and caught in Sketch.cpp
+struct HostStall
+{
+};
+
+struct HostInputByte
+{
+	uint64_t time;
+	uint8_t value;
+};
+
+class HostBoard
+{
+public:
+	HostOptions options;
+	HostStats stats;
+
+	HostTraceHandler traceHandler;
+	void * traceContext;
+
+	HostWorld world;
+
+	uint64_t now;
+
+	void powerOn(const HostOptions & newOptions)
+	{
+		options = newOptions;
+		memset(&stats, 0, sizeof(stats));
+
+		now = options.startMicros;
+		passStart = now;
+
+		interruptsHeld = 0;
+		inInterrupt = false;
+
+		timerHandler = NULL;
+		timerAttached = false;
+		timerPending = false;
+		timerPeriod = 1000000;
+		timerDue = HOST_NEVER;
+
+		echoHandler = NULL;
+		echoPin = 2;
+		echoPending = false;
+		echoPinLevel = false;
+		echoRiseAt = HOST_NEVER;
+		echoFallAt = HOST_NEVER;
+		triggerLevel = false;
+
+		input.clear();
+		receiveHead = 0;
+		receiveCount = 0;
+		byteMicros = 10000000 / 1200;
+		lastArrival = 0;
+		senderStopAt = HOST_NEVER;
+		senderResumeAt = HOST_NEVER;
+		transmitDoneAt = 0;
+
+		memset(eeprom, 0xFF, sizeof(eeprom));
+		eepromBusyUntil = 0;
+
+		frameLength = 0;
+		leftCoils = 0;
+		rightCoils = 0;
+
+		randomState = 1;
+
+		world.powerOn(options, options.seed);
+	}
+
+	void setTrace(HostTraceHandler handler, void * context)
+	{
+		traceHandler = handler;
+		traceContext = context;
+	}
+
+	void trace(uint8_t kind, const uint8_t * data, int length)
+	{
+		if (traceHandler == NULL)
+			return;
+
+		HostTraceEvent event;
+		event.time = now;
+		event.kind = kind;
+		event.length = length;
+		memcpy(event.data, data, length);
+		traceHandler(traceContext, &event);
+	}
+
+	void trace(uint8_t kind, uint8_t value)
+	{
+		trace(kind, &value, 1);
+	}
+
+	// Passes through loop() and the watchdog
+
+	void startPass()
+	{
+		passStart = now;
+	}
+
+	void endPass()
+	{
+		advanceTo(now + options.loopPassMicros);
+
+		uint64_t length = now - passStart;
+
+		if (length > stats.longestPassMicros)
+			stats.longestPassMicros = length;
+
+		stats.loopPasses++;
+	}
+
+	void checkWatchdog()
+	{
+		if (now - passStart > options.watchdogMicros)
+		{
+			stats.stalled = true;
+			trace(TRACE_STALL, NULL, 0);
+			throw HostStall();
+		}
+	}
+
+	// The clock
+
+	uint32_t readMillis()
+	{
+		advanceTo(now + HOST_CLOCK_READ_MICROS);
+
+		// Timer0 overflows every 1024 microseconds and millis() counts whole
+		// milliseconds of those, skipping a value now and then as the AVR does
+		return (uint32_t)((now / 1024) * 1024 / 1000);
+	}
+
+	uint32_t readMicros()
+	{
+		advanceTo(now + HOST_CLOCK_READ_MICROS);
+
+		return (uint32_t)(now & ~(uint64_t)3);
+	}
+
+	// Moves the clock on to the given time, firing the interrupts and serial
+	// arrivals that fall due on the way
+
+	void advanceTo(uint64_t target)
+	{
+		if (inInterrupt)
+		{
+			if (target > now)
+				now = target;
+			return;
+		}
+
+		while (true)
+		{
+			uint64_t next = target;
+			int event = 0;
+
+			if (timerAttached && timerDue <= next)
+			{
+				next = timerDue;
+				event = 1;
+			}
+
+			uint64_t arrival = nextArrival();
+
+			if (arrival < next)
+			{
+				next = arrival;
+				event = 2;
+			}
+
+			uint64_t echo = echoRiseAt < echoFallAt ? echoRiseAt : echoFallAt;
+
+			if (echo < next)
+			{
+				next = echo;
+				event = 3;
+			}
+
+			if (event == 0)
+				break;
+
+			if (next > now)
+				now = next;
+
+			switch (event)
+			{
+			case 1:
+				timerOverflow();
+				break;
+			case 2:
+				deliverInput();
+				break;
+			case 3:
+				echoEdge();
+				break;
+			}
+
+			checkWatchdog();
+		}
+
+		if (target > now)
+			now = target;
+
+		checkWatchdog();
+	}
+
+	// Interrupts
+
+	void holdInterrupts()
+	{
+		interruptsHeld++;
+	}
+
+	// The global interrupt flag as the sketch sees it through SREG. Clearing
+	// it holds interrupts off once, however often noInterrupts() was called,
+	// and setting it lets them all through again.
+
+	bool interruptsEnabled()
+	{
+		return interruptsHeld == 0 && !inInterrupt;
+	}
+
+	void setInterruptsEnabled(bool enabled)
+	{
+		if (enabled)
+		{
+			if (interruptsHeld > 0)
+			{
+				interruptsHeld = 1;
+				releaseInterrupts();
+			}
+		}
+		else if (interruptsHeld == 0 && !inInterrupt)
+		{
+			holdInterrupts();
+		}
+	}
+
+	void releaseInterrupts()
+	{
+		if (interruptsHeld == 0)
+			return;
+
+		if (--interruptsHeld > 0)
+			return;
+
+		// An interrupt flag holds one pending interrupt however many times
+		// it was raised
+		if (timerPending)
+		{
+			timerPending = false;
+			runInterrupt(timerHandler);
+		}
+
+		if (echoPending)
+		{
+			echoPending = false;
+			runInterrupt(echoHandler);
+		}
+	}
+
+	void runInterrupt(void(*handler)())
+	{
+		if (handler == NULL || inInterrupt)
+			return;
+
+		inInterrupt = true;
+		handler();
+		inInterrupt = false;
+	}
+
+	// Timer1
+
+	void timerSetPeriod(uint32_t microseconds)
+	{
+		timerPeriod = microseconds < 1 ? 1 : microseconds;
+		timerDue = now + timerPeriod;
+	}
+
+	void timerAttach(void(*handler)())
+	{
+		timerHandler = handler;
+		timerAttached = true;
+	}
+
+	void timerDetach()
+	{
+		timerAttached = false;
+		timerPending = false;
+	}
+
+	void timerOverflow()
+	{
+		while (timerDue <= now)
+			timerDue += timerPeriod;
+
+		stats.timerInterrupts++;
+
+		if (interruptsHeld || inInterrupt)
+			timerPending = true;
+		else
+			runInterrupt(timerHandler);
+	}
+
+	// The motor coils, driven through PORTD and PORTB
+
+	void portWritten(char port, uint8_t value)
+	{
+		if (port == 'D')
+		{
+			uint8_t coils = value >> 4;
+
+			if (coils != leftCoils)
+			{
+				leftCoils = coils;
+				if (coils)
+				{
+					stats.leftSteps++;
+					world.coilsChanged(true, coils);
+				}
+				trace(TRACE_LEFT_STEP, coils);
+			}
+		}
+		else if (port == 'B')
+		{
+			uint8_t coils = value & 0x0F;
+
+			if (coils != rightCoils)
+			{
+				rightCoils = coils;
+				if (coils)
+				{
+					stats.rightSteps++;
+					world.coilsChanged(false, coils);
+				}
+				trace(TRACE_RIGHT_STEP, coils);
+			}
+		}
+	}
+
+	// The distance sensor, triggered on one pin and echoing on another
+	// which has a pin change interrupt attached
+
+	uint8_t readPIND()
+	{
+		return echoPinLevel ? (1 << echoPin) : 0;
+	}
+
+	void attachPinInterrupt(uint8_t pin, void(*handler)())
+	{
+		echoPin = pin;
+		echoHandler = handler;
+	}
+
+	uint32_t echoWidth()
+	{
+		if (!world.walls.empty())
+			return world.echoWidth();
+
+		if (options.distanceInMM == 0)
+			return HOST_ECHO_TIMEOUT_MICROS;
+
+		return (uint32_t)(options.distanceInMM * HOST_ECHO_MICROS_PER_MM);
+	}
+
+	void triggerWritten(bool level)
+	{
+		// The sensor sends its burst on the falling edge of the trigger
+		// and ignores triggers while it is still listening
+		if (triggerLevel && !level && echoRiseAt == HOST_NEVER && echoFallAt == HOST_NEVER)
+		{
+			echoRiseAt = now + HOST_ECHO_DELAY_MICROS;
+			echoFallAt = echoRiseAt + echoWidth();
+		}
+
+		triggerLevel = level;
+	}
+
+	void echoEdge()
+	{
+		if (echoRiseAt <= now)
+		{
+			echoRiseAt = HOST_NEVER;
+			echoPinLevel = true;
+		}
+		else
+		{
+			echoFallAt = HOST_NEVER;
+			echoPinLevel = false;
+		}
+
+		if (interruptsHeld || inInterrupt)
+			echoPending = true;
+		else
+			runInterrupt(echoHandler);
+	}
+
+	// Serial input. Bytes are queued by the runner and arrive in the
+	// receive buffer at their time, or when paced as fast as the baud rate
+	// and the sender's reaction to flow control allow
+
+	void serialBegin(uint32_t baud)
+	{
+		// Ten bits for each byte with a start and stop bit
+		byteMicros = 10000000 / baud;
+	}
+
+	void send(const uint8_t * bytes, int length, uint64_t atMicros)
+	{
+		for (int i = 0; i < length; i++)
+		{
+			HostInputByte b;
+			b.time = atMicros;
+			b.value = bytes[i];
+			input.push_back(b);
+		}
+	}
+
+	uint64_t nextArrival()
+	{
+		if (input.empty())
+			return HOST_NEVER;
+
+		uint64_t arrival = input.front().time;
+
+		if (!options.pacedInput)
+			return arrival;
+
+		if (arrival < lastArrival + byteMicros)
+			arrival = lastArrival + byteMicros;
+
+		if (options.senderHonoursFlowControl && senderStopAt <= arrival - byteMicros)
+		{
+			if (senderResumeAt == HOST_NEVER)
+				return HOST_NEVER;
+
+			if (arrival < senderResumeAt + byteMicros)
+				arrival = senderResumeAt + byteMicros;
+		}
+
+		return arrival;
+	}
+
+	void deliverInput()
+	{
+		uint8_t value = input.front().value;
+		input.pop_front();
+
+		lastArrival = now;
+
+		if (senderResumeAt <= now)
+		{
+			senderStopAt = HOST_NEVER;
+			senderResumeAt = HOST_NEVER;
+		}
+
+		if (receiveCount == HOST_SERIAL_BUFFER_SIZE - 1)
+		{
+			stats.bytesDropped++;
+			trace(TRACE_SERIAL_DROPPED, value);
+			return;
+		}
+
+		receiveBuffer[(receiveHead + receiveCount) % HOST_SERIAL_BUFFER_SIZE] = value;
+		receiveCount++;
+		stats.bytesReceived++;
+		trace(TRACE_SERIAL_IN, value);
+	}
+
+	int serialAvailable()
+	{
+		return receiveCount;
+	}
+
+	int serialPeek()
+	{
+		if (receiveCount == 0)
+			return -1;
+
+		return receiveBuffer[receiveHead];
+	}
+
+	int serialRead()
+	{
+		if (receiveCount == 0)
+			return -1;
+
+		uint8_t value = receiveBuffer[receiveHead];
+		receiveHead = (receiveHead + 1) % HOST_SERIAL_BUFFER_SIZE;
+		receiveCount--;
+
+		advanceTo(now + options.serialReadMicros);
+
+		return value;
+	}
+
+	// Serial output. The transmit buffer drains at the baud rate and a
+	// write waits while it is full
+
+	int bytesWaitingToSend()
+	{
+		if (transmitDoneAt <= now)
+			return 0;
+
+		return (int)((transmitDoneAt - now + byteMicros - 1) / byteMicros);
+	}
+
+	int serialAvailableForWrite()
+	{
+		int room = HOST_SERIAL_BUFFER_SIZE - 1 - bytesWaitingToSend();
+
+		return room < 0 ? 0 : room;
+	}
+
+	void serialWrite(uint8_t value)
+	{
+		while (bytesWaitingToSend() >= HOST_SERIAL_BUFFER_SIZE - 1)
+			advanceTo(transmitDoneAt - (HOST_SERIAL_BUFFER_SIZE - 2) * (uint64_t)byteMicros);
+
+		if (transmitDoneAt < now)
+			transmitDoneAt = now;
+
+		transmitDoneAt += byteMicros;
+
+		stats.bytesSent++;
+		trace(TRACE_SERIAL_OUT, value);
+
+		// The sender reacts to flow control some time after the byte
+		// reaches it
+		if (value == HOST_XOFF)
+		{
+			stats.xoffsSent++;
+			senderStopAt = transmitDoneAt + options.flowControlReactionMicros;
+			senderResumeAt = HOST_NEVER;
+		}
+		else if (value == HOST_XON && senderStopAt != HOST_NEVER)
+		{
+			senderResumeAt = transmitDoneAt + options.flowControlReactionMicros;
+		}
+	}
+
+	void serialFlush()
+	{
+		advanceTo(transmitDoneAt);
+	}
+
+	// EEPROM. A write takes 3.3ms to complete in the background and the
+	// next read or write waits for it
+
+	void eepromWait()
+	{
+		if (eepromBusyUntil > now)
+			advanceTo(eepromBusyUntil);
+	}
+
+	uint8_t eepromRead(int address)
+	{
+		eepromWait();
+		stats.eepromReads++;
+		return eeprom[address % HOST_EEPROM_SIZE];
+	}
+
+	void eepromWrite(int address, uint8_t value)
+	{
+		eepromWait();
+
+		address %= HOST_EEPROM_SIZE;
+		eeprom[address] = value;
+		stats.eepromWrites++;
+		eepromBusyUntil = now + options.eepromWriteMicros;
+
+		uint8_t data[3] = { (uint8_t)(address & 0xFF), (uint8_t)(address >> 8), value };
+		trace(TRACE_EEPROM_WRITE, data, 3);
+	}
+
+	// Pixels. Sending the colours to a strip of WS2812s takes 30
+	// microseconds a pixel with interrupts off
+
+	void showPixels(const uint8_t * colours, int count)
+	{
+		int length = count * 3;
+
+		stats.pixelFrames++;
+
+		if (length != frameLength || memcmp(colours, frame, length) != 0)
+		{
+			memcpy(frame, colours, length);
+			frameLength = length;
+			trace(TRACE_PIXELS, frame, frameLength);
+		}
+
+		holdInterrupts();
+		advanceTo(now + count * 30);
+		releaseInterrupts();
+	}
+
+	// Sound
+
+	void playTone(uint16_t frequency, uint32_t duration)
+	{
+		uint8_t data[6] = { (uint8_t)(frequency & 0xFF), (uint8_t)(frequency >> 8),
+			(uint8_t)(duration & 0xFF), (uint8_t)(duration >> 8),
+			(uint8_t)(duration >> 16), (uint8_t)(duration >> 24) };
+
+		if (frequency)
+			stats.tones++;
+
+		trace(TRACE_TONE, data, 6);
+	}
+
+	// random() from avr-libc, so that a seed gives the same numbers
+
+	int32_t nextRandom()
+	{
+		int32_t x = (int32_t)randomState;
+
+		if (x == 0)
+			x = 123459876L;
+
+		int32_t hi = x / 127773L;
+		int32_t lo = x % 127773L;
+
+		x = 16807L * lo - 2836L * hi;
+
+		if (x < 0)
+			x += 0x7fffffffL;
+
+		randomState = x;
+
+		return x % ((uint32_t)0x7fffffffL + 1);
+	}
+
+	void fillStats(HostStats * result)
+	{
+		*result = stats;
+		result->now = now;
+		result->bytesWaiting = input.size();
+	}
+
+	uint8_t eeprom[HOST_EEPROM_SIZE];
+	uint32_t randomState;
+
+	int receiveCount;
+	std::deque<HostInputByte> input;
+
+private:
+	uint64_t passStart;
+
+	int interruptsHeld;
+	bool inInterrupt;
+
+	void(*timerHandler)();
+	bool timerAttached;
+	bool timerPending;
+	uint32_t timerPeriod;
+	uint64_t timerDue;
+
+	void(*echoHandler)();
+	uint8_t echoPin;
+	bool echoPending;
+	bool echoPinLevel;
+	uint64_t echoRiseAt;
+	uint64_t echoFallAt;
+	bool triggerLevel;
+
+	uint8_t receiveBuffer[HOST_SERIAL_BUFFER_SIZE];
+	int receiveHead;
+	uint32_t byteMicros;
+	uint64_t lastArrival;
+	uint64_t senderStopAt;
+	uint64_t senderResumeAt;
+	uint64_t transmitDoneAt;
+
+	uint64_t eepromBusyUntil;
+
+	uint8_t frame[HOST_TRACE_DATA_LENGTH];
+	int frameLength;
+	uint8_t leftCoils;
+	uint8_t rightCoils;
+};
+
+HostBoard hostBoard;
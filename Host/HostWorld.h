@@ -0,0 +1,306 @@
+///////////////////////////////////////////////////////////
+/// Host world
+///////////////////////////////////////////////////////////
+
+// The robot's place in a flat world of walls, for the simulated board in
+// HostBoard.h. The board passes on every change of the coil patterns, and
+// the world turns each wheel by the angle between the old pattern and the
+// new one, as the motor would, and moves the robot. The distance sensor
+// hears the echo from the nearest wall in its beam.
+//
+// Positions are in mm and match the odometry: the robot powers on at 0,0
+// facing along y, with x to the right. The heading is in radians, positive
+// to the right.
+//
+// The wheels are the size given in HostOptions, not the size the sketch
+// has been told, so a robot with the wrong wheel settings drives the wrong
+// distance, as a real one would.
+//
+// This file is only included into Sketch.cpp, so nothing here is inline.
+
+#pragma once
+
+#include <math.h>
+#include <vector>
+
+#include "HostApi.h"
+
+// The echo timing comes from HostBoard.h, which includes this file
+
+// Half steps for one turn of the wheel of a 28BYJ-48
+#define HOST_STEPS_PER_REV 4096
+
+// The robot is touching a wall when its middle is this close to it
+#define HOST_ROBOT_RADIUS_MM 60
+
+// The sensor is this far in front of the middle of the robot
+#define HOST_SENSOR_OFFSET_MM 50
+
+// Beyond this range the sensor hears no echo
+#define HOST_SENSOR_RANGE_MM 4000
+
+// The beam is swept with this many rays and the nearest echo is the one heard
+#define HOST_BEAM_RAYS 7
+#define HOST_BEAM_HALF_ANGLE_DEGREES 15
+
+// A wall struck more than this far from square on reflects the sound away
+#define HOST_MAX_INCIDENCE_DEGREES 60
+
+// Each reading is out by up to this much either way
+#define HOST_SENSOR_NOISE_MM 5
+
+// Returns the position of a coil pattern in the half step sequence, the
+// same for both motors, or -1 if it isn't one
+
+int coilPhase(uint8_t coils)
+{
+	static const uint8_t sequence[8] = { 0x8, 0xC, 0x4, 0x6, 0x2, 0x3, 0x1, 0x9 };
+
+	for (int i = 0; i < 8; i++)
+	{
+		if (sequence[i] == coils)
+			return i;
+	}
+
+	return -1;
+}
+
+class HostWorld
+{
+public:
+	std::vector<HostWall> walls;
+
+	HostPose pose;
+
+	void powerOn(const HostOptions & options, uint32_t seed)
+	{
+		wheelDiameter = options.wheelDiameterMM;
+		wheelSpacing = options.wheelSpacingMM;
+		noiseState = seed ? seed : 1;
+
+		memset(&pose, 0, sizeof(pose));
+		pose.clearance = clearance();
+		pose.minClearance = pose.clearance;
+
+		phase[0] = -1;
+		phase[1] = -1;
+	}
+
+	void setWalls(const HostWall * newWalls, int count)
+	{
+		walls.assign(newWalls, newWalls + count);
+
+		pose.clearance = clearance();
+		pose.minClearance = pose.clearance;
+	}
+
+	// Called with the new pattern on the coils of one motor. The rotor
+	// turns to the nearest position of the new pattern, so a jump of four
+	// half steps, or a pattern that is not in the sequence, leaves it where
+	// it is. The left wheel turns forwards as the sequence goes up and the
+	// right wheel, which faces the other way, as it goes down.
+
+	void coilsChanged(bool left, uint8_t coils)
+	{
+		int side = left ? 0 : 1;
+		int newPhase = coilPhase(coils);
+
+		if (newPhase < 0)
+			return;
+
+		int oldPhase = phase[side];
+		phase[side] = newPhase;
+
+		if (oldPhase < 0)
+			return;
+
+		int halfSteps = (newPhase - oldPhase + 8) % 8;
+
+		if (halfSteps > 4)
+			halfSteps -= 8;
+		else if (halfSteps == 4)
+			return;
+
+		if (!left)
+			halfSteps = -halfSteps;
+
+		if (halfSteps != 0)
+			turnWheel(left, halfSteps);
+	}
+
+	// Returns the width of the echo pulse in microseconds for a reading
+	// taken now
+
+	uint32_t echoWidth()
+	{
+		pose.echoes++;
+
+		double distance = sensorDistance();
+
+		if (distance < 0)
+			return HOST_ECHO_TIMEOUT_MICROS;
+
+		distance += (int)(nextNoise() % (2 * HOST_SENSOR_NOISE_MM + 1)) - HOST_SENSOR_NOISE_MM;
+
+		if (distance < 0)
+			distance = 0;
+
+		return (uint32_t)(distance * HOST_ECHO_MICROS_PER_MM);
+	}
+
+private:
+	double wheelDiameter;
+	double wheelSpacing;
+	int phase[2];
+	uint32_t noiseState;
+
+	// A step of one wheel turns the robot about the other wheel and the
+	// middle of the robot moves along a chord of that circle
+
+	void turnWheel(bool left, int halfSteps)
+	{
+		double distance = halfSteps * M_PI * wheelDiameter / HOST_STEPS_PER_REV;
+
+		double turn = distance / wheelSpacing;
+
+		if (!left)
+			turn = -turn;
+
+		double chord = wheelSpacing * sin(fabs(turn) / 2.0);
+
+		if (distance < 0)
+			chord = -chord;
+
+		double chordHeading = pose.heading + turn / 2.0;
+
+		pose.x += chord * sin(chordHeading);
+		pose.y += chord * cos(chordHeading);
+		pose.heading += turn;
+
+		if (walls.empty())
+			return;
+
+		bool touching = pose.clearance < 0;
+
+		pose.clearance = clearance();
+
+		if (pose.clearance < pose.minClearance)
+			pose.minClearance = pose.clearance;
+
+		if (pose.clearance < 0 && !touching)
+			pose.collisions++;
+	}
+
+	// Returns the distance along a ray to a wall, or -1 if the ray misses it
+	// or strikes it too far from square on to hear an echo. The direction of
+	// the ray must be a unit vector.
+
+	double rayToWall(double x, double y, double dx, double dy, const HostWall & wall, double minIncidenceCos)
+	{
+		double ex = wall.x2 - wall.x1;
+		double ey = wall.y2 - wall.y1;
+
+		double cross = dx * ey - dy * ex;
+
+		double length = sqrt(ex * ex + ey * ey);
+
+		// cross / length is the cosine of the angle between the ray and the
+		// normal of the wall, which also rules out rays along the wall
+		if (fabs(cross) < minIncidenceCos * length)
+			return -1;
+
+		double wx = wall.x1 - x;
+		double wy = wall.y1 - y;
+
+		double t = (wx * ey - wy * ex) / cross;
+		double u = (wx * dy - wy * dx) / cross;
+
+		if (t < 0 || u < 0 || u > 1)
+			return -1;
+
+		return t;
+	}
+
+	// Returns the distance in mm the sensor would measure without noise,
+	// or -1 if no echo would come back
+
+	double sensorDistance()
+	{
+		double sensorX = pose.x + HOST_SENSOR_OFFSET_MM * sin(pose.heading);
+		double sensorY = pose.y + HOST_SENSOR_OFFSET_MM * cos(pose.heading);
+
+		double halfAngle = HOST_BEAM_HALF_ANGLE_DEGREES * M_PI / 180.0;
+		double minIncidenceCos = cos(HOST_MAX_INCIDENCE_DEGREES * M_PI / 180.0);
+
+		double nearest = -1;
+
+		for (int ray = 0; ray < HOST_BEAM_RAYS; ray++)
+		{
+			double angle = pose.heading - halfAngle + (2 * halfAngle * ray) / (HOST_BEAM_RAYS - 1);
+			double dx = sin(angle);
+			double dy = cos(angle);
+
+			for (size_t i = 0; i < walls.size(); i++)
+			{
+				double distance = rayToWall(sensorX, sensorY, dx, dy, walls[i], minIncidenceCos);
+
+				if (distance >= 0 && (nearest < 0 || distance < nearest))
+					nearest = distance;
+			}
+		}
+
+		if (nearest > HOST_SENSOR_RANGE_MM)
+			return -1;
+
+		return nearest;
+	}
+
+	// Returns the distance from the middle of the robot to the nearest part
+	// of a wall, less the radius of the robot
+
+	double clearance()
+	{
+		double nearest = HOST_SENSOR_RANGE_MM;
+
+		for (size_t i = 0; i < walls.size(); i++)
+		{
+			const HostWall & wall = walls[i];
+
+			double ex = wall.x2 - wall.x1;
+			double ey = wall.y2 - wall.y1;
+
+			double wx = pose.x - wall.x1;
+			double wy = pose.y - wall.y1;
+
+			double lengthSquared = ex * ex + ey * ey;
+			double u = lengthSquared > 0 ? (wx * ex + wy * ey) / lengthSquared : 0;
+
+			if (u < 0)
+				u = 0;
+
+			if (u > 1)
+				u = 1;
+
+			double dx = wx - u * ex;
+			double dy = wy - u * ey;
+
+			double distance = sqrt(dx * dx + dy * dy);
+
+			if (distance < nearest)
+				nearest = distance;
+		}
+
+		return nearest - HOST_ROBOT_RADIUS_MM;
+	}
+
+	// The noise has its own numbers so that it does not change the ones
+	// the sketch gets from random()
+
+	uint32_t nextNoise()
+	{
+		noiseState ^= noiseState << 13;
+		noiseState ^= noiseState >> 17;
+		noiseState ^= noiseState << 5;
+		return noiseState;
+	}
+};
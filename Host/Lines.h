@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////
+/// Lines
+///////////////////////////////////////////////////////////
+
+// hullhost lines - prints the statement numbers that each line of a script
+// is stored as, for patching a stored program with REn,i,c. Statements are
+// numbered from zero, as REn counts them.
+//
+// The script is sent to a robot one line at a time and the statements stored
+// are counted after each line. Lines that store nothing, such as begin, end
+// and blank lines, have no numbers. The statement that closes a block is
+// only stored when the compiler sees the line that comes out of the block,
+// so it is counted with that line, or with end.
+
+#pragma once
+
+#include "Runner.h"
+
+// Runs the robot until the bytes sent to it have been read and it has had
+// a tenth of a second to deal with them
+
+bool settleLine(Robot * robot)
+{
+	HostStats stats;
+
+	do
+	{
+		if (!runRobot(robot, robot->sketch.hostNow() + 10000))
+			return false;
+
+		robot->sketch.hostGetStats(&stats);
+	} while (stats.bytesWaiting > 0);
+
+	return runRobot(robot, robot->sketch.hostNow() + 100000);
+}
+
+int printScriptLines(const RunnerSettings & settings)
+{
+	std::string input;
+
+	if (!readInputFiles(settings, &input))
+		return 1;
+
+	Robot robot;
+
+	if (!loadRobot(&robot, settings.library.c_str(), 0))
+		return 1;
+
+	applySettings(settings, &robot.options);
+	startRobot(&robot);
+
+	// Let the robot start up before the first line
+	runRobot(&robot, robot.options.startMicros + secondsToMicros(settings.inputAt));
+
+	int result = 0;
+	int stored = 0;
+	int lineNumber = 0;
+	size_t pos = 0;
+
+	while (pos < input.size())
+	{
+		size_t end = input.find('\n', pos);
+
+		if (end == std::string::npos)
+			end = input.size();
+		else
+			end++;
+
+		std::string line = input.substr(pos, end - pos);
+		pos = end;
+		lineNumber++;
+
+		robot.sketch.hostSend((const uint8_t *)line.data(), (int)line.size(), robot.sketch.hostNow());
+
+		if (!settleLine(&robot))
+		{
+			fprintf(stderr, "hullhost: robot stalled at line %d\n", lineNumber);
+			result = 1;
+			break;
+		}
+
+		int count = robot.sketch.hostStoredStatements();
+
+		// Nothing stored yet, or a new program started
+		if (count < stored)
+			stored = 0;
+
+		while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+			line.pop_back();
+
+		if (count <= stored)
+			printf("%4d %9s  %s\n", lineNumber, "", line.c_str());
+		else if (count == stored + 1)
+			printf("%4d %9d  %s\n", lineNumber, stored, line.c_str());
+		else
+		{
+			char numbers[32];
+			snprintf(numbers, sizeof(numbers), "%d-%d", stored, count - 1);
+			printf("%4d %9s  %s\n", lineNumber, numbers, line.c_str());
+		}
+
+		if (count > stored)
+			stored = count;
+	}
+
+	unloadRobot(&robot);
+
+	return result;
+}
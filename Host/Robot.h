@@ -0,0 +1,268 @@
+///////////////////////////////////////////////////////////
+/// Robot
+///////////////////////////////////////////////////////////
+
+// One simulated robot for the runner. Each robot loads its own copy of the
+// sketch library, so each has its own globals, board and clock and robots
+// can be run side by side on different threads. Everything the runner keeps
+// about a robot is in the Robot struct.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <string>
+
+#include "HostApi.h"
+
+// Pointers to the functions exported by the sketch library
+
+struct HostSketch
+{
+#define HOST_API_POINTER(result, name, args) result(*name)args;
+	HOST_API_FUNCTIONS(HOST_API_POINTER)
+#undef HOST_API_POINTER
+};
+
+// Called with each event the board traces
+
+typedef void(*RobotWatcher)(struct Robot * robot, const HostTraceEvent * event);
+
+struct Robot
+{
+	int number;
+	void * library;
+	HostSketch sketch;
+	HostOptions options;
+
+	// FNV-1a hash of every event traced, which two runs of the same
+	// session should agree on
+	uint64_t digest;
+	uint64_t events;
+
+	// Serial output is copied here, to stdout or both
+	bool keepOutput;
+	bool echoOutput;
+	std::string output;
+
+	// The trace is written here as text if set
+	FILE * traceFile;
+
+	RobotWatcher watcher;
+	void * watcherContext;
+
+	bool stalled;
+};
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+void hashBytes(uint64_t * hash, const void * data, size_t length)
+{
+	const uint8_t * bytes = (const uint8_t *)data;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		*hash ^= bytes[i];
+		*hash *= FNV_PRIME;
+	}
+}
+
+const char * traceKindNames[] = {
+	"in", "dropped", "out", "left", "right", "pixels", "tone", "eeprom", "stall" };
+
+void writeTraceEvent(FILE * file, const HostTraceEvent * event)
+{
+	fprintf(file, "%llu %s", (unsigned long long)event->time, traceKindNames[event->kind]);
+
+	switch (event->kind)
+	{
+	case TRACE_TONE:
+		fprintf(file, " %u %u", event->data[0] | event->data[1] << 8,
+			event->data[2] | event->data[3] << 8 | event->data[4] << 16 | (unsigned)event->data[5] << 24);
+		break;
+
+	case TRACE_EEPROM_WRITE:
+		fprintf(file, " %u %02X", event->data[0] | event->data[1] << 8, event->data[2]);
+		break;
+
+	default:
+		for (int i = 0; i < event->length; i++)
+			fprintf(file, " %02X", event->data[i]);
+		break;
+	}
+
+	fputc('\n', file);
+}
+
+void robotTraceHandler(void * context, const HostTraceEvent * event)
+{
+	Robot * robot = (Robot *)context;
+
+	hashBytes(&robot->digest, &event->time, sizeof(event->time));
+	hashBytes(&robot->digest, &event->kind, 1);
+	hashBytes(&robot->digest, event->data, event->length);
+	robot->events++;
+
+	if (event->kind == TRACE_SERIAL_OUT)
+	{
+		if (robot->keepOutput)
+			robot->output += (char)event->data[0];
+
+		if (robot->echoOutput)
+			putchar(event->data[0]);
+	}
+
+	if (robot->traceFile != NULL)
+		writeTraceEvent(robot->traceFile, event);
+
+	if (robot->watcher != NULL)
+		robot->watcher(robot, event);
+}
+
+// Loads a private copy of the sketch library for the robot and fills in the
+// function table. The copy is deleted once loaded, the mapping stays.
+// Returns false and prints the reason if the library cannot be loaded.
+
+bool loadRobot(Robot * robot, const char * libraryPath, int number)
+{
+	memset(&robot->sketch, 0, sizeof(robot->sketch));
+	robot->number = number;
+	robot->library = NULL;
+	robot->digest = FNV_OFFSET;
+	robot->events = 0;
+	robot->keepOutput = false;
+	robot->echoOutput = false;
+	robot->output.clear();
+	robot->traceFile = NULL;
+	robot->watcher = NULL;
+	robot->watcherContext = NULL;
+	robot->stalled = false;
+
+	char copyPath[] = "/tmp/hullhost-XXXXXX";
+
+	int copy = mkstemp(copyPath);
+
+	if (copy < 0)
+	{
+		perror("hullhost: copy of sketch library");
+		return false;
+	}
+
+	FILE * source = fopen(libraryPath, "rb");
+
+	if (source == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot open %s\n", libraryPath);
+		close(copy);
+		unlink(copyPath);
+		return false;
+	}
+
+	char buffer[65536];
+	size_t length;
+	bool copied = true;
+
+	while ((length = fread(buffer, 1, sizeof(buffer), source)) > 0)
+	{
+		if (write(copy, buffer, length) != (ssize_t)length)
+			copied = false;
+	}
+
+	fclose(source);
+	close(copy);
+
+	if (copied)
+		robot->library = dlopen(copyPath, RTLD_NOW | RTLD_LOCAL);
+
+	unlink(copyPath);
+
+	if (robot->library == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot load %s: %s\n", libraryPath, copied ? dlerror() : "copy failed");
+		return false;
+	}
+
+#define HOST_API_LOAD(result, name, args) \
+	robot->sketch.name = (result(*)args)dlsym(robot->library, #name); \
+	if (robot->sketch.name == NULL) \
+	{ \
+		fprintf(stderr, "hullhost: %s has no %s\n", libraryPath, #name); \
+		return false; \
+	}
+	HOST_API_FUNCTIONS(HOST_API_LOAD)
+#undef HOST_API_LOAD
+
+	if (robot->sketch.hostApiVersion() != HOST_API_VERSION)
+	{
+		fprintf(stderr, "hullhost: %s is for a different version of the runner\n", libraryPath);
+		return false;
+	}
+
+	robot->sketch.hostDefaultOptions(&robot->options);
+
+	return true;
+}
+
+// Powers the robot on with its options and runs setup(), with the EEPROM
+// holding the given image or erased
+
+void startRobot(Robot * robot, const std::string * eeprom = NULL)
+{
+	robot->sketch.hostPowerOn(&robot->options);
+	robot->sketch.hostSetTrace(robotTraceHandler, robot);
+
+	if (eeprom != NULL)
+		robot->sketch.hostLoadEEPROM((const uint8_t *)eeprom->data(), (int)eeprom->size());
+
+	if (robot->sketch.hostSetup())
+		robot->stalled = true;
+}
+
+// Runs the robot until its clock reaches the given time
+// Returns false if it has stalled
+
+bool runRobot(Robot * robot, uint64_t micros)
+{
+	if (robot->stalled)
+		return false;
+
+	if (robot->sketch.hostRunUntil(micros))
+		robot->stalled = true;
+
+	return !robot->stalled;
+}
+
+void unloadRobot(Robot * robot)
+{
+	if (robot->library != NULL)
+		dlclose(robot->library);
+
+	robot->library = NULL;
+}
+
+// Reads a whole file, returning false if it cannot be read
+
+bool readFile(const char * path, std::string * contents)
+{
+	FILE * file = fopen(path, "rb");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot open %s\n", path);
+		return false;
+	}
+
+	char buffer[4096];
+	size_t length;
+
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		contents->append(buffer, length);
+
+	fclose(file);
+
+	return true;
+}
@@ -0,0 +1,217 @@
+///////////////////////////////////////////////////////////
+/// Runner settings
+///////////////////////////////////////////////////////////
+
+// Settings shared by the hullhost commands, read from the command line in
+// hullhost.cpp. Board options left unset keep the defaults from the sketch
+// library, see hostDefaultOptions() in Sketch.cpp.
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Robot.h"
+
+#define NOT_SET -1
+
+struct RunnerSettings
+{
+	std::string library;
+	std::vector<std::string> files;
+
+	// Board options
+	int64_t seed = NOT_SET;
+	int64_t startMicros = NOT_SET;
+	int64_t distanceInMM = NOT_SET;
+	int64_t loopPassMicros = NOT_SET;
+	int64_t eepromWriteMicros = NOT_SET;
+	int64_t reactionMicros = NOT_SET;
+	int pacedInput = NOT_SET;
+	int senderHonoursFlowControl = NOT_SET;
+
+	// Seconds from power on to sending the input
+	double inputAt = 1.0;
+	// Seconds to keep running after the input has arrived
+	double seconds = 10;
+
+	std::string traceFile;
+	std::string eepromIn;
+	std::string eepromOut;
+	std::string recordFile;
+	std::string digest;
+
+	bool stats = false;
+	bool quiet = false;
+
+	// warp
+	double lead = 30;
+	double after = 60;
+	int phases = 8;
+	double days = 1;
+	double stepGap = 50;
+
+	// world
+	std::string worldFile;
+	double limit = 300;
+	bool poses = false;
+
+	// fleet
+	int robots = 16;
+	int threads = 0;
+	double slice = 0.1;
+	bool sameSeed = false;
+};
+
+void applySettings(const RunnerSettings & settings, HostOptions * options)
+{
+	if (settings.seed != NOT_SET)
+		options->seed = (uint32_t)settings.seed;
+	if (settings.startMicros != NOT_SET)
+		options->startMicros = (uint64_t)settings.startMicros;
+	if (settings.distanceInMM != NOT_SET)
+		options->distanceInMM = (uint32_t)settings.distanceInMM;
+	if (settings.loopPassMicros != NOT_SET)
+		options->loopPassMicros = (uint32_t)settings.loopPassMicros;
+	if (settings.eepromWriteMicros != NOT_SET)
+		options->eepromWriteMicros = (uint32_t)settings.eepromWriteMicros;
+	if (settings.reactionMicros != NOT_SET)
+		options->flowControlReactionMicros = (uint32_t)settings.reactionMicros;
+	if (settings.pacedInput != NOT_SET)
+		options->pacedInput = settings.pacedInput != 0;
+	if (settings.senderHonoursFlowControl != NOT_SET)
+		options->senderHonoursFlowControl = settings.senderHonoursFlowControl != 0;
+}
+
+// Reads the files named on the command line into one string of input
+
+bool readInputFiles(const RunnerSettings & settings, std::string * input)
+{
+	for (size_t i = 0; i < settings.files.size(); i++)
+	{
+		if (!readFile(settings.files[i].c_str(), input))
+			return false;
+	}
+
+	return true;
+}
+
+uint64_t secondsToMicros(double seconds)
+{
+	return (uint64_t)(seconds * 1000000.0 + 0.5);
+}
+
+double wallSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void printStats(FILE * file, Robot * robot)
+{
+	HostStats stats;
+	robot->sketch.hostGetStats(&stats);
+
+	fprintf(file, "time %.3f s, loop passes %llu, longest pass %.1f ms%s\n",
+		(stats.now - robot->options.startMicros) / 1e6, (unsigned long long)stats.loopPasses,
+		stats.longestPassMicros / 1e3, stats.stalled ? ", stalled" : "");
+	fprintf(file, "serial received %llu, dropped %llu, sent %llu, XOFFs %llu\n",
+		(unsigned long long)stats.bytesReceived, (unsigned long long)stats.bytesDropped,
+		(unsigned long long)stats.bytesSent, (unsigned long long)stats.xoffsSent);
+	fprintf(file, "EEPROM reads %llu, writes %llu\n",
+		(unsigned long long)stats.eepromReads, (unsigned long long)stats.eepromWrites);
+	fprintf(file, "timer interrupts %llu, steps %llu left %llu right, pixel frames %llu, tones %llu\n",
+		(unsigned long long)stats.timerInterrupts, (unsigned long long)stats.leftSteps,
+		(unsigned long long)stats.rightSteps, (unsigned long long)stats.pixelFrames,
+		(unsigned long long)stats.tones);
+	fprintf(file, "trace events %llu, digest %016llx\n",
+		(unsigned long long)robot->events, (unsigned long long)robot->digest);
+}
+
+// Opens the trace file named in the settings, if there is one
+
+bool openTrace(const RunnerSettings & settings, Robot * robot)
+{
+	if (settings.traceFile.empty())
+		return true;
+
+	robot->traceFile = fopen(settings.traceFile.c_str(), "w");
+
+	if (robot->traceFile == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot write %s\n", settings.traceFile.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void closeTrace(Robot * robot)
+{
+	if (robot->traceFile != NULL)
+		fclose(robot->traceFile);
+
+	robot->traceFile = NULL;
+}
+
+bool saveEEPROM(const RunnerSettings & settings, Robot * robot)
+{
+	if (settings.eepromOut.empty())
+		return true;
+
+	uint8_t image[HOST_EEPROM_SIZE];
+	robot->sketch.hostReadEEPROM(image, sizeof(image));
+
+	FILE * file = fopen(settings.eepromOut.c_str(), "wb");
+
+	if (file == NULL || fwrite(image, 1, sizeof(image), file) != sizeof(image))
+	{
+		fprintf(stderr, "hullhost: cannot write %s\n", settings.eepromOut.c_str());
+		if (file != NULL)
+			fclose(file);
+		return false;
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+// Runs the robot until it has been idle for a second after the last of its
+// input has arrived, or for the given number of seconds after that. Returns
+// the time it first went idle after the input, or HOST_NEVER if it did not.
+
+uint64_t runUntilSettled(Robot * robot, double seconds, uint64_t inputAt)
+{
+	uint64_t limit = HOST_NEVER;
+	uint64_t idleSince = HOST_NEVER;
+	uint64_t firstIdle = HOST_NEVER;
+	uint64_t now = robot->sketch.hostNow();
+
+	while (now < limit && runRobot(robot, now + 10000))
+	{
+		now = robot->sketch.hostNow();
+
+		HostStats stats;
+		robot->sketch.hostGetStats(&stats);
+
+		if (stats.bytesWaiting > 0 || now < inputAt)
+			continue;
+
+		if (limit == HOST_NEVER)
+			limit = now + secondsToMicros(seconds);
+
+		if (!robot->sketch.hostRobotIdle())
+			idleSince = HOST_NEVER;
+		else if (idleSince == HOST_NEVER)
+		{
+			idleSince = now;
+			if (firstIdle == HOST_NEVER)
+				firstIdle = now;
+		}
+		else if (now - idleSince >= 1000000)
+			break;
+	}
+
+	return firstIdle;
+}
@@ -0,0 +1,446 @@
+///////////////////////////////////////////////////////////
+/// Serial sessions
+///////////////////////////////////////////////////////////
+
+// Recording and replay of what was sent to a robot over the serial port.
+//
+// hullhost run --record log   records a session with a simulated robot
+// hullhost relay device log   records a session with a real robot, passing
+//                             the bytes between a pseudo terminal and the
+//                             robot's serial port
+// hullhost replay log         sends the bytes in the log to a simulated robot
+//                             at the times they arrived before
+//
+// A log is text. Each byte sent to the robot is a line giving the time in
+// microseconds from power on, or from the start of the relay, and the byte
+// in hex. Bytes the robot sent back are lines with "out" between the two.
+// Recordings from the simulated robot also give the seed, the start time of
+// the clock and the EEPROM at power on, so a replay starts from the same
+// state and leaves the same trace, down to the pixel frames, motor steps and
+// EEPROM writes. A relay log has no EEPROM image, so a replay of one starts
+// with the EEPROM erased unless --eeprom is given. Its times are from the
+// start of the relay and bytes read together share a time, so they are sent
+// from --at seconds after power on and no faster than the baud rate allows.
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+
+#include "Runner.h"
+
+struct SessionByte
+{
+	uint64_t time;
+	uint8_t value;
+};
+
+struct SessionLog
+{
+	bool haveSeed;
+	uint32_t seed;
+	uint64_t startMicros;
+	std::string eeprom;
+	std::vector<SessionByte> input;
+	std::string output;
+};
+
+#define SESSION_EEPROM_LINE 32
+
+void writeSessionHeader(FILE * log, const char * source)
+{
+	fprintf(log, "# HullOS serial session from %s\n", source);
+}
+
+void writeSessionState(FILE * log, const HostOptions * options, const uint8_t * eeprom)
+{
+	fprintf(log, "seed %u\n", options->seed);
+	fprintf(log, "start %llu\n", (unsigned long long)options->startMicros);
+
+	for (int address = 0; address < HOST_EEPROM_SIZE; address += SESSION_EEPROM_LINE)
+	{
+		fprintf(log, "eeprom %d ", address);
+
+		for (int i = 0; i < SESSION_EEPROM_LINE; i++)
+			fprintf(log, "%02X", eeprom[address + i]);
+
+		fputc('\n', log);
+	}
+}
+
+void writeSessionByte(FILE * log, uint64_t time, bool output, uint8_t value)
+{
+	fprintf(log, output ? "%llu out %02X\n" : "%llu %02X\n", (unsigned long long)time, value);
+}
+
+// Returns false and prints the line if the log cannot be read
+
+bool readSessionLog(const char * path, SessionLog * session)
+{
+	FILE * file = fopen(path, "r");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot open %s\n", path);
+		return false;
+	}
+
+	session->haveSeed = false;
+	session->startMicros = 0;
+
+	char line[256];
+	int lineNo = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), file) != NULL)
+	{
+		lineNo++;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		unsigned long long time;
+		unsigned int value;
+		unsigned int address;
+		char hex[2 * SESSION_EEPROM_LINE + 1];
+
+		if (sscanf(line, "seed %u", &value) == 1)
+		{
+			session->seed = value;
+			session->haveSeed = true;
+		}
+		else if (sscanf(line, "start %llu", &time) == 1)
+			session->startMicros = time;
+		else if (sscanf(line, "eeprom %u %64s", &address, hex) == 2)
+		{
+			session->eeprom.resize(HOST_EEPROM_SIZE, (char)0xFF);
+
+			for (int i = 0; hex[2 * i] && hex[2 * i + 1] && address + i < HOST_EEPROM_SIZE; i++)
+			{
+				char pair[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+				session->eeprom[address + i] = (char)strtoul(pair, NULL, 16);
+			}
+		}
+		else if (sscanf(line, "%llu out %x", &time, &value) == 2)
+			session->output += (char)value;
+		else if (sscanf(line, "%llu %x", &time, &value) == 2)
+		{
+			SessionByte b;
+			b.time = time;
+			b.value = (uint8_t)value;
+			session->input.push_back(b);
+		}
+		else
+			ok = false;
+	}
+
+	fclose(file);
+
+	if (!ok)
+		fprintf(stderr, "hullhost: %s line %d: %s", path, lineNo, line);
+
+	return ok;
+}
+
+// Writes each byte that arrives at the robot, and each byte it sends, to the
+// log given as the watcher context
+
+void recordSessionEvent(Robot * robot, const HostTraceEvent * event)
+{
+	FILE * log = (FILE *)robot->watcherContext;
+	uint64_t time = event->time - robot->options.startMicros;
+
+	switch (event->kind)
+	{
+	case TRACE_SERIAL_IN:
+	case TRACE_SERIAL_DROPPED:
+		writeSessionByte(log, time, false, event->data[0]);
+		break;
+
+	case TRACE_SERIAL_OUT:
+		writeSessionByte(log, time, true, event->data[0]);
+		break;
+	}
+}
+
+// Starts recording the session with the robot, which must not have been
+// started yet. Returns the log, or NULL if it cannot be written.
+
+FILE * startSessionRecording(const char * path, Robot * robot, const std::string & eeprom)
+{
+	FILE * log = fopen(path, "w");
+
+	if (log == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot write %s\n", path);
+		return NULL;
+	}
+
+	uint8_t image[HOST_EEPROM_SIZE];
+
+	memset(image, 0xFF, sizeof(image));
+	memcpy(image, eeprom.data(), eeprom.size() < sizeof(image) ? eeprom.size() : sizeof(image));
+
+	writeSessionHeader(log, "the host build");
+	writeSessionState(log, &robot->options, image);
+
+	robot->watcher = recordSessionEvent;
+	robot->watcherContext = log;
+
+	return log;
+}
+
+// Sends the bytes in a log to a robot at the times they arrived when the log
+// was made. Reports how long after the last byte the robot went idle, which
+// can be used to time a change to the firmware, and whether the robot sent
+// back what the log says. With --digest the trace must match the one given.
+
+int replaySession(const RunnerSettings & settings)
+{
+	if (settings.files.size() != 1)
+	{
+		fprintf(stderr, "hullhost: replay needs one log\n");
+		return 2;
+	}
+
+	const char * path = settings.files[0].c_str();
+
+	SessionLog session;
+
+	if (!readSessionLog(path, &session))
+		return 1;
+
+	if (!settings.eepromIn.empty())
+	{
+		session.eeprom.clear();
+		if (!readFile(settings.eepromIn.c_str(), &session.eeprom))
+			return 1;
+	}
+
+	Robot robot;
+
+	if (!loadRobot(&robot, settings.library.c_str(), 0))
+		return 1;
+
+	if (session.haveSeed)
+		robot.options.seed = session.seed;
+
+	robot.options.startMicros = session.startMicros;
+	applySettings(settings, &robot.options);
+
+	bool relayed = !session.haveSeed;
+
+	robot.options.pacedInput = relayed;
+	robot.options.senderHonoursFlowControl = false;
+
+	robot.keepOutput = true;
+	robot.echoOutput = !settings.quiet;
+
+	if (!openTrace(settings, &robot))
+		return 1;
+
+	double wallStart = wallSeconds();
+
+	startRobot(&robot, session.eeprom.empty() ? NULL : &session.eeprom);
+
+	uint64_t start = robot.options.startMicros;
+	uint64_t offset = relayed ? secondsToMicros(settings.inputAt) : 0;
+	uint64_t lastByte = start;
+
+	for (size_t i = 0; i < session.input.size(); i++)
+	{
+		lastByte = start + offset + session.input[i].time;
+		robot.sketch.hostSend(&session.input[i].value, 1, lastByte);
+	}
+
+	uint64_t idleAt = runUntilSettled(&robot, settings.seconds, lastByte);
+
+	double wall = wallSeconds() - wallStart;
+
+	fflush(stdout);
+	closeTrace(&robot);
+
+	if (!settings.quiet)
+		printf("\n");
+
+	printf("replayed %d bytes from %s, the last at %.3f s\n", (int)session.input.size(), path,
+		(lastByte - start) / 1e6);
+
+	if (robot.stalled)
+		printf("stalled at %.3f s\n", (robot.sketch.hostNow() - start) / 1e6);
+	else if (idleAt == HOST_NEVER)
+		printf("still busy %.3f s after the last byte\n", settings.seconds);
+	else
+		printf("idle %.3f s after the last byte\n", (idleAt - lastByte) / 1e6);
+
+	if (!session.output.empty())
+	{
+		size_t same = 0;
+
+		while (same < session.output.size() && same < robot.output.size() &&
+			session.output[same] == robot.output[same])
+			same++;
+
+		if (same == session.output.size() && same == robot.output.size())
+			printf("output matches the log\n");
+		else
+			printf("output differs from the log after %d of %d bytes\n", (int)same, (int)session.output.size());
+	}
+
+	printf("trace digest %016llx, %llu events, %.3f s of wall time\n",
+		(unsigned long long)robot.digest, (unsigned long long)robot.events, wall);
+
+	if (settings.stats)
+		printStats(stdout, &robot);
+
+	bool ok = !robot.stalled;
+
+	if (!settings.digest.empty() && strtoull(settings.digest.c_str(), NULL, 16) != robot.digest)
+	{
+		printf("trace digest should be %s\n", settings.digest.c_str());
+		ok = false;
+	}
+
+	if (!saveEEPROM(settings, &robot))
+		ok = false;
+
+	unloadRobot(&robot);
+
+	return ok ? 0 : 1;
+}
+
+// Relays between a pseudo terminal, for the program that talks to the robot,
+// and the robot's serial port, logging the bytes each way until interrupted
+
+volatile sig_atomic_t relayStopping = 0;
+
+void stopRelay(int signal)
+{
+	relayStopping = 1;
+}
+
+bool makeRaw(int fd, speed_t speed)
+{
+	struct termios settings;
+
+	if (tcgetattr(fd, &settings) != 0)
+		return false;
+
+	cfmakeraw(&settings);
+	settings.c_cflag |= CLOCAL | CREAD;
+
+	if (speed != 0)
+	{
+		cfsetispeed(&settings, speed);
+		cfsetospeed(&settings, speed);
+	}
+
+	return tcsetattr(fd, TCSANOW, &settings) == 0;
+}
+
+int relaySession(const RunnerSettings & settings)
+{
+	if (settings.files.size() != 2)
+	{
+		fprintf(stderr, "hullhost: relay needs the serial port and a log\n");
+		return 2;
+	}
+
+	const char * devicePath = settings.files[0].c_str();
+
+	int device = open(devicePath, O_RDWR | O_NOCTTY);
+
+	if (device < 0 || !makeRaw(device, B1200))
+	{
+		fprintf(stderr, "hullhost: cannot open %s: %s\n", devicePath, strerror(errno));
+		return 1;
+	}
+
+	int terminal = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (terminal < 0 || grantpt(terminal) != 0 || unlockpt(terminal) != 0)
+	{
+		perror("hullhost: pseudo terminal");
+		return 1;
+	}
+
+	// Held open so that the terminal stays up between programs using it
+	int terminalSide = open(ptsname(terminal), O_RDWR | O_NOCTTY);
+
+	if (terminalSide < 0 || !makeRaw(terminalSide, 0))
+	{
+		perror("hullhost: pseudo terminal");
+		return 1;
+	}
+
+	FILE * log = fopen(settings.files[1].c_str(), "w");
+
+	if (log == NULL)
+	{
+		fprintf(stderr, "hullhost: cannot write %s\n", settings.files[1].c_str());
+		return 1;
+	}
+
+	writeSessionHeader(log, devicePath);
+
+	printf("relaying %s to %s, interrupt to stop\n", ptsname(terminal), devicePath);
+	fflush(stdout);
+
+	signal(SIGINT, stopRelay);
+	signal(SIGTERM, stopRelay);
+
+	double start = wallSeconds();
+	int bytesIn = 0;
+	int bytesOut = 0;
+
+	while (!relayStopping)
+	{
+		struct pollfd fds[2] = { { terminal, POLLIN, 0 }, { device, POLLIN, 0 } };
+
+		if (poll(fds, 2, 100) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		uint8_t buffer[256];
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (!(fds[i].revents & POLLIN))
+				continue;
+
+			ssize_t length = read(fds[i].fd, buffer, sizeof(buffer));
+
+			if (length <= 0)
+				continue;
+
+			uint64_t time = secondsToMicros(wallSeconds() - start);
+			bool fromRobot = fds[i].fd == device;
+
+			if (write(fromRobot ? terminal : device, buffer, length) != length)
+				fprintf(stderr, "hullhost: short write to %s\n", fromRobot ? "terminal" : devicePath);
+
+			for (ssize_t j = 0; j < length; j++)
+				writeSessionByte(log, time, fromRobot, buffer[j]);
+
+			if (fromRobot)
+				bytesOut += (int)length;
+			else
+				bytesIn += (int)length;
+		}
+	}
+
+	fclose(log);
+	close(terminalSide);
+	close(terminal);
+	close(device);
+
+	printf("logged %d bytes to the robot and %d back\n", bytesIn, bytesOut);
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+// The HullOS sketch built as a shared library for the host, on the simulated
+// board in HostBoard.h. The runner loads a separate copy of the library for
+// each robot, see Robot.h, and drives it through the functions at the end of
+// this file.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <TimerOne.h>
+#include <Adafruit_NeoPixel.h>
+
+#include "HostApi.h"
+
+// The sketch folder is on the include path, see SKETCH in the Makefile
+#include "HullOS.ino"
+
+#define HOST_EXPORT extern "C" __attribute__((visibility("default")))
+
+HOST_EXPORT int hostApiVersion()
+{
+	return HOST_API_VERSION;
+}
+
+HOST_EXPORT void hostDefaultOptions(HostOptions * options)
+{
+	memset(options, 0, sizeof(HostOptions));
+
+	options->seed = 1;
+	options->loopPassMicros = 200;
+	options->serialReadMicros = 50;
+	options->eepromWriteMicros = 3300;
+	options->watchdogMicros = 30000000;
+	options->pacedInput = true;
+	options->senderHonoursFlowControl = true;
+	options->flowControlReactionMicros = 20000;
+	options->lightLevel = 512;
+	options->wheelDiameterMM = 69;
+	options->wheelSpacingMM = 110;
+}
+
+HOST_EXPORT void hostPowerOn(const HostOptions * options)
+{
+	hostBoard.powerOn(*options);
+	hostBoard.randomState = options->seed;
+}
+
+HOST_EXPORT void hostSetTrace(HostTraceHandler handler, void * context)
+{
+	hostBoard.setTrace(handler, context);
+}
+
+HOST_EXPORT void hostLoadEEPROM(const uint8_t * image, int length)
+{
+	if (length > HOST_EEPROM_SIZE)
+		length = HOST_EEPROM_SIZE;
+
+	memcpy(hostBoard.eeprom, image, length);
+}
+
+HOST_EXPORT void hostReadEEPROM(uint8_t * image, int length)
+{
+	if (length > HOST_EEPROM_SIZE)
+		length = HOST_EEPROM_SIZE;
+
+	memcpy(image, hostBoard.eeprom, length);
+}
+
+HOST_EXPORT void hostSend(const uint8_t * bytes, int length, uint64_t atMicros)
+{
+	hostBoard.send(bytes, length, atMicros);
+}
+
+HOST_EXPORT void hostSetDistance(uint32_t distanceInMM)
+{
+	hostBoard.options.distanceInMM = distanceInMM;
+}
+
+// The walls are kept when the robot is powered on again
+
+HOST_EXPORT void hostSetWorld(const HostWall * walls, int count)
+{
+	hostBoard.world.setWalls(walls, count);
+}
+
+HOST_EXPORT void hostGetPose(HostPose * pose)
+{
+	*pose = hostBoard.world.pose;
+}
+
+// Returns 0, or 1 if the robot has stalled
+
+HOST_EXPORT int hostSetup()
+{
+	try
+	{
+		hostBoard.startPass();
+		setup();
+		hostBoard.endPass();
+	}
+	catch (HostStall &)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+// Runs passes through loop() until the clock reaches the given time
+// Returns 0, or 1 if the robot has stalled, now or before
+
+HOST_EXPORT int hostRunUntil(uint64_t micros)
+{
+	if (hostBoard.stats.stalled)
+		return 1;
+
+	try
+	{
+		while (hostBoard.now < micros)
+		{
+			hostBoard.startPass();
+			loop();
+			hostBoard.endPass();
+		}
+	}
+	catch (HostStall &)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+HOST_EXPORT uint64_t hostNow()
+{
+	return hostBoard.now;
+}
+
+// True when there is nothing left for the robot to do: no input waiting,
+// no program running and the motors and sound stopped
+
+HOST_EXPORT bool hostRobotIdle()
+{
+	return hostBoard.input.empty() && hostBoard.receiveCount == 0 &&
+		deviceState == EXECUTE_IMMEDIATELY && programState == PROGRAM_STOPPED &&
+		!motorsMoving() && tuneNotes == NULL;
+}
+
+HOST_EXPORT void hostGetStats(HostStats * stats)
+{
+	hostBoard.fillStats(stats);
+}
+
+// The number of statements stored by the download in progress, or by the
+// last download once it has finished, or -1 if there has not been one.
+// The EEPROM is read without the board's timing so that the robot is not
+// held up.
+
+HOST_EXPORT int hostStoredStatements()
+{
+	int start = downloadStart;
+	int end = programWriteBase;
+
+	if (deviceState != STORE_PROGRAM)
+	{
+		programSlot entry;
+		memcpy(&entry, hostBoard.eeprom + PROGRAM_SLOTS_OFFSET + downloadSlot * sizeof(programSlot),
+			sizeof(programSlot));
+
+		if (entry.length == 0)
+			return -1;
+
+		start = entry.offset;
+		end = entry.offset + entry.programLength;
+	}
+
+	int count = 0;
+
+	for (int pos = start; pos < end && pos < HOST_EEPROM_SIZE; pos++)
+	{
+		if (hostBoard.eeprom[pos] == STATEMENT_TERMINATOR)
+			count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////
+/// Thread pool
+///////////////////////////////////////////////////////////
+
+// A fixed set of worker threads for running robots side by side. forEach()
+// hands out the indices to whichever thread is free and returns when all of
+// them are done, so the caller can keep the robots in step.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	ThreadPool(int threads) : generation(0), busy(0), stopping(false)
+	{
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&ThreadPool::work, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wake.notify_all();
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	int size()
+	{
+		return (int)workers.size();
+	}
+
+	// Calls job(i) for each i from 0 to count - 1 and waits for them all
+
+	void forEach(int count, std::function<void(int)> job)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		currentJob = job;
+		jobCount = count;
+		nextIndex = 0;
+		busy = (int)workers.size();
+		generation++;
+
+		wake.notify_all();
+		done.wait(lock, [this] { return busy == 0; });
+	}
+
+private:
+	void work()
+	{
+		unsigned long seen = 0;
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+
+				if (stopping)
+					return;
+
+				seen = generation;
+			}
+
+			int i;
+
+			while ((i = nextIndex++) < jobCount)
+				currentJob(i);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--busy == 0)
+					done.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	std::function<void(int)> currentJob;
+	int jobCount;
+	std::atomic<int> nextIndex;
+
+	unsigned long generation;
+	int busy;
+	bool stopping;
+};
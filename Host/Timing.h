@@ -0,0 +1,538 @@
+///////////////////////////////////////////////////////////
+/// Motor timing
+///////////////////////////////////////////////////////////
+
+// hullhost timing - measures the step timing of the motors, the drive modes
+// and go to point moves on the simulated board.
+//
+// Each test is a script made up here and run on a robot of its own. The
+// script prints a number before and after each move, and the steps the board
+// traces between two of these lines are the steps of that move. So the
+// timings include the interrupt latency and the time strip.show() holds the
+// interrupts off, as they would on the robot.
+//
+// The sweep makes a straight move and arcs of several radii, each in several
+// times. The steps of a wheel that makes N steps in a move of T seconds
+// should come every T/N seconds. The move is taken to start T/N before the
+// first step of whichever wheel steps first, and each step is compared with
+// its ideal time from there. For each wheel it reports:
+//
+// steps    steps made
+// mean     mean of the errors, in microseconds
+// max      largest error
+// drift    error of the last step
+//
+// then the mean and largest difference between the errors of the two wheels
+// at each step, the difference between the time the last step was made and
+// the time asked for, and the number of timer interrupts.
+//
+// The drive mode test drives 200mm as fast as it can in half step and full
+// step drive and reports the speed and the interrupt rate, with the errors of
+// the left wheel from an even spacing of its steps.
+//
+// The go to point test drives round a slalom of waypoints and compares where
+// the robot really is, from HostWorld.h, with the waypoint and with where its
+// odometry says it is. The time for each waypoint includes printing the
+// position, about a fifth of a second at 1200 baud.
+
+#pragma once
+
+#include <math.h>
+
+#include "Runner.h"
+
+struct TimingLine
+{
+	std::string text;
+	uint64_t time;
+	uint64_t interrupts;
+	HostPose pose;
+};
+
+struct TimingMonitor
+{
+	// Times of the steps of each wheel
+	std::vector<uint64_t> steps[2];
+	std::vector<TimingLine> lines;
+	std::string line;
+};
+
+void watchTiming(Robot * robot, const HostTraceEvent * event)
+{
+	TimingMonitor * monitor = (TimingMonitor *)robot->watcherContext;
+
+	switch (event->kind)
+	{
+	case TRACE_LEFT_STEP:
+	case TRACE_RIGHT_STEP:
+		// The coils are turned off at the end of a move, which is not a step
+		if (event->data[0] != 0)
+			monitor->steps[event->kind == TRACE_RIGHT_STEP].push_back(event->time);
+		break;
+
+	case TRACE_SERIAL_OUT:
+	{
+		char c = (char)event->data[0];
+
+		if (c == '\r')
+			break;
+
+		if (c != '\n')
+		{
+			monitor->line += c;
+			break;
+		}
+
+		HostStats stats;
+		robot->sketch.hostGetStats(&stats);
+
+		TimingLine line;
+		line.text = monitor->line;
+		line.time = event->time;
+		line.interrupts = stats.timerInterrupts;
+		robot->sketch.hostGetPose(&line.pose);
+
+		monitor->lines.push_back(line);
+		monitor->line.clear();
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+// Runs the script on a new robot until it settles, watching the steps and
+// the lines it prints
+
+bool runTimingScript(const RunnerSettings & settings, const std::string & script, TimingMonitor * monitor)
+{
+	Robot robot;
+
+	if (!loadRobot(&robot, settings.library.c_str(), 0))
+		return false;
+
+	applySettings(settings, &robot.options);
+
+	robot.watcher = watchTiming;
+	robot.watcherContext = monitor;
+
+	startRobot(&robot);
+
+	uint64_t inputAt = robot.options.startMicros + secondsToMicros(settings.inputAt);
+
+	robot.sketch.hostSend((const uint8_t *)script.data(), (int)script.size(), inputAt);
+
+	runUntilSettled(&robot, settings.seconds, inputAt);
+
+	bool stalled = robot.stalled;
+
+	if (stalled)
+		fprintf(stderr, "hullhost: robot stalled\n");
+
+	unloadRobot(&robot);
+
+	return !stalled;
+}
+
+// Returns the index of the line that is just the given number, or -1
+
+int findMarker(const TimingMonitor & monitor, int number)
+{
+	std::string text = std::to_string(number);
+
+	for (size_t i = 0; i < monitor.lines.size(); i++)
+	{
+		if (monitor.lines[i].text == text)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+// Returns the steps of one wheel made between two times
+
+std::vector<uint64_t> stepsBetween(const std::vector<uint64_t> & steps, uint64_t from, uint64_t to)
+{
+	std::vector<uint64_t> result;
+
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		if (steps[i] > from && steps[i] <= to)
+			result.push_back(steps[i]);
+	}
+
+	return result;
+}
+
+// Returns the error of each step from an even spacing of the steps over the
+// move, which starts one interval before the given time
+
+std::vector<double> stepErrors(const std::vector<uint64_t> & steps, double start, double seconds)
+{
+	std::vector<double> errors;
+
+	double interval = seconds * 1e6 / steps.size();
+
+	for (size_t i = 0; i < steps.size(); i++)
+		errors.push_back(steps[i] - (start + (i + 1) * interval));
+
+	return errors;
+}
+
+struct WheelTiming
+{
+	double mean = 0;
+	double max = 0;
+	double drift = 0;
+};
+
+WheelTiming summariseErrors(const std::vector<double> & errors)
+{
+	WheelTiming timing;
+
+	for (size_t i = 0; i < errors.size(); i++)
+	{
+		timing.mean += fabs(errors[i]);
+		timing.max = std::max(timing.max, fabs(errors[i]));
+	}
+
+	if (!errors.empty())
+	{
+		timing.mean /= errors.size();
+		timing.drift = errors.back();
+	}
+
+	return timing;
+}
+
+// The difference between the errors of the two wheels, taken at each step of
+// either wheel against the last step of the other
+
+void syncErrors(const std::vector<uint64_t> * steps, const std::vector<double> * errors, double * mean, double * max)
+{
+	double total = 0;
+	int samples = 0;
+
+	*max = 0;
+
+	for (int wheel = 0; wheel < 2; wheel++)
+	{
+		const std::vector<uint64_t> & own = steps[wheel];
+		const std::vector<uint64_t> & other = steps[1 - wheel];
+
+		size_t last = 0;
+
+		for (size_t i = 0; i < own.size(); i++)
+		{
+			while (last + 1 < other.size() && other[last + 1] <= own[i])
+				last++;
+
+			if (other.empty() || other[last] > own[i])
+				continue;
+
+			double difference = fabs(errors[wheel][i] - errors[1 - wheel][last]);
+
+			total += difference;
+			samples++;
+			*max = std::max(*max, difference);
+		}
+	}
+
+	*mean = samples ? total / samples : 0;
+}
+
+const int timingRadii[] = { 0, 60, 100, 200, 500 };
+const int timingMoveTimes[] = { 2, 5, 10, 20 };
+
+#define TIMING_STRAIGHT_DISTANCE 100
+#define TIMING_ARC_ANGLE 90
+
+bool timingSweep(const RunnerSettings & settings)
+{
+	struct SweepMove
+	{
+		int radius;
+		int time;
+	};
+
+	// A radius of -1 is the straight move
+	std::vector<SweepMove> moves;
+
+	for (int time : timingMoveTimes)
+	{
+		moves.push_back({ -1, time });
+
+		for (int radius : timingRadii)
+			moves.push_back({ radius, time });
+	}
+
+	std::string script = "begin\nprintln 0\n";
+
+	for (size_t i = 0; i < moves.size(); i++)
+	{
+		if (moves[i].radius < 0)
+			script += "move " + std::to_string(TIMING_STRAIGHT_DISTANCE);
+		else
+			script += "arc " + std::to_string(moves[i].radius) + " angle " + std::to_string(TIMING_ARC_ANGLE);
+
+		script += " intime " + std::to_string(moves[i].time * 10) + "\n";
+		script += "println " + std::to_string(i + 1) + "\n";
+	}
+
+	script += "end\n";
+
+	TimingMonitor monitor;
+
+	if (!runTimingScript(settings, script, &monitor))
+		return false;
+
+	printf("radius,angle,time,lsteps,lmean,lmax,ldrift,rsteps,rmean,rmax,rdrift,syncmean,syncmax,moveerror,interrupts\n");
+
+	for (size_t i = 0; i < moves.size(); i++)
+	{
+		if (moves[i].radius < 0)
+			printf("straight,%d,", TIMING_STRAIGHT_DISTANCE);
+		else
+			printf("%d,%d,", moves[i].radius, TIMING_ARC_ANGLE);
+
+		printf("%d,", moves[i].time);
+
+		int before = findMarker(monitor, (int)i);
+		int after = findMarker(monitor, (int)i + 1);
+
+		if (before < 0 || after < 0)
+		{
+			printf("did not finish\n");
+			continue;
+		}
+
+		const TimingLine & from = monitor.lines[before];
+		const TimingLine & to = monitor.lines[after];
+
+		std::vector<uint64_t> steps[2];
+		std::vector<double> errors[2];
+
+		for (int wheel = 0; wheel < 2; wheel++)
+			steps[wheel] = stepsBetween(monitor.steps[wheel], from.time, to.time);
+
+		if (steps[0].empty() && steps[1].empty())
+		{
+			printf("too fast\n");
+			continue;
+		}
+
+		double start = HOST_NEVER;
+		uint64_t lastStep = 0;
+
+		for (int wheel = 0; wheel < 2; wheel++)
+		{
+			if (steps[wheel].empty())
+				continue;
+
+			start = std::min(start, steps[wheel][0] - moves[i].time * 1e6 / steps[wheel].size());
+			lastStep = std::max(lastStep, steps[wheel].back());
+		}
+
+		for (int wheel = 0; wheel < 2; wheel++)
+		{
+			errors[wheel] = stepErrors(steps[wheel], start, moves[i].time);
+
+			WheelTiming timing = summariseErrors(errors[wheel]);
+
+			printf("%d,%.0f,%.0f,%.0f,", (int)steps[wheel].size(), timing.mean, timing.max, timing.drift);
+		}
+
+		double syncMean;
+		double syncMax;
+
+		syncErrors(steps, errors, &syncMean, &syncMax);
+
+		printf("%.0f,%.0f,%.0f,%llu\n", syncMean, syncMax, lastStep - start - moves[i].time * 1e6,
+			(unsigned long long)(to.interrupts - from.interrupts));
+	}
+
+	return true;
+}
+
+#define TIMING_DRIVE_MODE_DISTANCE 200
+
+bool timingDriveModes(const RunnerSettings & settings)
+{
+	printf("mode,steps,mmpersec,time,interrupts,interruptspersec,lmean,lmax\n");
+
+	const char * names[] = { "half", "full" };
+
+	for (int mode = 0; mode < 2; mode++)
+	{
+		// The drive mode is stored in EEPROM, but each robot starts afresh
+		std::string script = "*MD" + std::to_string(mode) + "\nbegin\nprintln 0\nmove " +
+			std::to_string(TIMING_DRIVE_MODE_DISTANCE) + "\nprintln 1\nend\n";
+
+		TimingMonitor monitor;
+
+		if (!runTimingScript(settings, script, &monitor))
+			return false;
+
+		int before = findMarker(monitor, 0);
+		int after = findMarker(monitor, 1);
+
+		printf("%s,", names[mode]);
+
+		if (before < 0 || after < 0)
+		{
+			printf("did not finish\n");
+			continue;
+		}
+
+		const TimingLine & from = monitor.lines[before];
+		const TimingLine & to = monitor.lines[after];
+
+		std::vector<uint64_t> steps = stepsBetween(monitor.steps[0], from.time, to.time);
+
+		if (steps.size() < 2)
+		{
+			printf("too fast\n");
+			continue;
+		}
+
+		// Even spacing from the first step to the last
+		double interval = (double)(steps.back() - steps.front()) / (steps.size() - 1);
+		double seconds = interval * steps.size() / 1e6;
+
+		std::vector<double> errors = stepErrors(steps, steps.front() - interval, seconds);
+		WheelTiming timing = summariseErrors(errors);
+
+		uint64_t interrupts = to.interrupts - from.interrupts;
+
+		printf("%d,%.1f,%.3f,%llu,%.0f,%.0f,%.0f\n", (int)steps.size(), TIMING_DRIVE_MODE_DISTANCE / seconds,
+			seconds, (unsigned long long)interrupts, interrupts / seconds, timing.mean, timing.max);
+	}
+
+	return true;
+}
+
+// A slalom with most points nearly ahead, then some sharp corners back to
+// the start, in mm from where the robot powered on
+
+const int timingWaypoints[][2] = {
+	{ 0, 300 }, { 100, 600 }, { 0, 900 }, { 100, 1200 },
+	{ 0, 1500 }, { 300, 1400 }, { 400, 1000 }, { 200, 500 },
+	{ 300, 100 }, { 0, 0 } };
+
+#define NO_OF_TIMING_WAYPOINTS 10
+
+double angleDifference(double degrees)
+{
+	degrees = fmod(degrees, 360.0);
+
+	if (degrees > 180)
+		degrees -= 360;
+
+	if (degrees < -180)
+		degrees += 360;
+
+	return degrees;
+}
+
+bool timingGoto(const RunnerSettings & settings)
+{
+	std::string script = "begin\nprintln 0\n";
+
+	for (int i = 0; i < NO_OF_TIMING_WAYPOINTS; i++)
+	{
+		script += "goto " + std::to_string(timingWaypoints[i][0]) + ", " +
+			std::to_string(timingWaypoints[i][1]) + "\n";
+		script += "println " + std::to_string(i + 1) + "\nprintln @x\nprintln @y\nprintln @heading\n";
+	}
+
+	script += "end\n";
+
+	TimingMonitor monitor;
+
+	if (!runTimingScript(settings, script, &monitor))
+		return false;
+
+	printf("x,y,time,error,odometryerror,headingerror\n");
+
+	int start = findMarker(monitor, 0);
+
+	if (start < 0)
+	{
+		printf("did not start\n");
+		return true;
+	}
+
+	uint64_t previous = monitor.lines[start].time;
+	double totalError = 0;
+	double maxError = 0;
+	int reached = 0;
+
+	for (int i = 0; i < NO_OF_TIMING_WAYPOINTS; i++)
+	{
+		int x = timingWaypoints[i][0];
+		int y = timingWaypoints[i][1];
+
+		printf("%d,%d,", x, y);
+
+		int marker = findMarker(monitor, i + 1);
+
+		if (marker < 0 || marker + 3 >= (int)monitor.lines.size())
+		{
+			printf("did not finish\n");
+			break;
+		}
+
+		const TimingLine & line = monitor.lines[marker];
+		const HostPose & pose = line.pose;
+
+		double odometryX = atof(monitor.lines[marker + 1].text.c_str());
+		double odometryY = atof(monitor.lines[marker + 2].text.c_str());
+		double odometryHeading = atof(monitor.lines[marker + 3].text.c_str()) / 100.0;
+
+		double error = hypot(pose.x - x, pose.y - y);
+		double odometryError = hypot(odometryX - pose.x, odometryY - pose.y);
+		double headingError = angleDifference(odometryHeading - pose.heading * 180.0 / M_PI);
+
+		printf("%.3f,%.1f,%.1f,%.2f\n", (line.time - previous) / 1e6, error, odometryError, headingError);
+
+		totalError += error;
+		maxError = std::max(maxError, error);
+		previous = line.time;
+		reached++;
+	}
+
+	if (reached > 0)
+	{
+		double seconds = (previous - monitor.lines[start].time) / 1e6;
+
+		printf("waypoints per minute %.2f, mean error %.1f, max error %.1f\n",
+			reached * 60.0 / seconds, totalError / reached, maxError);
+	}
+
+	return true;
+}
+
+int runTiming(const RunnerSettings & settings)
+{
+	// The go to point route takes a few minutes
+	RunnerSettings timingSettings = settings;
+	timingSettings.seconds = std::max(settings.seconds, 600.0);
+
+	printf("Motor timing\n");
+
+	if (!timingSweep(timingSettings))
+		return 1;
+
+	printf("\nDrive modes\n");
+
+	if (!timingDriveModes(timingSettings))
+		return 1;
+
+	printf("\nGo to point\n");
+
+	if (!timingGoto(timingSettings))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,302 @@
+///////////////////////////////////////////////////////////
+/// Time warp
+///////////////////////////////////////////////////////////
+
+// hullhost warp - runs a program across the points where the robot's clocks
+// wrap, and for days of simulated time, looking for the robot freezing or
+// losing its timing.
+//
+// micros() wraps every 2^32 microseconds, about 71.6 minutes, and millis()
+// every 2^32 milliseconds, about 49.7 days. The millis() wrap falls at
+// 4294967296000 microseconds, which is a micros() wrap as well. The robot is
+// powered on --lead seconds before each wrap and runs for --after seconds
+// after it. This is repeated --phases times, powering on a further fraction
+// of a second earlier each time, so that the wrap falls in a different part
+// of the program. Then the robot runs from power on for --days days, crossing
+// the micros() wrap again and again.
+//
+// The program should print a line at a steady rate and move, as
+// examples/heartbeat.txt does. Each run reports:
+//
+// stalls      passes through loop() that ran past the watchdog
+// late        lines more than half as late again as the usual interval,
+//             or no line at all for that long at the end of the run
+// early       lines less than half the usual interval after the one before,
+//             from delays that ended early
+// step gaps   gaps between steps of a wheel in the middle of a move longer
+//             than --step-gap milliseconds
+//
+// and the time of the first problem, from the wrap. The interval is the
+// usual one, the longest over the runs.
+
+#pragma once
+
+#include <algorithm>
+
+#include "Runner.h"
+
+// 2^32 milliseconds of timer 0 overflows
+#define MILLIS_WRAP_MICROS 4294967296000ull
+#define MICROS_WRAP_MICROS 4294967296ull
+
+struct WarpMonitor
+{
+	std::vector<uint64_t> lineTimes;
+	uint64_t lastStep[2];
+	uint64_t stepGapLimit;
+	uint64_t stepGaps;
+	uint64_t longestStepGap;
+	uint64_t firstStepGap;
+};
+
+void watchWarp(Robot * robot, const HostTraceEvent * event)
+{
+	WarpMonitor * monitor = (WarpMonitor *)robot->watcherContext;
+
+	switch (event->kind)
+	{
+	case TRACE_SERIAL_OUT:
+		if (event->data[0] == '\n')
+			monitor->lineTimes.push_back(event->time);
+		break;
+
+	case TRACE_LEFT_STEP:
+	case TRACE_RIGHT_STEP:
+	{
+		uint64_t * last = &monitor->lastStep[event->kind == TRACE_RIGHT_STEP];
+
+		// The coils are turned off at the end of a move
+		if (event->data[0] == 0)
+		{
+			*last = HOST_NEVER;
+			break;
+		}
+
+		if (*last != HOST_NEVER)
+		{
+			uint64_t gap = event->time - *last;
+
+			if (gap > monitor->longestStepGap)
+				monitor->longestStepGap = gap;
+
+			if (gap > monitor->stepGapLimit)
+			{
+				if (monitor->stepGaps == 0)
+					monitor->firstStepGap = event->time;
+				monitor->stepGaps++;
+			}
+		}
+
+		*last = event->time;
+		break;
+	}
+	}
+}
+
+struct WarpResult
+{
+	int runs = 0;
+	double simulated = 0;
+	double wall = 0;
+	int lines = 0;
+	uint64_t usual = 0;
+	int stalls = 0;
+	int late = 0;
+	int early = 0;
+	uint64_t stepGaps = 0;
+	uint64_t longestStepGap = 0;
+	// From the wrap, the earliest over the runs
+	double firstProblem = 0;
+	bool problem = false;
+	bool silent = false;
+};
+
+// Runs one robot from the given power on time for the given number of
+// seconds and adds what it saw to the result
+
+bool warpRun(const RunnerSettings & settings, const std::string & input,
+	uint64_t powerOn, uint64_t wrapAt, double seconds, WarpResult * result)
+{
+	Robot robot;
+
+	if (!loadRobot(&robot, settings.library.c_str(), 0))
+		return false;
+
+	applySettings(settings, &robot.options);
+	robot.options.startMicros = powerOn;
+
+	WarpMonitor monitor;
+	monitor.lastStep[0] = HOST_NEVER;
+	monitor.lastStep[1] = HOST_NEVER;
+	monitor.stepGapLimit = secondsToMicros(settings.stepGap / 1000.0);
+	monitor.stepGaps = 0;
+	monitor.longestStepGap = 0;
+	monitor.firstStepGap = 0;
+
+	robot.watcher = watchWarp;
+	robot.watcherContext = &monitor;
+
+	double wallStart = wallSeconds();
+
+	startRobot(&robot);
+
+	robot.sketch.hostSend((const uint8_t *)input.data(), (int)input.size(),
+		powerOn + secondsToMicros(settings.inputAt));
+
+	uint64_t end = powerOn + secondsToMicros(seconds);
+
+	// Run in ten second slices so that a stall ends the run early
+	for (uint64_t t = powerOn; t < end && !robot.stalled; )
+	{
+		t += 10000000;
+		runRobot(&robot, t < end ? t : end);
+	}
+
+	uint64_t now = robot.sketch.hostNow();
+
+	// The usual interval between lines, leaving out the first, which
+	// waits for the download
+	std::vector<uint64_t> intervals;
+
+	for (size_t i = 2; i < monitor.lineTimes.size(); i++)
+		intervals.push_back(monitor.lineTimes[i] - monitor.lineTimes[i - 1]);
+
+	uint64_t usual = 0;
+
+	if (!intervals.empty())
+	{
+		std::vector<uint64_t> sorted = intervals;
+		std::sort(sorted.begin(), sorted.end());
+		usual = sorted[sorted.size() / 2];
+	}
+
+	uint64_t firstProblem = HOST_NEVER;
+
+	for (size_t i = 0; i < intervals.size(); i++)
+	{
+		bool isLate = intervals[i] * 2 > usual * 3;
+		bool isEarly = intervals[i] * 2 < usual;
+
+		if (isLate)
+			result->late++;
+
+		if (isEarly)
+			result->early++;
+
+		if ((isLate || isEarly) && firstProblem == HOST_NEVER)
+			firstProblem = monitor.lineTimes[i + 2];
+	}
+
+	if (usual != 0 && (now - monitor.lineTimes.back()) * 2 > usual * 3)
+	{
+		result->late++;
+
+		if (firstProblem == HOST_NEVER)
+			firstProblem = monitor.lineTimes.back();
+	}
+
+	if (monitor.stepGaps && monitor.firstStepGap < firstProblem)
+		firstProblem = monitor.firstStepGap;
+
+	if (robot.stalled)
+	{
+		result->stalls++;
+
+		if (now < firstProblem)
+			firstProblem = now;
+	}
+
+	if (usual == 0)
+		result->silent = true;
+
+	if (firstProblem != HOST_NEVER)
+	{
+		double fromWrap = ((double)firstProblem - (double)wrapAt) / 1e6;
+
+		if (!result->problem || fromWrap < result->firstProblem)
+			result->firstProblem = fromWrap;
+
+		result->problem = true;
+	}
+
+	result->runs++;
+	result->simulated += (now - powerOn) / 1e6;
+	result->wall += wallSeconds() - wallStart;
+	result->lines += (int)monitor.lineTimes.size();
+	result->usual = std::max(result->usual, usual);
+	result->stepGaps += monitor.stepGaps;
+	result->longestStepGap = std::max(result->longestStepGap, monitor.longestStepGap);
+
+	unloadRobot(&robot);
+
+	return true;
+}
+
+// Prints a line of results. Returns false if there were problems.
+
+bool printWarpResult(const char * name, const WarpResult & result)
+{
+	printf("%-12s %4d %10.1f %7.2f %7d %9.3f %6d %4d %5d %9llu %9.1f",
+		name, result.runs, result.simulated, result.wall, result.lines, result.usual / 1e6,
+		result.stalls, result.late, result.early, (unsigned long long)result.stepGaps,
+		result.longestStepGap / 1e3);
+
+	if (result.silent)
+		printf("  no lines printed");
+	else if (result.problem)
+		printf("  first at %+.3f s", result.firstProblem);
+
+	printf("\n");
+
+	return !result.silent && !result.problem;
+}
+
+int runWarp(const RunnerSettings & settings)
+{
+	std::string input;
+
+	if (!readInputFiles(settings, &input))
+		return 1;
+
+	printf("%-12s %4s %10s %7s %7s %9s %6s %4s %5s %9s %9s\n", "run", "runs", "seconds", "wall",
+		"lines", "interval", "stalls", "late", "early", "step gaps", "max gap");
+
+	const char * names[] = { "micros wrap", "millis wrap" };
+	uint64_t wraps[] = { MICROS_WRAP_MICROS, MILLIS_WRAP_MICROS };
+
+	bool ok = true;
+
+	for (int w = 0; w < 2; w++)
+	{
+		WarpResult result;
+
+		// Each phase powers on a little earlier, so that the wrap falls at a
+		// different point in the program
+		for (int phase = 0; phase < settings.phases; phase++)
+		{
+			double lead = settings.lead + (double)phase / settings.phases;
+
+			if (!warpRun(settings, input, wraps[w] - secondsToMicros(lead), wraps[w],
+				lead + settings.after, &result))
+				return 1;
+		}
+
+		ok &= printWarpResult(names[w], result);
+	}
+
+	if (settings.days > 0)
+	{
+		WarpResult result;
+
+		if (!warpRun(settings, input, 0, 0, settings.days * 86400, &result))
+			return 1;
+
+		char name[32];
+		snprintf(name, sizeof(name), "%g days", settings.days);
+		ok &= printWarpResult(name, result);
+	}
+
+	printf("%s\n", ok ? "no problems" : "problems found");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+///////////////////////////////////////////////////////////
+/// World
+///////////////////////////////////////////////////////////
+
+// hullhost world - runs a program on a robot in a room of walls, see
+// HostWorld.h, and reports how it got on.
+//
+// The room is read from the file given with --world. Each line is one of
+//
+// wall x1 y1 x2 y2    a wall from x1,y1 to x2,y2
+// goal x y radius     the robot has arrived when its middle is this close
+//                     to x,y
+//
+// in mm, with the robot starting at 0,0 facing along y and x to the right.
+// Lines starting with # are ignored.
+//
+// The run ends when the robot reaches the goal, when the program has
+// finished and the robot has been idle for a second, or after --limit
+// seconds. The robot drives through walls rather than stopping at them, and
+// each time it runs into one counts as a collision. The line printed gives
+// the time from the end of the download, whether the robot reached the
+// goal, the collisions, the closest the robot came to a wall, the number of
+// distance readings and where the robot ended up, with the heading in
+// degrees. With --poses each line the robot prints is followed by where it
+// was when it printed it.
+
+#pragma once
+
+#include <math.h>
+
+#include "Runner.h"
+
+struct WorldSettings
+{
+	std::vector<HostWall> walls;
+	bool haveGoal = false;
+	double goalX = 0;
+	double goalY = 0;
+	double goalRadius = 0;
+};
+
+bool readWorldFile(const char * path, WorldSettings * world)
+{
+	std::string text;
+
+	if (!readFile(path, &text))
+		return false;
+
+	size_t pos = 0;
+	int lineNumber = 0;
+
+	while (pos < text.size())
+	{
+		size_t end = text.find('\n', pos);
+
+		if (end == std::string::npos)
+			end = text.size();
+
+		std::string line = text.substr(pos, end - pos);
+		pos = end + 1;
+		lineNumber++;
+
+		char word[16];
+
+		if (sscanf(line.c_str(), " %15s", word) != 1 || word[0] == '#')
+			continue;
+
+		HostWall wall;
+
+		if (strcmp(word, "wall") == 0 &&
+			sscanf(line.c_str(), " wall %lf %lf %lf %lf", &wall.x1, &wall.y1, &wall.x2, &wall.y2) == 4)
+		{
+			world->walls.push_back(wall);
+			continue;
+		}
+
+		if (strcmp(word, "goal") == 0 &&
+			sscanf(line.c_str(), " goal %lf %lf %lf", &world->goalX, &world->goalY, &world->goalRadius) == 3)
+		{
+			world->haveGoal = true;
+			continue;
+		}
+
+		fprintf(stderr, "hullhost: %s line %d: %s\n", path, lineNumber, line.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+double headingInDegrees(double heading)
+{
+	double degrees = heading * 180.0 / M_PI;
+
+	degrees = fmod(degrees, 360.0);
+
+	if (degrees > 180)
+		degrees -= 360;
+
+	if (degrees < -180)
+		degrees += 360;
+
+	return degrees;
+}
+
+// Prints each line the robot sends with the pose it was in at the end of it
+
+struct PoseLines
+{
+	std::string line;
+};
+
+void watchPoseLines(Robot * robot, const HostTraceEvent * event)
+{
+	if (event->kind != TRACE_SERIAL_OUT)
+		return;
+
+	PoseLines * lines = (PoseLines *)robot->watcherContext;
+
+	char c = (char)event->data[0];
+
+	if (c == '\r')
+		return;
+
+	if (c != '\n')
+	{
+		lines->line += c;
+		return;
+	}
+
+	HostPose pose;
+	robot->sketch.hostGetPose(&pose);
+
+	printf("%-32s %8.1f %8.1f %7.1f\n", lines->line.c_str(), pose.x, pose.y, headingInDegrees(pose.heading));
+
+	lines->line.clear();
+}
+
+int runWorld(const RunnerSettings & settings)
+{
+	std::string input;
+
+	if (!readInputFiles(settings, &input))
+		return 1;
+
+	WorldSettings world;
+
+	if (!settings.worldFile.empty() && !readWorldFile(settings.worldFile.c_str(), &world))
+		return 1;
+
+	Robot robot;
+
+	if (!loadRobot(&robot, settings.library.c_str(), 0))
+		return 1;
+
+	applySettings(settings, &robot.options);
+
+	PoseLines lines;
+
+	if (settings.poses)
+	{
+		robot.watcher = watchPoseLines;
+		robot.watcherContext = &lines;
+	}
+	else
+		robot.echoOutput = !settings.quiet;
+
+	if (!openTrace(settings, &robot))
+		return 1;
+
+	robot.sketch.hostSetWorld(world.walls.data(), (int)world.walls.size());
+
+	startRobot(&robot);
+
+	uint64_t inputAt = robot.options.startMicros + secondsToMicros(settings.inputAt);
+
+	robot.sketch.hostSend((const uint8_t *)input.data(), (int)input.size(), inputAt);
+
+	uint64_t programStart = HOST_NEVER;
+	uint64_t idleSince = HOST_NEVER;
+	uint64_t now = robot.sketch.hostNow();
+	bool atGoal = false;
+	HostPose pose;
+
+	while (runRobot(&robot, now + 10000))
+	{
+		now = robot.sketch.hostNow();
+
+		robot.sketch.hostGetPose(&pose);
+
+		if (world.haveGoal && hypot(pose.x - world.goalX, pose.y - world.goalY) < world.goalRadius)
+		{
+			atGoal = true;
+			break;
+		}
+
+		HostStats stats;
+		robot.sketch.hostGetStats(&stats);
+
+		if (stats.bytesWaiting > 0 || now < inputAt)
+			continue;
+
+		if (programStart == HOST_NEVER)
+			programStart = now;
+
+		if (now - programStart >= secondsToMicros(settings.limit))
+			break;
+
+		if (!robot.sketch.hostRobotIdle())
+			idleSince = HOST_NEVER;
+		else if (idleSince == HOST_NEVER)
+			idleSince = now;
+		else if (now - idleSince >= 1000000)
+			break;
+	}
+
+	fflush(stdout);
+	closeTrace(&robot);
+
+	robot.sketch.hostGetPose(&pose);
+
+	if (programStart == HOST_NEVER)
+		programStart = now;
+
+	printf("time,goal,collisions,clearance,readings,x,y,heading\n");
+	printf("%.3f,%s,%u,%.1f,%u,%.1f,%.1f,%.1f\n", (now - programStart) / 1e6,
+		world.haveGoal ? (atGoal ? "yes" : "no") : "none", pose.collisions,
+		world.walls.empty() ? 0.0 : pose.minClearance, pose.echoes, pose.x, pose.y,
+		headingInDegrees(pose.heading));
+
+	if (settings.stats)
+		printStats(stderr, &robot);
+
+	if (robot.stalled)
+		fprintf(stderr, "hullhost: robot stalled\n");
+
+	int result = robot.stalled ? 1 : 0;
+
+	unloadRobot(&robot);
+
+	return result;
+}
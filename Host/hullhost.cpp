@@ -0,0 +1,293 @@
+// hullhost - runs HullOS on the host, on the simulated board built into
+// libhullos.so. See README.md for the commands and options.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "Runner.h"
+#include "Fleet.h"
+#include "Session.h"
+#include "Warp.h"
+#include "Lines.h"
+#include "World.h"
+#include "Timing.h"
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: hullhost command [options] [file...]\n"
+		"commands:\n"
+		"  run      run one robot, sending it the files, and print what it sends back\n"
+		"  fleet    run a number of robots side by side and report the throughput\n"
+		"  replay   send the bytes in a session log to a robot at their recorded times\n"
+		"  relay    pass bytes between a pseudo terminal and a robot's serial port,\n"
+		"           logging them: hullhost relay /dev/ttyUSB0 session.log\n"
+		"  warp     run a program across the micros() and millis() wraps and for days\n"
+		"  lines    print the statement numbers each line of a script is stored as\n"
+		"  world    run a program in a room of walls and report where the robot got to\n"
+		"  timing   measure the step timing of moves, the drive modes and go to point\n"
+		"options:\n"
+		"  --lib path          sketch library, default libhullos.so beside hullhost\n"
+		"  --seconds s         simulated seconds to run after the input has arrived\n"
+		"  --at s              simulated seconds from power on to sending the input\n"
+		"  --seed n            seed for random()\n"
+		"  --start us          simulated time at power on\n"
+		"  --distance mm       distance to the obstacle in front of the robot\n"
+		"  --pass us           time taken by each pass through loop()\n"
+		"  --eeprom-write us   time taken by each EEPROM write\n"
+		"  --reaction us       time the sender takes to act on XON and XOFF\n"
+		"  --no-pacing         send the input as fast as it is given\n"
+		"  --no-flow-control   sender ignores XON and XOFF\n"
+		"  --trace file        write everything the board sees to the file\n"
+		"  --eeprom file       start with this EEPROM image\n"
+		"  --save-eeprom file  save the EEPROM image at the end\n"
+		"  --record file       log the session for replay\n"
+		"  --digest hex        replay: fail unless the trace digest is this\n"
+		"  --stats             print the board counters at the end\n"
+		"  --quiet             do not print the serial output\n"
+		"warp options:\n"
+		"  --lead s            simulated seconds from power on to each wrap, default 30\n"
+		"  --after s           simulated seconds to run after each wrap, default 60\n"
+		"  --phases n          runs at each wrap, each powered on later, default 8\n"
+		"  --days d            simulated days to run from power on, default 1\n"
+		"  --step-gap ms       longest gap between steps in a move, default 50\n"
+		"world options:\n"
+		"  --world file        the walls and goal, see World.h\n"
+		"  --limit s           simulated seconds to give the program, default 300\n"
+		"  --poses             print where the robot was after each line it sends\n"
+		"fleet options:\n"
+		"  -n robots           number of robots, default 16\n"
+		"  -j threads          number of threads, default one for each core\n"
+		"  --slice s           simulated seconds run by every robot before the next slice\n"
+		"  --same-seed         give every robot the same seed and check their traces match\n");
+}
+
+// Returns the folder hullhost was run from, to find the sketch library
+
+std::string programFolder()
+{
+	char path[PATH_MAX];
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+	if (length <= 0)
+		return ".";
+
+	path[length] = 0;
+
+	char * slash = strrchr(path, '/');
+
+	if (slash != NULL)
+		*slash = 0;
+
+	return path;
+}
+
+bool parseSettings(int argc, char ** argv, RunnerSettings * settings)
+{
+	settings->library = programFolder() + "/libhullos.so";
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string option = argv[i];
+
+		if (option.size() < 2 || option[0] != '-')
+		{
+			settings->files.push_back(option);
+			continue;
+		}
+
+		if (option == "--no-pacing")
+			settings->pacedInput = 0;
+		else if (option == "--no-flow-control")
+			settings->senderHonoursFlowControl = 0;
+		else if (option == "--stats")
+			settings->stats = true;
+		else if (option == "--quiet")
+			settings->quiet = true;
+		else if (option == "--same-seed")
+			settings->sameSeed = true;
+		else if (option == "--poses")
+			settings->poses = true;
+		else
+		{
+			if (i + 1 >= argc)
+			{
+				fprintf(stderr, "hullhost: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char * value = argv[++i];
+
+			if (option == "--lib")
+				settings->library = value;
+			else if (option == "--seconds")
+				settings->seconds = atof(value);
+			else if (option == "--at")
+				settings->inputAt = atof(value);
+			else if (option == "--seed")
+				settings->seed = strtoll(value, NULL, 0);
+			else if (option == "--start")
+				settings->startMicros = strtoll(value, NULL, 0);
+			else if (option == "--distance")
+				settings->distanceInMM = strtoll(value, NULL, 0);
+			else if (option == "--pass")
+				settings->loopPassMicros = strtoll(value, NULL, 0);
+			else if (option == "--eeprom-write")
+				settings->eepromWriteMicros = strtoll(value, NULL, 0);
+			else if (option == "--reaction")
+				settings->reactionMicros = strtoll(value, NULL, 0);
+			else if (option == "--trace")
+				settings->traceFile = value;
+			else if (option == "--eeprom")
+				settings->eepromIn = value;
+			else if (option == "--save-eeprom")
+				settings->eepromOut = value;
+			else if (option == "--record")
+				settings->recordFile = value;
+			else if (option == "--digest")
+				settings->digest = value;
+			else if (option == "-n")
+				settings->robots = atoi(value);
+			else if (option == "-j")
+				settings->threads = atoi(value);
+			else if (option == "--lead")
+				settings->lead = atof(value);
+			else if (option == "--after")
+				settings->after = atof(value);
+			else if (option == "--phases")
+				settings->phases = atoi(value);
+			else if (option == "--days")
+				settings->days = atof(value);
+			else if (option == "--step-gap")
+				settings->stepGap = atof(value);
+			else if (option == "--world")
+				settings->worldFile = value;
+			else if (option == "--limit")
+				settings->limit = atof(value);
+			else if (option == "--slice")
+				settings->slice = atof(value);
+			else
+			{
+				fprintf(stderr, "hullhost: unknown option %s\n", option.c_str());
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Runs one robot until it has been idle for a second after the input has
+// arrived, or for the given number of seconds after that
+
+int runOne(const RunnerSettings & settings)
+{
+	std::string input;
+
+	if (!readInputFiles(settings, &input))
+		return 1;
+
+	std::string eeprom;
+
+	if (!settings.eepromIn.empty() && !readFile(settings.eepromIn.c_str(), &eeprom))
+		return 1;
+
+	Robot robot;
+
+	if (!loadRobot(&robot, settings.library.c_str(), 0))
+		return 1;
+
+	applySettings(settings, &robot.options);
+	robot.echoOutput = !settings.quiet;
+
+	if (!openTrace(settings, &robot))
+		return 1;
+
+	FILE * log = NULL;
+
+	if (!settings.recordFile.empty())
+	{
+		log = startSessionRecording(settings.recordFile.c_str(), &robot, eeprom);
+		if (log == NULL)
+			return 1;
+	}
+
+	startRobot(&robot, eeprom.empty() ? NULL : &eeprom);
+
+	uint64_t start = robot.options.startMicros;
+
+	robot.sketch.hostSend((const uint8_t *)input.data(), (int)input.size(),
+		start + secondsToMicros(settings.inputAt));
+
+	runUntilSettled(&robot, settings.seconds, start + secondsToMicros(settings.inputAt));
+
+	fflush(stdout);
+	closeTrace(&robot);
+
+	if (log != NULL)
+		fclose(log);
+
+	if (settings.stats)
+		printStats(stderr, &robot);
+
+	if (!saveEEPROM(settings, &robot))
+		return 1;
+
+	if (robot.stalled)
+		fprintf(stderr, "hullhost: robot stalled\n");
+
+	int result = robot.stalled ? 1 : 0;
+
+	unloadRobot(&robot);
+
+	return result;
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 2;
+	}
+
+	RunnerSettings settings;
+
+	if (!parseSettings(argc, argv, &settings))
+	{
+		usage();
+		return 2;
+	}
+
+	std::string command = argv[1];
+
+	if (command == "run")
+		return runOne(settings);
+
+	if (command == "fleet")
+		return runFleet(settings);
+
+	if (command == "replay")
+		return replaySession(settings);
+
+	if (command == "relay")
+		return relaySession(settings);
+
+	if (command == "warp")
+		return runWarp(settings);
+
+	if (command == "lines")
+		return printScriptLines(settings);
+
+	if (command == "world")
+		return runWorld(settings);
+
+	if (command == "timing")
+		return runTiming(settings);
+
+	usage();
+	return 2;
+}
@@ -0,0 +1,75 @@
+// Stand-in for the Adafruit NeoPixel library. show() hands the colours to
+// the simulated board, which records each frame that differs from the last.
+
+#pragma once
+
+#include "Arduino.h"
+
+#define NEO_GRB 0x52
+#define NEO_RGB 0x06
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel
+{
+public:
+	Adafruit_NeoPixel(uint16_t count, int16_t /* pin */ = 6, uint16_t /* type */ = NEO_GRB + NEO_KHZ800)
+	{
+		pixelCount = count < HOST_MAX_PIXELS ? count : HOST_MAX_PIXELS;
+		memset(colours, 0, sizeof(colours));
+	}
+
+	void begin()
+	{
+	}
+
+	void show()
+	{
+		hostBoard.showPixels(colours, pixelCount);
+	}
+
+	void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+	{
+		if (n >= pixelCount)
+			return;
+
+		colours[n * 3] = r;
+		colours[n * 3 + 1] = g;
+		colours[n * 3 + 2] = b;
+	}
+
+	void setPixelColor(uint16_t n, uint32_t c)
+	{
+		setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c);
+	}
+
+	uint32_t getPixelColor(uint16_t n) const
+	{
+		if (n >= pixelCount)
+			return 0;
+
+		return ((uint32_t)colours[n * 3] << 16) | ((uint32_t)colours[n * 3 + 1] << 8) | colours[n * 3 + 2];
+	}
+
+	uint16_t numPixels() const
+	{
+		return pixelCount;
+	}
+
+	void setBrightness(uint8_t /* brightness */)
+	{
+	}
+
+	void clear()
+	{
+		memset(colours, 0, sizeof(colours));
+	}
+
+	static uint32_t Color(uint8_t r, uint8_t g, uint8_t b)
+	{
+		return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+	}
+
+private:
+	uint16_t pixelCount;
+	uint8_t colours[HOST_MAX_PIXELS * 3];
+};
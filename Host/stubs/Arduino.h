@@ -0,0 +1,475 @@
+// Stand-in for the parts of the Arduino core used by HullOS, for the host
+// build in Sketch.cpp. Anything that touches the hardware goes to the
+// simulated board in HostBoard.h.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <limits.h>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include "../HostBoard.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef std::string String;
+
+// Program memory is ordinary memory on the host
+
+#define PROGMEM
+#define F(s) (s)
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_byte_near(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_word_near(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+
+#define PI 3.1415926535897932384626433832795
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#include "binary.h"
+
+// Registers. Writes to the motor ports are passed to the board so that it
+// can follow the steps.
+
+class HostPort
+{
+public:
+	HostPort(char name) : name(name), value(0)
+	{
+	}
+
+	operator uint8_t() const
+	{
+		return value;
+	}
+
+	HostPort & operator=(uint8_t newValue)
+	{
+		value = newValue;
+		hostBoard.portWritten(name, value);
+		return *this;
+	}
+
+	HostPort & operator|=(uint8_t bits)
+	{
+		return *this = value | bits;
+	}
+
+	HostPort & operator&=(uint8_t bits)
+	{
+		return *this = value & bits;
+	}
+
+private:
+	char name;
+	uint8_t value;
+};
+
+HostPort PORTD('D');
+HostPort PORTB('B');
+uint8_t DDRD;
+uint8_t DDRB;
+
+#define PIND (hostBoard.readPIND())
+
+inline void noInterrupts()
+{
+	hostBoard.holdInterrupts();
+}
+
+inline void interrupts()
+{
+	hostBoard.releaseInterrupts();
+}
+
+// Only the global interrupt flag, bit 7, is kept
+
+#define SREG_I 0x80
+
+class HostStatusRegister
+{
+public:
+	operator uint8_t() const
+	{
+		return hostBoard.interruptsEnabled() ? SREG_I : 0;
+	}
+
+	HostStatusRegister & operator=(uint8_t newValue)
+	{
+		hostBoard.setInterruptsEnabled((newValue & SREG_I) != 0);
+		return *this;
+	}
+};
+
+HostStatusRegister SREG;
+
+#define cli() noInterrupts()
+#define sei() interrupts()
+
+// Time
+
+inline uint32_t millis()
+{
+	return hostBoard.readMillis();
+}
+
+inline uint32_t micros()
+{
+	return hostBoard.readMicros();
+}
+
+inline void delay(uint32_t milliseconds)
+{
+	hostBoard.advanceTo(hostBoard.now + milliseconds * (uint64_t)1000);
+}
+
+inline void delayMicroseconds(unsigned int microseconds)
+{
+	hostBoard.advanceTo(hostBoard.now + microseconds);
+}
+
+// Pins
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : NOT_AN_INTERRUPT))
+
+// The distance sensor trigger is on pin 3 and its echo on pin 2
+#define HOST_TRIGGER_PIN 3
+
+inline void pinMode(uint8_t /* pin */, uint8_t /* mode */)
+{
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level)
+{
+	if (pin == HOST_TRIGGER_PIN)
+		hostBoard.triggerWritten(level != LOW);
+}
+
+inline int digitalRead(uint8_t /* pin */)
+{
+	return LOW;
+}
+
+inline int analogRead(uint8_t /* pin */)
+{
+	return hostBoard.options.lightLevel;
+}
+
+inline void attachInterrupt(uint8_t interruptNo, void(*handler)(), int /* mode */)
+{
+	hostBoard.attachPinInterrupt(interruptNo == 0 ? 2 : 3, handler);
+}
+
+inline void detachInterrupt(uint8_t interruptNo)
+{
+	hostBoard.attachPinInterrupt(interruptNo == 0 ? 2 : 3, NULL);
+}
+
+inline uint32_t pulseIn(uint8_t /* pin */, uint8_t /* state */, uint32_t /* timeout */ = 1000000L)
+{
+	uint32_t width = hostBoard.echoWidth();
+
+	hostBoard.advanceTo(hostBoard.now + HOST_ECHO_DELAY_MICROS + width);
+
+	return width;
+}
+
+// Sound, played by Timer2 on real hardware
+
+inline void tone(uint8_t /* pin */, unsigned int frequency, uint32_t duration = 0)
+{
+	hostBoard.playTone(frequency, duration);
+}
+
+inline void noTone(uint8_t /* pin */)
+{
+	hostBoard.playTone(0, 0);
+}
+
+// Numbers
+
+inline int32_t random(int32_t howBig)
+{
+	if (howBig == 0)
+		return 0;
+
+	return hostBoard.nextRandom() % howBig;
+}
+
+inline int32_t random(int32_t howSmall, int32_t howBig)
+{
+	if (howSmall >= howBig)
+		return howSmall;
+
+	return random(howBig - howSmall) + howSmall;
+}
+
+inline void randomSeed(uint32_t seed)
+{
+	if (seed != 0)
+		hostBoard.randomState = seed;
+}
+
+using std::abs;
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+inline bool isAlphaNumeric(int c)
+{
+	return isalnum(c) != 0;
+}
+
+inline bool isDigit(int c)
+{
+	return isdigit(c) != 0;
+}
+
+inline int toLowerCase(int c)
+{
+	return tolower(c);
+}
+
+inline int toUpperCase(int c)
+{
+	return toupper(c);
+}
+
+// The serial port, printing numbers the way the Arduino Print class does
+
+class HardwareSerial
+{
+public:
+	void begin(uint32_t baud)
+	{
+		hostBoard.serialBegin(baud);
+	}
+
+	int available()
+	{
+		return hostBoard.serialAvailable();
+	}
+
+	int peek()
+	{
+		return hostBoard.serialPeek();
+	}
+
+	int read()
+	{
+		return hostBoard.serialRead();
+	}
+
+	int availableForWrite()
+	{
+		return hostBoard.serialAvailableForWrite();
+	}
+
+	void flush()
+	{
+		hostBoard.serialFlush();
+	}
+
+	operator bool()
+	{
+		return true;
+	}
+
+	size_t write(uint8_t value)
+	{
+		hostBoard.serialWrite(value);
+		return 1;
+	}
+
+	size_t write(const uint8_t * buffer, size_t size)
+	{
+		for (size_t i = 0; i < size; i++)
+			write(buffer[i]);
+		return size;
+	}
+
+	size_t write(const char * text)
+	{
+		return write((const uint8_t *)text, strlen(text));
+	}
+
+	size_t print(const char * text)
+	{
+		return write(text);
+	}
+
+	size_t print(const String & text)
+	{
+		return write(text.c_str());
+	}
+
+	size_t print(char c)
+	{
+		return write((uint8_t)c);
+	}
+
+	size_t print(unsigned char value, int base = DEC)
+	{
+		return printNumber(value, base);
+	}
+
+	size_t print(int value, int base = DEC)
+	{
+		return printSigned((int32_t)value, (uint32_t)value, base);
+	}
+
+	size_t print(unsigned int value, int base = DEC)
+	{
+		return printNumber(value, base);
+	}
+
+	size_t print(long value, int base = DEC)
+	{
+		return printSigned(value, (uint64_t)value, base);
+	}
+
+	size_t print(unsigned long value, int base = DEC)
+	{
+		return printNumber(value, base);
+	}
+
+	// double is the same as float on the AVR
+	size_t print(double value, int digits = 2)
+	{
+		return printFloat((float)value, digits);
+	}
+
+	size_t println()
+	{
+		return write("\r\n");
+	}
+
+	template <typename T> size_t println(T value)
+	{
+		size_t n = print(value);
+		return n + println();
+	}
+
+	template <typename T> size_t println(T value, int format)
+	{
+		size_t n = print(value, format);
+		return n + println();
+	}
+
+private:
+	size_t printNumber(uint64_t value, int base)
+	{
+		char text[66];
+		char * p = &text[sizeof(text) - 1];
+
+		*p = 0;
+
+		if (base < 2)
+			base = 10;
+
+		do
+		{
+			int digit = value % base;
+			value /= base;
+			*--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		} while (value);
+
+		return write(p);
+	}
+
+	size_t printSigned(int64_t value, uint64_t bits, int base)
+	{
+		if (base == 0)
+			return write((uint8_t)value);
+
+		if (base == 10 && value < 0)
+			return print('-') + printNumber((uint64_t)-value, 10);
+
+		if (base == 10)
+			return printNumber((uint64_t)value, 10);
+
+		return printNumber(bits, base);
+	}
+
+	size_t printFloat(float number, int digits)
+	{
+		if (std::isnan(number))
+			return print("nan");
+
+		if (std::isinf(number))
+			return print("inf");
+
+		if (number > 4294967040.0f || number < -4294967040.0f)
+			return print("ovf");
+
+		size_t n = 0;
+
+		if (number < 0.0f)
+		{
+			n += print('-');
+			number = -number;
+		}
+
+		float rounding = 0.5f;
+
+		for (int i = 0; i < digits; i++)
+			rounding /= 10.0f;
+
+		number += rounding;
+
+		uint32_t intPart = (uint32_t)number;
+		float remainder = number - (float)intPart;
+
+		n += printNumber(intPart, 10);
+
+		if (digits > 0)
+			n += print('.');
+
+		while (digits-- > 0)
+		{
+			remainder *= 10.0f;
+			unsigned int toPrint = (unsigned int)remainder;
+			n += printNumber(toPrint, 10);
+			remainder -= toPrint;
+		}
+
+		return n;
+	}
+};
+
+HardwareSerial Serial;
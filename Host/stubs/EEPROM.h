@@ -0,0 +1,32 @@
+// Stand-in for the Arduino EEPROM library, kept by the simulated board
+
+#pragma once
+
+#include "Arduino.h"
+
+class EEPROMClass
+{
+public:
+	uint8_t read(int address)
+	{
+		return hostBoard.eepromRead(address);
+	}
+
+	void write(int address, uint8_t value)
+	{
+		hostBoard.eepromWrite(address, value);
+	}
+
+	void update(int address, uint8_t value)
+	{
+		if (read(address) != value)
+			write(address, value);
+	}
+
+	uint16_t length()
+	{
+		return HOST_EEPROM_SIZE;
+	}
+};
+
+EEPROMClass EEPROM;
@@ -0,0 +1,53 @@
+// Stand-in for the TimerOne library. The interrupt comes a period after the
+// period is set, which is how the motor code uses it from inside the handler.
+
+#pragma once
+
+#include "Arduino.h"
+
+// Longest period with the largest prescaler
+#define HOST_TIMER_ONE_MAX_PERIOD 8388480
+
+class TimerOne
+{
+public:
+	void initialize(long microseconds = 1000000)
+	{
+		setPeriod(microseconds);
+	}
+
+	void setPeriod(long microseconds)
+	{
+		if (microseconds > HOST_TIMER_ONE_MAX_PERIOD)
+			microseconds = HOST_TIMER_ONE_MAX_PERIOD;
+
+		hostBoard.timerSetPeriod((uint32_t)microseconds);
+	}
+
+	void attachInterrupt(void(*isr)(), long microseconds = -1)
+	{
+		if (microseconds > 0)
+			setPeriod(microseconds);
+
+		hostBoard.timerAttach(isr);
+	}
+
+	void detachInterrupt()
+	{
+		hostBoard.timerDetach();
+	}
+
+	void start()
+	{
+	}
+
+	void stop()
+	{
+	}
+
+	void restart()
+	{
+	}
+};
+
+TimerOne Timer1;
@@ -29,9 +29,11 @@ DeviceState deviceState = EXECUTE_IMMEDIATELY;
 
 byte diagnosticsOutputLevel = 0;
 
-long delayEndTime;
+uint32_t delayEndTime;
 
-#define COMMAND_BUFFER_SIZE 60
+// Size of the buffer for statements arriving over the serial line. Big enough
+// for the compiled form of the longest script line.
+#define COMMAND_BUFFER_SIZE 80
 
 // Set command terminator to CR
 
@@ -41,12 +43,99 @@ long delayEndTime;
 // This is the EOT character
 #define PROGRAM_TERMINATOR 0x00
 
-char programCommand[COMMAND_BUFFER_SIZE];
-char * commandPos;
-char * commandLimit;
-char * bufferLimit;
-char * decodePos;
-char * decodeLimit;
+// A read position in a statement being decoded. Statements from the serial
+// line are decoded from the remote command buffer in RAM, stored program
+// statements are decoded straight out of EEPROM without being copied, so a
+// stored statement can be any length. The decoders see the same thing either way.
+
+// The last byte read from the program store. The decoders often look at
+// the same byte more than once and an EEPROM read is slow.
+int storeCachePos = -1;
+char storeCacheByte;
+
+struct statementCursor
+{
+	char * ramPos;    // NULL when reading from the program store
+	int storePos;     // EEPROM offset when reading from the program store
+
+	statementCursor()
+	{
+		ramPos = NULL;
+		storePos = 0;
+	}
+
+	statementCursor(char * pos)
+	{
+		ramPos = pos;
+		storePos = 0;
+	}
+
+	static statementCursor inProgramStore(int pos)
+	{
+		statementCursor result;
+		result.storePos = pos;
+		return result;
+	}
+
+	char operator * () const
+	{
+		if (ramPos)
+			return *ramPos;
+
+		if (storePos != storeCachePos)
+		{
+			storeCacheByte = EEPROM.read(storePos);
+			storeCachePos = storePos;
+		}
+
+		return storeCacheByte;
+	}
+
+	statementCursor & operator ++ ()
+	{
+		if (ramPos)
+			ramPos++;
+		else
+			storePos++;
+		return *this;
+	}
+
+	statementCursor operator ++ (int)
+	{
+		statementCursor result = *this;
+		++(*this);
+		return result;
+	}
+
+	statementCursor & operator += (int offset)
+	{
+		if (ramPos)
+			ramPos += offset;
+		else
+			storePos += offset;
+		return *this;
+	}
+
+	statementCursor operator + (int offset) const
+	{
+		statementCursor result = *this;
+		result += offset;
+		return result;
+	}
+
+	bool operator == (const statementCursor & other) const
+	{
+		return ramPos == other.ramPos & storePos == other.storePos;
+	}
+
+	bool operator != (const statementCursor & other) const
+	{
+		return !(*this == other);
+	}
+};
+
+statementCursor decodePos;
+statementCursor decodeLimit;
 
 char remoteCommand[COMMAND_BUFFER_SIZE];
 char * remotePos;
@@ -79,14 +168,67 @@ byte GetRawCh()
 }
 
 // Current position in the EEPROM of the execution
+// While a statement runs this is the start of it, see exeuteProgramStatement
 int programCounter;
 
+// Set when the running statement moves the program counter itself
+bool programCounterMoved;
+
+void moveProgramCounter(int pos)
+{
+	programCounter = pos;
+	programCounterMoved = true;
+}
+
+// Returns the position of the statement after the one being run
+// The decoders stop on the terminator, so this usually reads only that
+
+int findStatementEnd()
+{
+	if (decodePos.ramPos)
+		return programCounter;
+
+	statementCursor pos = decodePos;
+
+	while (*pos != STATEMENT_TERMINATOR)
+		pos++;
+
+	return pos.storePos + 1;
+}
+
 // Start position of the code as stored in the EEPROM
 int programBase;
 
+// Slot of the program that was last started
+byte runningProgramSlot;
+
+// Position and number of entries of the label table of that program
+int labelTableBase;
+int noOfLabels;
+
+// Bit set for each slot that has passed verifyProgramSlot since power up
+byte verifiedSlots = 0;
+
 // Write position when downloading and storing program code
 int programWriteBase;
 
+// Slot, name and start position of the program being downloaded
+byte downloadSlot;
+char downloadName[PROGRAM_NAME_LENGTH];
+int downloadStart;
+
+// A patch replaces patchDeleteCount statements of the program in
+// downloadSlot, starting at statement patchIndex, with the statements
+// received before RX. These are held in RAM until the patch is complete.
+#define PATCH_BUFFER_SIZE 32
+
+bool patchingProgram = false;
+int patchIndex;
+int patchDeleteCount;
+byte patchBuffer[PATCH_BUFFER_SIZE];
+// Counts every byte received, so can be more than PATCH_BUFFER_SIZE
+int patchLength;
+
 // Write position for any incoming program code
 int bufferWritePosition;
 
@@ -126,29 +268,262 @@ void dumpProgramFromEEPROM(int EEPromStart)
 	}
 }
 
-// Starts a program running at the given position
+// Subroutines
+// The script compiler gives each subroutine a number. The start of each one
+// is marked with a CEnn statement. When a program starts the marks are found
+// and their positions recorded, so a call can go straight to its subroutine.
+
+#define MAX_SUBROUTINES 8
+#define CALL_STACK_SIZE 8
+
+int subroutineOffsets[MAX_SUBROUTINES];
+
+// Return addresses of the subroutines that are running
+int callStack[CALL_STACK_SIZE];
+byte callStackPointer;
+
+// Position of the statement in the given entry of the label table
+// of the running program
+
+inline int labelTableEntry(int entryNo)
+{
+	return programBase + readIntFromEEPROM(labelTableBase + (entryNo * 2));
+}
+
+void findSubroutinesInProgram()
+{
+	for (byte i = 0; i < MAX_SUBROUTINES; i++)
+	{
+		subroutineOffsets[i] = -1;
+	}
+
+	callStackPointer = 0;
+
+	for (int i = 0; i < noOfLabels; i++)
+	{
+		int programPosition = labelTableEntry(i);
+
+		char commandCh = EEPROM.read(programPosition + 1);
+
+		if (commandCh != 'E' & commandCh != 'e')
+			continue;
+
+		int subroutineNo = 0;
+		int digitPos = programPosition + 2;
+
+		while (isdigit(EEPROM.read(digitPos)))
+		{
+			subroutineNo = (subroutineNo * 10) + EEPROM.read(digitPos) - '0';
+			digitPos++;
+		}
+
+		if (subroutineNo < MAX_SUBROUTINES)
+		{
+			subroutineOffsets[subroutineNo] = programPosition;
+		}
+	}
+}
+
+// Label tables
+// Works through the program image at imageStart and finds the statements
+// that go in its label table. If store is true the table is written after
+// the program terminator. Returns the length of the table in bytes.
+
+int buildLabelTable(int imageStart, bool store)
+{
+	int programPosition = imageStart;
+	int tablePosition;
+	bool atStatementStart = true;
+	int tableLength = 0;
+
+	// find the end of the program first, the table goes after it
+	while (EEPROM.read(programPosition) != PROGRAM_TERMINATOR)
+		programPosition++;
+
+	tablePosition = programPosition + 1;
+	programPosition = imageStart;
+
+	while (true)
+	{
+		char ch = EEPROM.read(programPosition);
+
+		if (ch == PROGRAM_TERMINATOR)
+			break;
+
+		if (atStatementStart & (ch == 'C' | ch == 'c'))
+		{
+			char commandCh = EEPROM.read(programPosition + 1);
+
+			if (commandCh == 'L' | commandCh == 'l' | commandCh == 'E' | commandCh == 'e')
+			{
+				if (store)
+					storeIntIntoEEPROM(programPosition - imageStart, tablePosition + tableLength);
+				tableLength += 2;
+			}
+		}
+
+		atStatementStart = (ch == STATEMENT_TERMINATOR);
+		programPosition++;
+	}
+
+	return tableLength;
+}
+
+// Checks the header and CRC of the program image in a slot
+// Each slot is only checked once after power up, unless it is changed, so
+// the code that runs programs can rely on every image ending with the
+// program terminator and doesn't check for running off the end of the EEPROM.
 
-void startProgramExecution(int programPosition)
+bool verifyProgramSlot(byte slot)
 {
-	if (isProgramStored())
+	if (verifiedSlots & (1 << slot))
+		return true;
+
+	programSlot entry;
+	loadProgramSlot(slot, &entry);
+
+	if (entry.length == 0 | entry.format != PROGRAM_FORMAT_VERSION)
+		return false;
+
+	if (entry.offset < (int)PROGRAM_AREA_OFFSET | entry.programLength < 1 |
+		entry.programLength > entry.length | entry.offset + entry.length > EEPROM_SIZE |
+		((entry.length - entry.programLength) & 1))
+		return false;
+
+	if (EEPROM.read(entry.offset + entry.programLength - 1) != PROGRAM_TERMINATOR)
+		return false;
+
+	if (crc16OfEEPROM(entry.offset, entry.length) != entry.crc)
 	{
+#ifdef PROGRAM_DEBUG
+		Serial.print(F(".Program CRC failed in slot: "));
+		Serial.println(slot);
+#endif
+		return false;
+	}
 
+	verifiedSlots |= 1 << slot;
+
+	return true;
+}
+
+// A patch cut short by a reset leaves its slot marked as being patched.
+// The half patched image is thrown away, along with any program after it
+// that fails its CRC check because it was only part way through being
+// moved, and the store is compacted to close the gaps.
+
+void recoverProgramPatch()
+{
+	int patchedOffset = -1;
+
+	for (byte slot = 0; slot < NO_OF_PROGRAM_SLOTS; slot++)
+	{
+		programSlot entry;
+		loadProgramSlot(slot, &entry);
+
+		if (entry.length > 0 & entry.format == PROGRAM_FORMAT_PATCHING)
+		{
 #ifdef PROGRAM_DEBUG
-		Serial.print(F(".Starting program execution at: "));
-		Serial.println(programPosition);
+			Serial.print(F(".Dropping half patched program in slot: "));
+			Serial.println(slot);
 #endif
-		clearVariables();
-		setAllLightsOff();
-		programCounter = programPosition;
-		programBase = programPosition;
-		programState = PROGRAM_ACTIVE;
+			patchedOffset = entry.offset;
+			memset(&entry.name, 0, PROGRAM_NAME_LENGTH);
+			entry.length = 0;
+			storeProgramSlot(slot, &entry);
+		}
 	}
+
+	if (patchedOffset == -1)
+		return;
+
+	for (byte slot = 0; slot < NO_OF_PROGRAM_SLOTS; slot++)
+	{
+		programSlot entry;
+		loadProgramSlot(slot, &entry);
+
+		if (entry.length > 0 && entry.offset > patchedOffset && !verifyProgramSlot(slot))
+		{
+			memset(&entry.name, 0, PROGRAM_NAME_LENGTH);
+			entry.length = 0;
+			storeProgramSlot(slot, &entry);
+		}
+	}
+
+	compactProgramStore();
+}
+
+// Called in setup to check the program that runs at power up before it
+// starts. The other slots are checked the first time they are started.
+
+void verifyProgramStore()
+{
+	verifiedSlots = 0;
+
+	if (!isProgramStored())
+		return;
+
+	recoverProgramPatch();
+
+	verifyProgramSlot(getStartProgramSlot());
+}
+
+// Starts the program in the given slot running
+// Returns false if the slot is empty or the program has been corrupted
+
+bool startProgramExecution(byte slot)
+{
+	if (!isProgramStored() | slot >= NO_OF_PROGRAM_SLOTS)
+		return false;
+
+	if (!verifyProgramSlot(slot))
+		return false;
+
+	programSlot entry;
+	loadProgramSlot(slot, &entry);
+
+#ifdef PROGRAM_DEBUG
+	Serial.print(F(".Starting program execution at: "));
+	Serial.println(entry.offset);
+#endif
+	clearVariables();
+	setAllLightsOff();
+	resetOdometry();
+	stopTune();
+	runningProgramSlot = slot;
+	programCounter = entry.offset;
+	programBase = entry.offset;
+	labelTableBase = entry.offset + entry.programLength;
+	noOfLabels = (entry.length - entry.programLength) / 2;
+	findSubroutinesInProgram();
+	programState = PROGRAM_ACTIVE;
+
+	return true;
 }
 
 // RH - remote halt
+// Stops the program and everything it set going: the motors, any tune and
+// any animation
 
 void haltProgramExecution()
 {
+#ifdef PROGRAM_DEBUG
+	Serial.print(F(".Halting program execution at: "));
+	Serial.println(programCounter);
+#endif
+
+	motorStop();
+	stopTune();
+	stopAnimation();
+
+	programState = PROGRAM_STOPPED;
+}
+
+// Called when the program runs off its end. The motors are stopped as for
+// a halt, but a tune or animation started by the program plays on.
+
+void endProgramExecution()
+{
 #ifdef PROGRAM_DEBUG
 	Serial.print(F(".Ending program execution at: "));
 	Serial.println(programCounter);
@@ -235,19 +610,24 @@ void resetLineStorageState()
 
 void storeProgramByte(byte b)
 {
+	if (patchingProgram)
+	{
+		if (patchLength < PATCH_BUFFER_SIZE)
+			patchBuffer[patchLength] = b;
+		patchLength++;
+		return;
+	}
+
 	storeByteIntoEEPROM(b, programWriteBase++);
 }
 
-void clearStoredProgram()
-{
-	clearProgramStoredFlag();
-	storeByteIntoEEPROM(PROGRAM_TERMINATOR, STORED_PROGRAM_OFFSET);
-}
+void pauseSerialInput();
 
-// Called to start the download of program code
+// Called to start the download of program code into a slot
 // each byte that arrives down the serial port is now stored in program memory
+// The name of the program must already be in downloadName
 //
-void startDownloadingCode(int downloadPosition)
+void startDownloadingCode(byte slot)
 {
 #ifdef PROGRAM_DEBUG
 	Serial.println(".Starting code download");
@@ -258,12 +638,21 @@ void startDownloadingCode(int downloadPosition)
 
 	// clear the existing program so that
 	// partially stored programs never get executed on power up
+	// The new program is stored after all the others
+	// Each byte moved can take an EEPROM write, which is longer than a byte
+	// takes to arrive, so the program text that follows is held off first
+
+	if (programBytesAfter(slot) > 0)
+		pauseSerialInput();
 
-	clearStoredProgram();
+	removeProgramFromStore(slot);
+	verifiedSlots &= ~(1 << slot);
 
 	deviceState = STORE_PROGRAM;
 
-	programWriteBase = downloadPosition;
+	downloadSlot = slot;
+	downloadStart = programStoreEnd();
+	programWriteBase = downloadStart;
 
 	resetLineStorageState();
 
@@ -282,6 +671,14 @@ void startDownloadingCode(int downloadPosition)
 
 int decodeScriptChar(char b, void(*output) (byte));
 
+// Telemetry.h
+void remoteTelemetry();
+
+// Memory.h
+void displayMemory();
+
+int findNextStatement(int programPosition);
+
 // Called when a byte is received from the host when in program storage mode
 // Adds it to the stored program, updates the stored position and the counter
 // If the byte is the terminator byte (zero) it changes to the "wait for checksum" state
@@ -289,6 +686,194 @@ int decodeScriptChar(char b, void(*output) (byte));
 
 //#define STORE_RECEIVED_BYTE_DEBUG
 
+// Records a completed download in the program directory. The new program
+// becomes the one that runs at power up.
+
+void storeDownloadedProgramSlot()
+{
+	programSlot entry;
+
+	memcpy(entry.name, downloadName, PROGRAM_NAME_LENGTH);
+	entry.offset = downloadStart;
+	entry.programLength = programWriteBase - downloadStart;
+	entry.length = entry.programLength + buildLabelTable(downloadStart, true);
+	entry.format = PROGRAM_FORMAT_VERSION;
+	entry.crc = crc16OfEEPROM(entry.offset, entry.length);
+
+	storeProgramSlot(downloadSlot, &entry);
+	verifiedSlots |= 1 << downloadSlot;
+	setStartProgramSlot(downloadSlot);
+}
+
+// Returns the position of the statement count statements on from pos
+// or -1 if the program ends first
+
+int skipStatements(int pos, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (EEPROM.read(pos) == PROGRAM_TERMINATOR)
+			return -1;
+
+		pos = findNextStatement(pos);
+
+		if (pos == -1)
+			return -1;
+	}
+
+	return pos;
+}
+
+// Moves the bytes of the store from start up to end by change bytes,
+// working away from the direction of the move so that no byte is written
+// over before it has been moved
+
+void moveStoreBytes(int start, int end, int change)
+{
+	if (change > 0)
+	{
+		for (int pos = end - 1; pos >= start; pos--)
+			EEPROM.update(pos + change, EEPROM.read(pos));
+	}
+	else if (change < 0)
+	{
+		for (int pos = start; pos < end; pos++)
+			EEPROM.update(pos + change, EEPROM.read(pos));
+	}
+}
+
+// Number of label table entries needed by the statements in the patch
+
+int patchLabelTableLength()
+{
+	int tableLength = 0;
+	bool atStatementStart = true;
+
+	for (int i = 0; i < patchLength - 1; i++)
+	{
+		byte b = patchBuffer[i];
+		byte next = patchBuffer[i + 1];
+
+		if (atStatementStart & (b == 'C' | b == 'c') &
+			(next == 'L' | next == 'l' | next == 'E' | next == 'e'))
+			tableLength += 2;
+
+		atStatementStart = (b == STATEMENT_TERMINATOR);
+	}
+
+	return tableLength;
+}
+
+// Puts the received patch into the program in downloadSlot
+// Only the part of the store after the change is moved, and EEPROM.update
+// skips any byte that ends up the same, so replacing a statement with one
+// of the same length only writes the bytes that differ. The label table is
+// then built again, and the programs after this one moved again if it has
+// changed size.
+// The slot is marked as being patched before anything is moved. Its new
+// header and CRC are written after everything else, still marked, and the
+// format byte put back last of all. A patch cut short by a reset leaves the
+// mark, and recoverProgramPatch() clears the slot up at power up. The moves
+// are not journalled, so programs after this one that were part way through
+// being moved are dropped too, and have to be sent again.
+// Returns false, with nothing changed, if the patch can't be made
+
+bool applyProgramPatch()
+{
+	if (patchLength > PATCH_BUFFER_SIZE)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("RXFAIL: patch too long"));
+#endif
+		return false;
+	}
+
+	programSlot entry;
+	loadProgramSlot(downloadSlot, &entry);
+
+	int editStart = -1;
+	int editEnd = -1;
+
+	// Only a checked program can be worked through safely
+	if (verifyProgramSlot(downloadSlot))
+	{
+		editStart = skipStatements(entry.offset, patchIndex);
+	}
+
+	if (editStart != -1)
+	{
+		editEnd = skipStatements(editStart, patchDeleteCount);
+	}
+
+	if (editEnd == -1)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("RXFAIL: no statement to patch"));
+#endif
+		return false;
+	}
+
+	int change = patchLength - (editEnd - editStart);
+	int storeEnd = programStoreEnd();
+
+	// The new labels can only make the table longer by this much
+	if (storeEnd + change + patchLabelTableLength() > EEPROM_SIZE)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("RXFAIL: program store full"));
+#endif
+		return false;
+	}
+
+	verifiedSlots &= ~(1 << downloadSlot);
+
+	// Any input after the RX waits until the store has been rewritten
+	pauseSerialInput();
+
+	storeProgramSlotFormat(downloadSlot, PROGRAM_FORMAT_PATCHING);
+
+	moveStoreBytes(editEnd, storeEnd, change);
+
+	storeBlockIntoEEPROM(patchBuffer, patchLength, editStart);
+
+	int oldTableLength = entry.length - entry.programLength;
+
+	storeEnd += change;
+	entry.programLength += change;
+
+	// Make room for the new label table in front of the programs after this one
+	int newTableLength = buildLabelTable(entry.offset, false);
+	int tableEnd = entry.offset + entry.programLength + oldTableLength;
+
+	moveStoreBytes(tableEnd, storeEnd, newTableLength - oldTableLength);
+
+	buildLabelTable(entry.offset, true);
+
+	change += newTableLength - oldTableLength;
+
+	for (byte i = 0; i < NO_OF_PROGRAM_SLOTS; i++)
+	{
+		programSlot moved;
+		loadProgramSlot(i, &moved);
+
+		if (moved.length > 0 && moved.offset > entry.offset)
+		{
+			moved.offset += change;
+			storeProgramSlot(i, &moved);
+		}
+	}
+
+	entry.length = entry.programLength + newTableLength;
+	entry.crc = crc16OfEEPROM(entry.offset, entry.length);
+	entry.format = PROGRAM_FORMAT_PATCHING;
+	storeProgramSlot(downloadSlot, &entry);
+
+	storeProgramSlotFormat(downloadSlot, PROGRAM_FORMAT_VERSION);
+	verifiedSlots |= 1 << downloadSlot;
+
+	return true;
+}
+
 void endProgramReceive()
 {
 	stopBusyPixel();
@@ -333,22 +918,43 @@ void storeReceivedByte(byte b)
 		case 'X':
 			endProgramReceive();
 
+			if (patchingProgram)
+			{
+				patchingProgram = false;
+
+				if (applyProgramPatch())
+				{
+					startProgramExecution(downloadSlot);
+				}
+				break;
+			}
+
 			// put the terminator on the end
 
 			storeProgramByte(PROGRAM_TERMINATOR);
 
-			setProgramStored();
+			if (programWriteBase > EEPROM_SIZE ||
+				programWriteBase + buildLabelTable(downloadStart, false) > EEPROM_SIZE)
+			{
+				// The slot stays empty
+#ifdef DIAGNOSTICS_ACTIVE
+				Serial.println(F("RXFAIL: program store full"));
+#endif
+				break;
+			}
+
+			storeDownloadedProgramSlot();
 
 #ifdef DIAGNOSTICS_ACTIVE
 
 			if (diagnosticsOutputLevel & DUMP_DOWNLOADS)
 			{
-				dumpProgramFromEEPROM(STORED_PROGRAM_OFFSET);
+				dumpProgramFromEEPROM(downloadStart);
 			}
 
 #endif
 
-			startProgramExecution(STORED_PROGRAM_OFFSET);
+			startProgramExecution(downloadSlot);
 
 			break;
 
@@ -357,7 +963,9 @@ void storeReceivedByte(byte b)
 			Serial.println("RA");
 			endProgramReceive();
 
-			clearStoredProgram();
+			// the slot was emptied when the download started
+			// or is left as it was by an abandoned patch
+			patchingProgram = false;
 
 			break;
 
@@ -416,16 +1024,7 @@ void storeReceivedByte(byte b)
 			// look busy
 			updateBusyPixel();
 		}
-	}
-}
-
-void resetCommand()
-{
-#ifdef COMMAND_DEBUG
-	Serial.println(".**resetCommand");
-#endif
-	commandPos = programCommand;
-	bufferLimit = commandPos + COMMAND_BUFFER_SIZE;
+	}
 }
 
 #ifdef COMMAND_DEBUG
@@ -502,10 +1101,10 @@ void remoteMoveForwards()
 		return;
 	}
 
-	int moveResult = timedMoveDistanceInMM(forwardMoveDistance, forwardMoveDistance, (float)forwardMoveTime / 10.0);
-
 #ifdef DIAGNOSTICS_ACTIVE
 
+	int moveResult = timedMoveDistanceInMM(forwardMoveDistance, forwardMoveDistance, (float)forwardMoveTime / 10.0);
+
 	if (moveResult == 0)
 	{
 
@@ -524,6 +1123,10 @@ void remoteMoveForwards()
 		}
 	}
 
+#else
+
+	timedMoveDistanceInMM(forwardMoveDistance, forwardMoveDistance, (float)forwardMoveTime / 10.0);
+
 #endif
 
 }
@@ -652,10 +1255,10 @@ void remoteMoveAngle()
 	Serial.println(time);
 #endif
 
-	int reply = timedMoveArcRobot(radius, angle, time / 10.0);
-
 #ifdef DIAGNOSTICS_ACTIVE
 
+	int reply = timedMoveArcRobot(radius, angle, time / 10.0);
+
 	if (reply == 0)
 	{
 
@@ -672,6 +1275,149 @@ void remoteMoveAngle()
 		}
 	}
 
+#else
+
+	timedMoveArcRobot(radius, angle, time / 10.0);
+
+#endif
+}
+
+// Command MGx,y,time - go to point. 
+// x - distance to the right of the start position in mm
+// y - distance ahead of the start position in mm
+// time - time for the move
+//
+// Return OK
+
+//#define MOVE_GOTO_DEBUG
+
+void remoteMoveGoto()
+{
+#ifdef MOVE_GOTO_DEBUG
+	Serial.println(".**moveGoto");
+#endif
+
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("MGFail: no x"));
+		}
+
+#endif
+
+		return;
+	}
+
+	int x;
+
+	if (!getValue(&x))
+	{
+		return;
+	}
+
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("MGFail: no y"));
+		}
+
+#endif
+
+		return;
+	}
+
+	decodePos++;
+
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("MGFail: no y"));
+		}
+
+#endif
+		return;
+	}
+
+	int y;
+
+	if (!getValue(&y))
+	{
+		return;
+	}
+
+	int time = 0;
+
+	if (*decodePos != STATEMENT_TERMINATOR & decodePos != decodeLimit)
+	{
+		decodePos++;
+
+		if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+		{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("MGFail: no time"));
+			}
+
+#endif
+
+			return;
+		}
+
+		if (!getValue(&time))
+		{
+			return;
+		}
+	}
+
+#ifdef MOVE_GOTO_DEBUG
+	Serial.print("    x: ");
+	Serial.print(x);
+	Serial.print(" y: ");
+	Serial.print(y);
+	Serial.print(" time: ");
+	Serial.println(time);
+#endif
+
+	// time is in ticks of a tenth of a second
+#ifdef DIAGNOSTICS_ACTIVE
+
+	int reply = startGoto(x, y, time * 100L);
+
+	if (reply == 0)
+	{
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.print(F("MGOK"));
+		}
+	}
+	else
+	{
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.print(F("MGFail"));
+		}
+	}
+
+#else
+
+	startGoto(x, y, time * 100L);
+
 #endif
 }
 
@@ -800,10 +1546,10 @@ void remoteMoveMotors()
 	Serial.println(time);
 #endif
 
-	int reply = timedMoveDistanceInMM(leftDistance, rightDistance, time / 10.0);
-
 #ifdef DIAGNOSTICS_ACTIVE
 
+	int reply = timedMoveDistanceInMM(leftDistance, rightDistance, time / 10.0);
+
 	if (reply == 0)
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -820,6 +1566,10 @@ void remoteMoveMotors()
 		}
 	}
 
+#else
+
+	timedMoveDistanceInMM(leftDistance, rightDistance, time / 10.0);
+
 #endif
 
 }
@@ -966,6 +1716,61 @@ void remoteViewWheelConfig()
 	dumpActiveWheelSettings();
 }
 
+// Command MDn - set the drive mode, 0 for half step and 1 for full step
+// The mode is stored with the wheel settings
+// Return OK
+
+void remoteSetDriveMode()
+{
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("MDFail: no drive mode"));
+		}
+
+#endif
+
+		return;
+	}
+
+	int mode;
+
+	if (!getValue(&mode))
+	{
+		return;
+	}
+
+	if (mode != HALF_STEP_DRIVE & mode != FULL_STEP_DRIVE)
+	{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("MDFail: invalid drive mode"));
+		}
+
+#endif
+
+		return;
+	}
+
+	setDriveMode(mode);
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("MDOK"));
+	}
+
+#endif
+}
+
 #ifdef COMMAND_DEBUG
 #define ROTATE_DEBUG
 #endif
@@ -997,8 +1802,6 @@ void remoteRotateRobot()
 		return;
 	}
 
-	rotateAngle;
-
 	if (!getValue(&rotateAngle))
 	{
 		return;
@@ -1164,6 +1967,14 @@ void remoteMoveControl()
 	case 'a':
 		remoteMoveAngle();
 		break;
+	case 'G':
+	case 'g':
+		remoteMoveGoto();
+		break;
+	case 'D':
+	case 'd':
+		remoteSetDriveMode();
+		break;
 	case 'F':
 	case 'f':
 		remoteMoveForwards();
@@ -1327,6 +2138,8 @@ void remoteColouredCandle()
 }
 
 // Command PNname - set a coloured candle with the name as given
+// The name is either a single letter (r g b c m y w k) or a full
+// colour name from the named colour table, for example PNmagenta
 // Return OK
 
 void remoteSetColorByName()
@@ -1362,7 +2175,52 @@ void remoteSetColorByName()
 		return;
 	}
 
-	char inputCh = toLowerCase(*decodePos);
+	// A full colour name is looked up in the named colour table,
+	// a single letter selects one of the primary colours
+
+	char name[MAX_COLOUR_NAME_LENGTH + 1];
+	byte nameLength = 0;
+
+	while (decodePos != decodeLimit && *decodePos != STATEMENT_TERMINATOR)
+	{
+		if (nameLength < MAX_COLOUR_NAME_LENGTH)
+		{
+			name[nameLength++] = *decodePos;
+		}
+		decodePos++;
+	}
+	name[nameLength] = 0;
+
+	if (nameLength > 1)
+	{
+		normaliseColourName(name);
+
+		if (!findNamedColour(name, &r, &g, &b))
+		{
+#ifdef DIAGNOSTICS_ACTIVE
+
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("FAIL: unknown colour in set colour by name"));
+			}
+#endif
+			return;
+		}
+
+		flickeringColouredLights(r, g, b, 0, 200);
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("OK"));
+		}
+
+#endif
+		return;
+	}
+
+	char inputCh = toLowerCase(name[0]);
 
 	switch (inputCh) 
 	{
@@ -1580,45 +2438,119 @@ void remoteSetIndividualPixel()
 
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println(F("Fail: mising colours after pixel"));
+			Serial.println(F("Fail: mising colours after pixel"));
+		}
+
+#endif
+
+		return;
+	}
+
+	byte r, g, b;
+
+	if (readColour(&r, &g, &b))
+	{
+		setLightColor(r, g, b, no);
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println("OK");
+		}
+
+#endif
+
+	}
+}
+
+void remoteSetPixelsOff()
+{
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println("POOK");
+	}
+
+#endif
+
+	setAllLightsOff();
+}
+
+// PKnnn      - play keyframe animation nnn once
+// PKnnn,1    - play keyframe animation nnn over and over
+// PK         - stop the animation
+
+void remoteAnimation()
+{
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.println(".**remoteAnimation: ");
+#endif
+
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+		stopAnimation();
+
+#ifdef DIAGNOSTICS_ACTIVE
+
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("PKOK"));
 		}
 
 #endif
+		return;
+	}
+
+	int animationNo;
 
+	if (!getValue(&animationNo))
+	{
 		return;
 	}
 
-	byte r, g, b;
+	int loop = 0;
 
-	if (readColour(&r, &g, &b))
+	if (*decodePos != STATEMENT_TERMINATOR & decodePos != decodeLimit)
 	{
-		setLightColor(r, g, b, no);
+		decodePos++;
+
+		if (!getValue(&loop))
+		{
+			return;
+		}
+	}
+
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.print(".  Animation: ");
+	Serial.print(animationNo);
+	Serial.print(" loop: ");
+	Serial.println(loop);
+#endif
 
+	if (!startAnimation(animationNo, loop != 0))
+	{
 #ifdef DIAGNOSTICS_ACTIVE
 
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println("OK");
+			Serial.println(F("PKFail: no animation"));
 		}
 
 #endif
-
+		return;
 	}
-}
-
-void remoteSetPixelsOff()
-{
 
 #ifdef DIAGNOSTICS_ACTIVE
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.println("POOK");
+		Serial.println(F("PKOK"));
 	}
 
 #endif
-
-	setAllLightsOff();
 }
 
 void remoteSetRandomColors()
@@ -1698,6 +2630,10 @@ void remotePixelControl()
 	case 'N':
 		remoteSetColorByName();
 		break;
+	case 'k':
+	case 'K':
+		remoteAnimation();
+		break;
 	}
 }
 
@@ -1748,7 +2684,7 @@ void remoteDelay()
 	}
 #endif
 
-	delayEndTime = millis() + delayValueInTenthsIOfASecond * 100;
+	delayEndTime = millis() + delayValueInTenthsIOfASecond * 100L;
 
 	programState = PROGRAM_AWAITING_DELAY_COMPLETION;
 }
@@ -1771,6 +2707,9 @@ void declareLabel()
 #endif
 }
 
+// Only used on verified programs, which always end with the program
+// terminator, so this never runs off the end of the EEPROM
+
 int findNextStatement(int programPosition)
 {
 
@@ -1778,188 +2717,92 @@ int findNextStatement(int programPosition)
 	{
 		char ch = EEPROM.read(programPosition);
 
-		if (ch == PROGRAM_TERMINATOR | programPosition == EEPROM_SIZE)
+		if (ch == PROGRAM_TERMINATOR)
 			return -1;
 
-		if (ch == STATEMENT_TERMINATOR)
-		{
-			programPosition++;
-			if (programPosition == EEPROM_SIZE)
-				return -1;
-			else
-				return programPosition;
-		}
 		programPosition++;
+
+		if (ch == STATEMENT_TERMINATOR)
+			return programPosition;
 	}
 }
 
-// Find a label in the program
-// Returns the offset into the program where the label is declared
-// The first parameter is the first character of the label 
+// Find a label in the running program
+// Returns the offset into the program of the statement after the label, as
+// the label itself does nothing. The script compiler puts labels that are
+// in the same place into one statement, such as CLl8,l6, and threads jumps
+// when it compiles them, so this is the only lookup a jump needs.
+// The parameter is the first character of the label 
 // (i.e. the character after the instruction code that specifies the destination)
 // This might not always be the same command (it might be a branch or a subroutine call)
-// The second parameter is the start position of the search in the program. 
-// This is always the start of a statement, and usually the start of the program, to allow
-// branches up the code. 
+// Only the statements in the label table of the program are looked at.
 
 //#define FIND_LABEL_IN_PROGRAM_DEBUG
 
-int findLabelInProgram(char * label, int programPosition)
+int findLabelInProgram(statementCursor label)
 {
-	// Assume we are starting at the beginning of the program
-
-	while (true)
+	for (int i = 0; i < noOfLabels; i++)
 	{
-		// Spin down the statements
-
-		int statementStart = programPosition;
-
-		char programByte = EEPROM.read(programPosition++);
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-		Serial.print("Statement at: ");
-		Serial.print(statementStart);
-		Serial.print(" starting: ");
-		Serial.println(programByte);
-#endif
-		if (programByte != 'C' & programByte != 'c')
-		{
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.println("Not a statement that starts with C");
-#endif
-
-			programPosition = findNextStatement(programPosition);
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.print("Spin to statement at: ");
-			Serial.println(programPosition);
-#endif
-
-			// Check to see if we have reached the end of the program in EEPROM
-			if (programPosition == -1)
-			{
-				// Give up if the end of the code has been reached
-				return -1;
-			}
-			else
-			{
-				// Check this statement
-				continue;
-			}
-		}
-
-		// If we get here we have found a C
-
-		programByte = EEPROM.read(programPosition++);
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-
-		Serial.print("Second statement character: ");
-		Serial.println(programByte);
+		int statementStart = labelTableEntry(i);
 
-#endif
+		char programByte = EEPROM.read(statementStart + 1);
 
-		// if we get here we have a control command - see if the command is a label
+		// subroutine entries are in the table too
 		if (programByte != 'L' & programByte != 'l')
-		{
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.println("Not a loop command");
-#endif
-
-			programPosition = findNextStatement(programPosition);
-			if (programPosition == -1)
-			{
-				return -1;
-			}
-			else
-			{
-				continue;
-			}
-		}
-
-		//if we get here we have a CL command
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-		Serial.println("Got a CL command");
-#endif
-
-		// Set start position for label comparison
-		char * labelTest = label;
+			continue;
 
-		// Now spin down the label looking for a match
+		int programPosition = statementStart + 2;
 
-		while (*labelTest != STATEMENT_TERMINATOR & programPosition < EEPROM_SIZE)
+		while (true)
 		{
-			programByte = EEPROM.read(programPosition);
+			// Set start position for label comparison
+			statementCursor labelTest = label;
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.print("Destination byte: ");
-			Serial.print(*labelTest);
-			Serial.print(" Program byte: ");
-			Serial.println(programByte);
-#endif
+			programByte = EEPROM.read(programPosition);
 
-			if (*labelTest == programByte)
+			// Each name in the statement ends with a comma or the statement
+			// terminator, so this stops at the end of it even if the label
+			// being looked for is longer
+			while (*labelTest != STATEMENT_TERMINATOR && *labelTest == programByte)
 			{
-
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-				Serial.println("Got a match");
-#endif
-				// Move on to the next byte
 				labelTest++;
 				programPosition++;
+				programByte = EEPROM.read(programPosition);
 			}
-			else
-			{
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-				Serial.println("Fail");
-#endif
-				break;
-			}
-		}
-
-		// get here when we reach the end of the statement or we have a mismatch
-
-		// Get the byte at the end of the destination statement
-
-		programByte = EEPROM.read(programPosition);
-
-		if (*labelTest == programByte)
-		{
-			// If the end of the label matches the end of the statement code we have a match
-			// Note that this means that if the last line of the program is a label we can only 
-			// find this line if it has a statement terminator on the end. 
-			// Which is fine by me. 
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.println("label match");
-#endif
-			return statementStart;
-		}
-		else
-		{
-			programPosition = findNextStatement(programPosition);
+			bool nameEnd = programByte == ',' | programByte == STATEMENT_TERMINATOR;
 
+			// If the end of the label matches the end of the name we have a match
+			if (*labelTest == STATEMENT_TERMINATOR & nameEnd)
+			{
 #ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.print("Spin to statement at: ");
-			Serial.println(programPosition);
+				Serial.print("label match at: ");
+				Serial.println(statementStart);
 #endif
+				while (programByte != STATEMENT_TERMINATOR)
+				{
+					programPosition++;
+					programByte = EEPROM.read(programPosition);
+				}
 
-			// Check to see if we have reached the end of the program in EEPROM
-			if (programPosition == -1)
-			{
-				// Give up if the end of the code has been reached
-				return -1;
+				return programPosition + 1;
 			}
-			else
+
+			// move on to the next name in the statement
+			while (programByte != ',' & programByte != STATEMENT_TERMINATOR)
 			{
-				// Check this statement
-				continue;
+				programPosition++;
+				programByte = EEPROM.read(programPosition);
 			}
+
+			if (programByte == STATEMENT_TERMINATOR)
+				break;
+
+			programPosition++;
 		}
 	}
+
+	return -1;
 }
 
 // Command CJxxxx - jump to label
@@ -1972,10 +2815,7 @@ void jumpToLabel()
 	Serial.println(".**jump to label");
 #endif
 
-	char * labelPos = decodePos;
-	char * labelSearch = decodePos;
-
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = findLabelInProgram(decodePos);
 
 #ifdef JUMP_TO_LABEL_DEBUG
 	Serial.print("Label statement pos: ");
@@ -1985,7 +2825,7 @@ void jumpToLabel()
 	if (labelStatementPos >= 0)
 	{
 		// the label has been found - jump to it
-		programCounter = labelStatementPos;
+		moveProgramCounter(labelStatementPos);
 
 #ifdef JUMP_TO_LABEL_DEBUG
 		Serial.print("New Program Counter: ");
@@ -2010,6 +2850,86 @@ void jumpToLabel()
 	}
 }
 
+// Command CEnn - start of subroutine nn
+// Only used to find the subroutine when the program starts
+
+void subroutineEntry()
+{
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("CEOK"));
+	}
+#endif
+}
+
+// Command CPnn - call subroutine nn
+// Stops the program if the calls are nested too deeply
+
+void callSubroutine()
+{
+	int subroutineNo;
+
+	if (!getValue(&subroutineNo))
+	{
+		return;
+	}
+
+	if (subroutineNo < 0 | subroutineNo >= MAX_SUBROUTINES || subroutineOffsets[subroutineNo] < 0)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("CPFail: no subroutine"));
+		}
+#endif
+		return;
+	}
+
+	if (callStackPointer == CALL_STACK_SIZE)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("CPFail: calls nested too deeply"));
+#endif
+		haltProgramExecution();
+		return;
+	}
+
+	callStack[callStackPointer++] = findStatementEnd();
+	moveProgramCounter(subroutineOffsets[subroutineNo]);
+
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("CPOK"));
+	}
+#endif
+}
+
+// Command CR - return from a subroutine
+// Stops the program if no subroutine is running
+
+void returnFromSubroutine()
+{
+	if (callStackPointer == 0)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("CRFail: not in a subroutine"));
+#endif
+		haltProgramExecution();
+		return;
+	}
+
+	moveProgramCounter(callStack[--callStackPointer]);
+
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("CROK"));
+	}
+#endif
+}
+
 //#define JUMP_TO_LABEL_COIN_DEBUG
 
 // Command CCxxxx - jump to label on a coin toss
@@ -2023,10 +2943,7 @@ void jumpToLabelCoinToss()
 
 #endif
 
-	char * labelPos = decodePos;
-	char * labelSearch = decodePos;
-
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = findLabelInProgram(decodePos);
 
 #ifdef JUMP_TO_LABEL_COIN_DEBUG
 	Serial.print("  Label statement pos: ");
@@ -2039,7 +2956,7 @@ void jumpToLabelCoinToss()
 
 		if (random(0, 2) == 0)
 		{
-			programCounter = labelStatementPos;
+			moveProgramCounter(labelStatementPos);
 #ifdef DIAGNOSTICS_ACTIVE
 			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 			{
@@ -2152,7 +3069,7 @@ void measureDistanceAndJump()
 		return;
 	}
 
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = findLabelInProgram(decodePos);
 
 #ifdef COMMAND_MEASURE_DEBUG
 	Serial.print("Label statement pos: ");
@@ -2180,7 +3097,7 @@ void measureDistanceAndJump()
 		Serial.println(F("Distance smaller - taking jump"));
 #endif
 		// the label has been found - jump to it
-		programCounter = labelStatementPos;
+		moveProgramCounter(labelStatementPos);
 
 #ifdef DIAGNOSTICS_ACTIVE
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -2255,7 +3172,7 @@ void compareAndJump(bool jumpIfTrue)
 		return;
 	}
 
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = findLabelInProgram(decodePos);
 
 #ifdef COMPARE_CONDITION_DEBUG
 	Serial.print("Label statement pos: ");
@@ -2276,7 +3193,7 @@ void compareAndJump(bool jumpIfTrue)
 		Serial.println(F("Condition true - taking jump"));
 #endif
 		// the label has been found - jump to it
-		programCounter = labelStatementPos;
+		moveProgramCounter(labelStatementPos);
 
 #ifdef DIAGNOSTICS_ACTIVE
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -2332,7 +3249,7 @@ void jumpWhenMotorsInactive()
 		return;
 	}
 
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = findLabelInProgram(decodePos);
 
 #ifdef JUMP_MOTORS_INACTIVE_DEBUG
 	Serial.print("Label statement pos: ");
@@ -2356,7 +3273,7 @@ void jumpWhenMotorsInactive()
 		Serial.println("Motors inactive - taking jump");
 #endif
 		// the label has been found - jump to it
-		programCounter = labelStatementPos;
+		moveProgramCounter(labelStatementPos);
 #ifdef DIAGNOSTICS_ACTIVE
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
@@ -2441,34 +3358,207 @@ void programControl()
 	case 'f':
 		compareAndJump(false);
 		break;
+	case 'E':
+	case 'e':
+		subroutineEntry();
+		break;
+	case 'P':
+	case 'p':
+		callSubroutine();
+		break;
+	case 'R':
+	case 'r':
+		returnFromSubroutine();
+		break;
 	}
 }
 
 //#define REMOTE_DOWNLOAD_DEBUG
 
-// RM - start remote download
+// Reads the program slot number at the decode position into slot
+// If there is no number the slot that runs at power up is used
+// Returns false if the number is not a valid slot
+
+bool getProgramSlotNo(byte * slot)
+{
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+		*slot = getStartProgramSlot();
+		return true;
+	}
+
+	int value;
+
+	if (!getValue(&value))
+		return false;
+
+	if (value < 0 | value >= NO_OF_PROGRAM_SLOTS)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("FAIL: invalid program slot"));
+#endif
+		return false;
+	}
+
+	*slot = value;
+	return true;
+}
+
+// RM - start remote download into the power up slot
+// RMn - start remote download into slot n
+// RMn,name - start remote download into slot n and name the program
 
 void remoteDownload()
 {
 
-#ifdef REMOTE_DOWNLOAD_DEBUG
-	Serial.println(F(".**remote download"));
+#ifdef REMOTE_DOWNLOAD_DEBUG
+	Serial.println(F(".**remote download"));
+#endif
+
+	if (deviceState != EXECUTE_IMMEDIATELY)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("RMFAIL: not accepting commands"));
+#endif
+		return;
+	}
+
+	byte slot;
+
+	if (!getProgramSlotNo(&slot))
+		return;
+
+	memset(downloadName, 0, PROGRAM_NAME_LENGTH);
+
+	if (*decodePos == ',')
+	{
+		decodePos++;
+
+		for (byte i = 0; i < PROGRAM_NAME_LENGTH; i++)
+		{
+			if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+				break;
+
+			downloadName[i] = *decodePos;
+			decodePos++;
+		}
+	}
+
+	startDownloadingCode(slot);
+}
+
+// REn,i,c - patch the program in slot n. The statements received up to the
+// next RX replace the c statements starting at statement i, counting from
+// zero. A count of zero inserts statements in front of statement i and no
+// statements deletes them. The program is only changed when RX arrives,
+// and a reset while it is being changed loses it, see applyProgramPatch().
+// A script line can compile to more than one statement, or none, and
+// hullhost lines on the host build gives the statement numbers of each line.
+
+void remotePatch()
+{
+	if (deviceState != EXECUTE_IMMEDIATELY)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("REFAIL: not accepting commands"));
+#endif
+		return;
+	}
+
+	byte slot;
+	int index;
+	int count;
+
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("REFAIL: missing slot"));
+#endif
+		return;
+	}
+
+	if (!getProgramSlotNo(&slot))
+		return;
+
+	if (*decodePos != ',')
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("REFAIL: missing statement number"));
+#endif
+		return;
+	}
+
+	decodePos++;
+
+	if (!getValue(&index))
+		return;
+
+	if (*decodePos != ',')
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("REFAIL: missing statement count"));
 #endif
+		return;
+	}
 
-	if (deviceState != EXECUTE_IMMEDIATELY)
+	decodePos++;
+
+	if (!getValue(&count))
+		return;
+
+	if (index < 0 | count < 0)
 	{
 #ifdef DIAGNOSTICS_ACTIVE
-		Serial.println(F("RMFAIL: not accepting commands"));
+		Serial.println(F("REFAIL: invalid statement number"));
 #endif
 		return;
 	}
 
-	startDownloadingCode(STORED_PROGRAM_OFFSET);
+	haltProgramExecution();
+
+	deviceState = STORE_PROGRAM;
+	downloadSlot = slot;
+	patchingProgram = true;
+	patchIndex = index;
+	patchDeleteCount = count;
+	patchLength = 0;
+
+	resetLineStorageState();
+
+	startBusyPixel(128, 128, 128);
+
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print(F("REOK"));
+	}
+#endif
 }
 
+// RS - start the power up program
+// RSn - start the program in slot n and make it the power up program
+
 void startProgramCommand()
 {
-	startProgramExecution(STORED_PROGRAM_OFFSET);
+	bool slotGiven = *decodePos != STATEMENT_TERMINATOR & decodePos != decodeLimit;
+
+	byte slot;
+
+	if (!getProgramSlotNo(&slot))
+		return;
+
+	if (!startProgramExecution(slot))
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		Serial.println(F("RSFAIL: no program"));
+#endif
+		return;
+	}
+
+	if (slotGiven)
+	{
+		setStartProgramSlot(slot);
+	}
 
 #ifdef DIAGNOSTICS_ACTIVE
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -2491,11 +3581,32 @@ void haltProgramExecutionCommand()
 #endif
 }
 
+// RC - clear all the program slots
+// RCn - clear slot n
+
 void clearProgramStoreCommand()
 {
-	haltProgramExecution();
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+		haltProgramExecution();
+		clearProgramStore();
+		verifiedSlots = 0;
+	}
+	else
+	{
+		byte slot;
+
+		if (!getProgramSlotNo(&slot))
+			return;
+
+		haltProgramExecution();
 
-	clearStoredProgram();
+		if (programBytesAfter(slot) > 0)
+			pauseSerialInput();
+
+		removeProgramFromStore(slot);
+		verifiedSlots &= ~(1 << slot);
+	}
 
 #ifdef DIAGNOSTICS_ACTIVE
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -2535,6 +3646,10 @@ void remoteManagement()
 	case 'm':
 		remoteDownload();
 		break;
+	case 'E':
+	case 'e':
+		remotePatch();
+		break;
 	case 'S':
 	case 's':
 		startProgramCommand();
@@ -2630,9 +3745,23 @@ void setMessaging()
 #endif
 }
 
+// IP - print the power up program
+// IPn - print the program in slot n
+
 void printProgram()
 {
-	dumpProgramFromEEPROM(STORED_PROGRAM_OFFSET);
+	byte slot;
+
+	if (!getProgramSlotNo(&slot))
+		return;
+
+	programSlot entry;
+	loadProgramSlot(slot, &entry);
+
+	if (entry.length > 0)
+	{
+		dumpProgramFromEEPROM(entry.offset);
+	}
 
 #ifdef DIAGNOSTICS_ACTIVE
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -2642,6 +3771,71 @@ void printProgram()
 #endif
 }
 
+// IF - print the program slots and the free space in the program store
+// Each slot is printed as number, name, offset, length. A * marks the
+// slot that runs at power up.
+
+void printProgramSlots()
+{
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("IFOK"));
+	}
+#endif
+
+	byte startSlot = getStartProgramSlot();
+
+	for (byte slot = 0; slot < NO_OF_PROGRAM_SLOTS; slot++)
+	{
+		programSlot entry;
+		loadProgramSlot(slot, &entry);
+
+		Serial.print(slot);
+		if (slot == startSlot)
+			Serial.print('*');
+		Serial.print(',');
+		for (byte i = 0; i < PROGRAM_NAME_LENGTH && entry.name[i]; i++)
+			Serial.print(entry.name[i]);
+		Serial.print(',');
+		Serial.print(entry.offset);
+		Serial.print(',');
+		Serial.println(entry.length);
+	}
+
+	Serial.print(F("Free: "));
+	Serial.println(programStoreFree());
+}
+
+#ifdef LOOP_TIMING
+
+// Longest pass through loop() since the last IL command
+// Passes that include the delay waiting for the light tick are counted too,
+// so this is only meaningful while a download or a fast program is running
+uint32_t worstLoopPassMicros = 0;
+
+void recordLoopPass(uint32_t passMicros)
+{
+	if (passMicros > worstLoopPassMicros)
+		worstLoopPassMicros = passMicros;
+}
+
+// Command IL - print the longest loop pass in microseconds and start again
+
+void displayLoopTiming()
+{
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("ILOK"));
+	}
+#endif
+	Serial.println(worstLoopPassMicros);
+	worstLoopPassMicros = 0;
+}
+
+#endif
+
 void information()
 {
 	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
@@ -2687,6 +3881,24 @@ void information()
 	case 'p':
 		printProgram();
 		break;
+	case 'T':
+	case 't':
+		remoteTelemetry();
+		break;
+	case 'R':
+	case 'r':
+		displayMemory();
+		break;
+	case 'F':
+	case 'f':
+		printProgramSlots();
+		break;
+#ifdef LOOP_TIMING
+	case 'L':
+	case 'l':
+		displayLoopTiming();
+		break;
+#endif
 	}
 }
 
@@ -2740,6 +3952,11 @@ void variableManagement()
 	case 'v':
 		viewVariable();
 		break;
+
+	case 'A':
+	case 'a':
+		declareArray();
+		break;
 	}
 }
 
@@ -2822,6 +4039,7 @@ void doTone()
 		delayEndTime = millis() + duration;
 		programState = PROGRAM_AWAITING_DELAY_COMPLETION;
 		// Note that this code intentionally falls through the end of the case
+		// fall through
 	case 'n':
 	case 'N':
 		playTone(frequency, duration);
@@ -2844,6 +4062,67 @@ void doTone()
 	}
 }
 
+// Command SPn,loop - play tune n in the background, over and over if loop is non-zero
+// Command SP        - stop the tune
+// Return OK
+
+void doPlayTune()
+{
+#ifdef PLAY_TONE_DEBUG
+	Serial.println(".**play tune");
+#endif
+
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+		stopTune();
+
+#ifdef DIAGNOSTICS_ACTIVE
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("SPOK"));
+		}
+#endif
+		return;
+	}
+
+	int tuneNo;
+
+	if (!getValue(&tuneNo))
+	{
+		return;
+	}
+
+	int loop = 0;
+
+	if (*decodePos != STATEMENT_TERMINATOR & decodePos != decodeLimit)
+	{
+		decodePos++;
+
+		if (!getValue(&loop))
+		{
+			return;
+		}
+	}
+
+	if (!startTune(tuneNo, loop != 0))
+	{
+#ifdef DIAGNOSTICS_ACTIVE
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("SPFail: no tune"));
+		}
+#endif
+		return;
+	}
+
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("SPOK"));
+	}
+#endif
+}
+
 void remoteSoundPlay()
 {
 	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
@@ -2873,6 +4152,10 @@ void remoteSoundPlay()
 	case 't':
 		doTone();
 		break;
+	case 'P':
+	case 'p':
+		doPlayTune();
+		break;
 	}
 }
 
@@ -2891,9 +4174,9 @@ void doRemoteWriteLine()
 
 void doRemotePrintValue()
 {
-	int valueToPrint;
+	scriptValue valueToPrint;
 
-	if(getValue(&valueToPrint))
+	if(getScriptValue(&valueToPrint))
 	{
 		Serial.print(valueToPrint);
 	}
@@ -2942,16 +4225,16 @@ void remoteWriteOutput()
 }
 
 
-void actOnCommand(char * commandDecodePos, char * comandDecodeLimit)
+void actOnCommand(statementCursor commandDecodePos, statementCursor comandDecodeLimit)
 {
 	decodePos = commandDecodePos;
 	decodeLimit = comandDecodeLimit;
 
-	*decodeLimit = 0;
-
 #ifdef COMMAND_DEBUG
 	Serial.print(F(".**processCommand:"));
-	Serial.println((char *)decodePos);
+	for (statementCursor pos = decodePos; pos != decodeLimit && *pos != STATEMENT_TERMINATOR; pos++)
+		Serial.print(*pos);
+	Serial.println();
 #endif
 
 	char commandCh = *decodePos;
@@ -3018,32 +4301,6 @@ void actOnCommand(char * commandDecodePos, char * comandDecodeLimit)
 	}
 }
 
-void processCommandByte(byte b)
-{
-	if (commandPos == bufferLimit)
-	{
-#ifdef COMMAND_DEBUG
-		Serial.println(F(".  Command buffer full - resetting"));
-#endif
-		resetCommand();
-		return;
-	}
-
-	*commandPos = b;
-
-	commandPos++;
-
-	if (b == STATEMENT_TERMINATOR)
-	{
-#ifdef COMMAND_DEBUG
-		Serial.println(F(".  Command end"));
-#endif
-		actOnCommand(programCommand, commandPos);
-		resetCommand();
-		return;
-	}
-}
-
 void resetSerialBuffer()
 {
 	remotePos = remoteCommand;
@@ -3072,6 +4329,63 @@ void interpretSerialByte(byte b)
 	}
 }
 
+// Serial input is worked through under a time budget so that a fast download
+// can't hold up the lights, the distance sensor and the running program.
+// Bytes wait in the serial receive buffer until there is time to compile them.
+// The compiled output of a line is queued and handed on a byte at a time,
+// as storing a byte in EEPROM takes over 3 milliseconds.
+
+// Time allowed for serial input in each pass through loop()
+// At least one byte is always dealt with, so a pass can overrun this
+#define SERIAL_INPUT_BUDGET_IN_MICROSECS 2000
+
+// Space for the compiled output of a line. If a line makes more than
+// this it is handed on straight away, as it was before there was a queue.
+#define COMPILED_OUTPUT_QUEUE_SIZE 32
+
+byte compiledOutputQueue[COMPILED_OUTPUT_QUEUE_SIZE];
+byte compiledOutputCount;
+byte compiledOutputPos;
+
+// Where the queued output goes. Chosen when the line starts to compile.
+void(*compiledOutputDestination) (byte);
+
+void queueCompiledByte(byte b)
+{
+	if (compiledOutputCount == COMPILED_OUTPUT_QUEUE_SIZE)
+	{
+		// Queue full. Send what is waiting and then this byte, in order.
+		while (compiledOutputPos < compiledOutputCount)
+			compiledOutputDestination(compiledOutputQueue[compiledOutputPos++]);
+		compiledOutputCount = 0;
+		compiledOutputPos = 0;
+		compiledOutputDestination(b);
+		return;
+	}
+
+	compiledOutputQueue[compiledOutputCount++] = b;
+}
+
+// Hands on one queued byte. Returns false if the queue was empty.
+
+bool sendCompiledByte()
+{
+	if (compiledOutputPos == compiledOutputCount)
+		return false;
+
+	byte b = compiledOutputQueue[compiledOutputPos++];
+
+	if (compiledOutputPos == compiledOutputCount)
+	{
+		compiledOutputCount = 0;
+		compiledOutputPos = 0;
+	}
+
+	compiledOutputDestination(b);
+
+	return true;
+}
+
 void processSerialByte(byte b)
 {
 #ifdef COMMAND_DEBUG
@@ -3082,12 +4396,92 @@ void processSerialByte(byte b)
 	switch (deviceState)
 	{
 	case EXECUTE_IMMEDIATELY:
-		decodeScriptChar(b, interpretSerialByte);
+		compiledOutputDestination = interpretSerialByte;
 		break;
 	case STORE_PROGRAM:
-		decodeScriptChar(b, storeReceivedByte);
+		compiledOutputDestination = storeReceivedByte;
 		break;
 	}
+
+	decodeScriptChar(b, queueCompiledByte);
+}
+
+// Flow control, turned on with SERIAL_FLOW_CONTROL in HullOS.ino. When the
+// receive buffer is getting full the host is sent XOFF and it is sent XON when
+// there is room again. The high water mark leaves room for the bytes the host
+// sends before it acts on the XOFF.
+
+#ifdef SERIAL_FLOW_CONTROL
+
+#define SERIAL_XON 0x11
+#define SERIAL_XOFF 0x13
+
+#define SERIAL_HIGH_WATER 40
+#define SERIAL_LOW_WATER 16
+
+bool serialInputPaused = false;
+
+void updateSerialFlowControl()
+{
+	int waiting = CharsAvailable();
+
+	if (!serialInputPaused & waiting >= SERIAL_HIGH_WATER)
+	{
+		Serial.write(SERIAL_XOFF);
+		serialInputPaused = true;
+		return;
+	}
+
+	if (serialInputPaused & waiting <= SERIAL_LOW_WATER)
+	{
+		Serial.write(SERIAL_XON);
+		serialInputPaused = false;
+	}
+}
+
+// Sent ahead of work that keeps the robot away from the serial port for
+// longer than the receive buffer lasts. updateSerialFlowControl sends XON
+// once the buffer has emptied.
+
+void pauseSerialInput()
+{
+	if (!serialInputPaused)
+	{
+		Serial.write(SERIAL_XOFF);
+		serialInputPaused = true;
+	}
+}
+
+#else
+
+void pauseSerialInput()
+{
+}
+
+#endif
+
+// Called from updateRobot on every pass
+
+void processSerialInput()
+{
+	uint32_t startMicros = micros();
+
+	do
+	{
+		// The output from the last line must be dealt with before the
+		// next line is compiled
+		if (!sendCompiledByte())
+		{
+			if (!CharsAvailable())
+				break;
+
+			processSerialByte(GetRawCh());
+		}
+	} while (micros() - startMicros < SERIAL_INPUT_BUDGET_IN_MICROSECS);
+
+#ifdef SERIAL_FLOW_CONTROL
+	updateSerialFlowControl();
+#endif
 }
 
 
@@ -3096,17 +4490,16 @@ void setupRemoteControl()
 #ifdef COMMAND_DEBUG
 	Serial.println(F(".**setupRemoteControl"));
 #endif
-	resetCommand();
 	resetSerialBuffer();
 }
 
 // Executes the statement in the EEPROM at the current program counter
-// The statement is assembled into a buffer by interpretCommandByte
+// The statement is decoded where it is stored in a single pass. The end of
+// it is only looked for once it has run, from where the decoders stopped,
+// and the program counter is moved on unless the statement jumped.
 
 bool exeuteProgramStatement()
 {
-	char programByte;
-
 #ifdef PROGRAM_DEBUG
 	Serial.println(F(".Executing statement"));
 #endif
@@ -3119,27 +4512,31 @@ bool exeuteProgramStatement()
 	}
 #endif
 
-	while (true)
+	// The program store may have been written since the last statement
+	storeCachePos = -1;
+
+	// The program was verified before it started, so it always ends
+	// with the terminator
+	if (*statementCursor::inProgramStore(programCounter) == PROGRAM_TERMINATOR)
 	{
-		programByte = EEPROM.read(programCounter++);
+		endProgramExecution();
+		return false;
+	}
 
-		if (programCounter >= EEPROM_SIZE || programByte == PROGRAM_TERMINATOR)
-		{
-			haltProgramExecution();
-			return false;
-		}
+	programCounterMoved = false;
 
-#ifdef PROGRAM_DEBUG
-		Serial.print(F(".    program byte: "));
-		Serial.println(programByte);
-#endif
+	actOnCommand(statementCursor::inProgramStore(programCounter),
+		statementCursor::inProgramStore(labelTableBase));
 
-		processCommandByte(programByte);
+	if (!programCounterMoved)
+		programCounter = findStatementEnd();
 
-		if (programByte == STATEMENT_TERMINATOR)
-			return true;
+#ifdef PROGRAM_DEBUG
+	Serial.print(F(".    next statement: "));
+	Serial.println(programCounter);
+#endif
 
-	}
+	return true;
 }
 
 #ifdef TEST_PROGRAM
@@ -3174,16 +4571,13 @@ void updateRobot()
 
 	// If we recieve serial data the program that is running
 	// must stop. 
-	while (CharsAvailable())
-	{
-		byte b = GetRawCh();
-		processSerialByte(b);
-	}
+	processSerialInput();
 
 	switch (programState)
 	{
 	case PROGRAM_STOPPED:
 	case PROGRAM_PAUSED:
+	case SYSTEM_CONFIGURATION_CONNECTION:
 		break;
 	case PROGRAM_ACTIVE:
 		exeuteProgramStatement();
@@ -3195,7 +4589,8 @@ void updateRobot()
 		}
 		break;
 	case PROGRAM_AWAITING_DELAY_COMPLETION:
-		if (millis() > delayEndTime)
+		// Compared as a difference so that the delay still ends when millis() wraps
+		if ((int32_t)(millis() - delayEndTime) > 0)
 		{
 			programState = PROGRAM_ACTIVE;
 		}
@@ -5,8 +5,8 @@
 const int trigPin = 3;       // trigger pin for distance 
 const int echoPin = 2;       // echo pin for distance
 
-volatile long pulseStartTime;
-volatile long pulseWidth;
+volatile int32_t pulseStartTime;
+volatile int32_t pulseWidth;
 
 enum DistanceSensorState
 {
@@ -21,7 +21,7 @@ volatile DistanceSensorState distanceSensorState = DISTANCE_SENSOR_OFF;
 
 volatile int distanceSensorReadingIntervalInMillisecs;
 
-volatile unsigned long timeOfLastDistanceReading;
+volatile uint32_t timeOfLastDistanceReading;
 
 void pulseEvent()
 {
@@ -84,11 +84,11 @@ inline void startWaitBetweenReadings()
 
 inline void updateSensorBetweenReadings()
 {
-  unsigned long now = millis();
-  unsigned long timeSinceLastReading = ulongDiff(now, timeOfLastDistanceReading);
+  uint32_t now = millis();
+  uint32_t timeSinceLastReading = ulongDiff(now, timeOfLastDistanceReading);
 
 
-  if (timeSinceLastReading >= distanceSensorReadingIntervalInMillisecs)
+  if (timeSinceLastReading >= (uint32_t)distanceSensorReadingIntervalInMillisecs)
   {
     startDistanceSensorReading();
   }
@@ -136,7 +136,7 @@ void directDistanceReadTest()
 {
   pinMode(trigPin, OUTPUT);
   pinMode(echoPin, INPUT);
-  long duration;
+  int32_t duration;
   float distance;
   while (true)
   {
@@ -58,6 +58,25 @@
 #define ERROR_NO_LABEL_FOR_LOOP_ON_STACK_IN_CONTINUE 56
 #define ERROR_NO_RADIUS_IN_ARC 57
 #define ERROR_NO_ANGLE_IN_ARC 58
+#define ERROR_NO_X_IN_GOTO 59
+#define ERROR_NO_Y_IN_GOTO 60
+#define ERROR_MISSING_VALUE_IN_ANIMATE 61
+#define ERROR_INVALID_OPTION_IN_ANIMATE 62
+#define ERROR_UNKNOWN_COLOUR_NAME 63
+#define ERROR_MISSING_VALUE_IN_PLAY 64
+#define ERROR_INVALID_OPTION_IN_PLAY 65
+#define ERROR_DEF_CANNOT_BE_USED_OUTSIDE_A_PROGRAM 66
+#define ERROR_CALL_CANNOT_BE_USED_OUTSIDE_A_PROGRAM 67
+#define ERROR_DEF_CANNOT_BE_INSIDE_ANOTHER_STATEMENT 68
+#define ERROR_INVALID_SUBROUTINE_NAME 69
+#define ERROR_SUBROUTINE_NAME_TOO_LONG 70
+#define ERROR_TOO_MANY_SUBROUTINES 71
+#define ERROR_SUBROUTINE_ALREADY_DEFINED 72
+#define ERROR_SUBROUTINE_NOT_DEFINED 73
+#define ERROR_INVALID_ARRAY_NAME 74
+#define ERROR_MISSING_LENGTH_IN_ARRAY 75
+#define ERROR_MISSING_CLOSE_BRACKET_IN_INDEX 76
+#define ERROR_INVALID_VALUE 77
 
 
 
@@ -5,7 +5,9 @@
 // Version 1.5 Rob Miles
 
 
-const String version = "HullOS Version R2.0";
+#define VERSION_TEXT "HullOS Version R2.0"
+
+const String version = VERSION_TEXT;
 
 // Physical connections for Arduino Pro Mini
 
@@ -35,7 +37,19 @@ const String version = "HullOS Version R2.0";
 // Define if driving a WEMOS board (not fully tested)
 //#define WEMOS
 
-#include "errors.h"
+// Define to record the longest pass through loop(), read with the IL command
+//#define LOOP_TIMING
+
+// Define to time the script arithmetic at power up, see Variables.h
+//#define ARITHMETIC_BENCHMARK
+
+// Define to send XOFF (0x13) when the serial receive buffer is nearly full, or
+// before programs are moved in EEPROM, and XON (0x11) when there is room again.
+// The sender must stop within 24 bytes of an XOFF. Senders that don't expect
+// these two bytes in the robot's output should leave this off.
+//#define SERIAL_FLOW_CONTROL
+
+#include "Errors.h"
 
 #include "Storage.h"
 
@@ -43,14 +57,20 @@ const String version = "HullOS Version R2.0";
 
 #include "MotorControl.h"
 
+#include "Odometry.h"
+
 #include "DistanceSensor.h"
 
 #include "Sound.h"
 
 #include "Commands.h"
 
+#include "Telemetry.h"
+
 #include "Script.h"
 
+#include "Memory.h"
+
 // starts silently and is ready to run as soon as possible
 //
 
@@ -63,22 +83,42 @@ void setup() {
   //
   //testDistanceSensor();
 
+#ifdef ARITHMETIC_BENCHMARK
+  benchmarkScriptArithmetic();
+#endif
+
   setupMotors();
+  setupOdometry();
   setupDistanceSensor(25);
   setupSound();
   setupRemoteControl();
   setupVariables();
+  setupProgramStore();
+  verifyProgramStore();
   startLights();
+
   // Uncomment to test the script engine
   //testScript();
 
-  startProgramExecution(STORED_PROGRAM_OFFSET);
+  startProgramExecution(getStartProgramSlot());
 }
 
 
 void loop() 
 {
+#ifdef LOOP_TIMING
+  uint32_t passStartMicros = micros();
+#endif
+
   updateRobot();
+  updateOdometry();
+  updateGoto();
+  updateTune();
   updateDistanceSensor();
+  updateTelemetry();
   updateLightsAndDelay(!commandsNeedFullSpeed());
+
+#ifdef LOOP_TIMING
+  recordLoopPass(micros() - passStartMicros);
+#endif
 }
@@ -0,0 +1,149 @@
+// Memory use
+// At power up, before any of the variables are set up, the whole of the free
+// RAM between the top of the variables and the top of memory is filled with a
+// known pattern. The stack grows down into this pattern, so the deepest the
+// stack has ever reached can be found later by looking for the lowest byte
+// that has been written over. Command IR reports this along with the free
+// memory right now and the RAM taken by the tables and buffers of each part
+// of the system.
+
+#define STACK_PAINT_BYTE 0xC5
+
+// Stack and heap space that must be left over once the tables and buffers
+// below have been allocated. The build fails if a change takes this away.
+// The check here only counts the tables and buffers, make avr in Host/
+// checks it against all of the variables as reported by avr-size.
+#define MEMORY_STACK_RESERVE 512
+
+// RAM used by the tables and buffers of each part of the system. These are
+// worked out when the code is compiled. Single variables are not listed,
+// they are counted in with the total static RAM reported by IR.
+
+#define PIXEL_TABLES_RAM (sizeof(lights) + sizeof(strip))
+
+#define MOTOR_TABLES_RAM (sizeof(activeWheelSettings))
+
+#define VARIABLE_TABLES_RAM (sizeof(variables) + sizeof(arrayPool) + \
+	sizeof(operators) + (NUMBER_OF_ARITHMETIC_OPERATORS * sizeof(struct op)) + \
+	sizeof(logicalOps) + (NUMBER_OF_LOGICAL_OPERATORS * sizeof(struct logicalOp)) + \
+	sizeof(readers) + (NO_OF_HARDWARE_READERS * sizeof(struct reading)))
+
+#define COMMAND_TABLES_RAM (sizeof(remoteCommand) + sizeof(compiledOutputQueue) + \
+	sizeof(decodePos) + sizeof(decodeLimit) + sizeof(subroutineOffsets) + sizeof(callStack) + \
+	sizeof(patchBuffer))
+
+#define SCRIPT_TABLES_RAM (sizeof(scriptInputBuffer) + sizeof(operation) + sizeof(subroutineNames))
+
+#define TELEMETRY_TABLES_RAM (sizeof(telemetryFrame) + sizeof(telemetryVariables))
+
+// RAM taken by the Arduino core and the libraries: the serial port with its
+// receive and transmit buffers, the version String, which is held as the
+// text it is made from and again as its own copy on the heap, and the
+// pixel colours the NeoPixel library keeps on the heap.
+
+#define CORE_BUFFERS_RAM (sizeof(Serial) + sizeof(version) + (2 * sizeof(VERSION_TEXT)) + \
+	(PIXELS * 3))
+
+#define ALL_TABLES_RAM (PIXEL_TABLES_RAM + MOTOR_TABLES_RAM + VARIABLE_TABLES_RAM + \
+	COMMAND_TABLES_RAM + SCRIPT_TABLES_RAM + TELEMETRY_TABLES_RAM + CORE_BUFFERS_RAM)
+
+#if defined(__AVR__)
+
+static_assert(ALL_TABLES_RAM <= (RAMEND - RAMSTART + 1) - MEMORY_STACK_RESERVE,
+	"Tables and buffers leave too little RAM for the stack");
+
+// Provided by the linker and the memory allocator
+extern char __data_start;
+extern char __heap_start;
+extern char * __brkval;
+
+// Runs from the .init3 section at reset, after the stack pointer has been set
+// and before the variables are cleared and initialised. Nothing is on the
+// stack yet, so everything above the variables can be painted.
+
+void paintStack() __attribute__((naked, used, section(".init3")));
+
+void paintStack()
+{
+	byte * p = (byte *)&__heap_start;
+
+	while (p <= (byte *)RAMEND)
+	{
+		*p++ = STACK_PAINT_BYTE;
+	}
+}
+
+byte * heapTop()
+{
+	if (__brkval == 0)
+		return (byte *)&__heap_start;
+
+	return (byte *)__brkval;
+}
+
+// Bytes between the top of the heap and the stack pointer right now
+
+int freeMemory()
+{
+	byte stackTop;
+
+	return &stackTop - heapTop();
+}
+
+// Lowest address the stack has written to since power up
+
+byte * stackLowWaterMark()
+{
+	byte * p = heapTop();
+
+	while (p <= (byte *)RAMEND && *p == STACK_PAINT_BYTE)
+	{
+		p++;
+	}
+
+	return p;
+}
+
+#endif
+
+// Command IR - print memory use in bytes
+
+void displayMemory()
+{
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("IROK"));
+	}
+#endif
+
+#if defined(__AVR__)
+	byte * lowWaterMark = stackLowWaterMark();
+
+	Serial.print(F("Free now: "));
+	Serial.println(freeMemory());
+	Serial.print(F("Stack high water: "));
+	Serial.println((int)((byte *)RAMEND + 1 - lowWaterMark));
+	Serial.print(F("Never used: "));
+	Serial.println((int)(lowWaterMark - heapTop()));
+	Serial.print(F("Heap: "));
+	Serial.println((int)(heapTop() - (byte *)&__heap_start));
+	Serial.print(F("Static: "));
+	Serial.println((int)((byte *)&__heap_start - (byte *)&__data_start));
+#endif
+
+	Serial.print(F("  Pixels: "));
+	Serial.println(PIXEL_TABLES_RAM);
+	Serial.print(F("  Motors: "));
+	Serial.println(MOTOR_TABLES_RAM);
+	Serial.print(F("  Variables: "));
+	Serial.println(VARIABLE_TABLES_RAM);
+	Serial.print(F("  Commands: "));
+	Serial.println(COMMAND_TABLES_RAM);
+	Serial.print(F("  Script: "));
+	Serial.println(SCRIPT_TABLES_RAM);
+	Serial.print(F("  Telemetry: "));
+	Serial.println(TELEMETRY_TABLES_RAM);
+	Serial.print(F("  Core: "));
+	Serial.println(CORE_BUFFERS_RAM);
+}
@@ -6,29 +6,81 @@
 #include <limits.h>
 #include <math.h>
 
+// Define to drive the motors from a fixed rate timer tick instead of
+// setting the timer for the next step on every interrupt. Each wheel has an
+// accumulator that adds up the time since its last step. When it reaches the
+// step interval the wheel steps and the interval is taken off, so the part of
+// a tick left over is carried into the next step and long moves do not drift.
+//#define MOTOR_DDA
+
+#ifdef MOTOR_DDA
+
+// Steps are made on the first tick after they fall due, so this is the
+// largest timing error for a single step
+#define DDA_TICK_IN_MICROSECS 200
+
+#endif
+
+// Define to set D13 (PB5, the LED on the Uno and Pro Mini) high while
+// motorUpdate() runs, so that the time each engine spends in the interrupt
+// handler on every tick can be measured with an oscilloscope or logic
+// analyser. One microsecond high is 16 clock cycles at 16 MHz. The pulse
+// leaves out the TimerOne handler around it, which saves and restores the
+// registers, and the probe itself adds two sbi/cbi instructions.
+//#define MOTOR_ISR_PROBE
+
+#ifdef MOTOR_ISR_PROBE
+#define MOTOR_ISR_PROBE_BIT 0x20
+#else
+#define MOTOR_ISR_PROBE_BIT 0
+#endif
+
+// Odometry.h adds up the steps made by each wheel, so it must be
+// told about the steps made before the step counters are reset
+void updateOdometry();
+void updateOdometryTo(uint32_t leftCount, uint32_t rightCount);
+void startOdometryMove(bool leftForward, bool rightForward);
+void resetOdometryStepCounts();
+void calculateOdometryStepSizes();
+
+// Set while a move made of several stages (for example go to point in Odometry.h)
+// has more stages to run. Cleared when the motors are started or stopped by anything else
+bool moveStagesPending = false;
+
+// Half step drive uses all eight phases of the waveform. Full step drive moves
+// two phases at a time starting from an odd position, so two coils are always on.
+// This gives more torque and half the number of steps for the same distance.
+
+#define HALF_STEP_DRIVE 0
+#define FULL_STEP_DRIVE 1
+
 const byte leftMotorWaveformLookup[8] = { B10000000, B11000000, B01000000, B01100000, B00100000, B00110000, B00010000, B10010000 };
 const byte rightMotorWaveformLookup[8] = { B01000, B01100, B00100, B00110, B00010, B00011, B00001, B01001 };
 
+// Set from the drive mode by setupWheelSettings()
+char waveformStepSize = 1;
+char waveformStartPos = 0;
+
 volatile char leftMotorWaveformPos = 0;
 volatile char leftMotorWaveformDelta = 0;
 
 volatile char rightMotorWaveformPos = 0;
 volatile char rightMotorWaveformDelta = 0;
 
-volatile unsigned long leftStepCounter = 0;
-volatile unsigned long leftNumberOfStepsToMove = 1000;
+volatile uint32_t leftStepCounter = 0;
+volatile uint32_t leftNumberOfStepsToMove = 1000;
 
-volatile unsigned long rightStepCounter = 0;
-volatile unsigned long rightNumberOfStepsToMove = 1000;
+volatile uint32_t rightStepCounter = 0;
+volatile uint32_t rightNumberOfStepsToMove = 1000;
 
-volatile unsigned long leftIntervalBetweenSteps;
-volatile unsigned long rightIntervalBetweenSteps;
+volatile uint32_t leftIntervalBetweenSteps;
+volatile uint32_t rightIntervalBetweenSteps;
 
-volatile unsigned long leftTimeOfLastStep;
-volatile unsigned long rightTimeOfLastStep;
+volatile uint32_t leftTimeOfLastStep;
+volatile uint32_t rightTimeOfLastStep;
 
-volatile unsigned long leftTimeOfNextStep;
-volatile unsigned long rightTimeOfNextStep;
+volatile uint32_t leftTimeOfNextStep;
+volatile uint32_t rightTimeOfNextStep;
 
 inline void leftStep()
 {
@@ -40,13 +92,12 @@ inline void leftStep()
 #ifdef WEMOS
   setLeft(lmotorPos);
 #else
-  PORTD = (PORTD & 0x0F) + leftMotorWaveformLookup[leftMotorWaveformPos];
+  PORTD = (PORTD & 0x0F) + leftMotorWaveformLookup[(byte)leftMotorWaveformPos];
 #endif
 
   // Update and wrap the waveform position
-  leftMotorWaveformPos += leftMotorWaveformDelta;
-  if (leftMotorWaveformPos == 8) leftMotorWaveformPos = 0;
-  if (leftMotorWaveformPos < 0) leftMotorWaveformPos = 7;
+  leftMotorWaveformPos = (leftMotorWaveformPos + leftMotorWaveformDelta) & 7;
+
 
   // If we are not counting steps - just return
 
@@ -65,12 +116,11 @@ inline void rightStep()
 #ifdef WEMOS
   setRight(rmotorPos);
 #else
-  PORTB = (PORTB & 0xF0) + rightMotorWaveformLookup[rightMotorWaveformPos];
+  PORTB = (PORTB & 0xF0) + rightMotorWaveformLookup[(byte)rightMotorWaveformPos];
 #endif
 
-  rightMotorWaveformPos -= rightMotorWaveformDelta;
-  if (rightMotorWaveformPos == 8) rightMotorWaveformPos = 0;
-  if (rightMotorWaveformPos < 0) rightMotorWaveformPos = 7;
+  rightMotorWaveformPos = (rightMotorWaveformPos - rightMotorWaveformDelta) & 7;
+
 
   if (++rightStepCounter >= rightNumberOfStepsToMove)
   {
@@ -80,19 +130,26 @@ inline void rightStep()
 }
 
 float turningCircle;
-const int countsperrev = 512 * 8; // number of microsteps per full revolution
+int countsperrev = 512 * 8; // number of steps per full revolution, set by the drive mode
 
 float leftStepsPerMM;
 float rightStepsPerMM;
 
-struct wheelSettings
+// Stored in the EEPROM as it is laid out in memory, see programSlot
+
+struct __attribute__((packed)) wheelSettings
 {
-  int leftWheelDiameter;
-  int rightWheelDiameter;
-  int wheelSpacing;
+  int16_t leftWheelDiameter;
+  int16_t rightWheelDiameter;
+  int16_t wheelSpacing;
   char check;
+  // added after the check so that settings stored before there was a
+  // drive mode are still loaded. An invalid value means half step.
+  byte driveMode;
 };
 
+static_assert(sizeof(struct wheelSettings) == 8, "wheel settings layout has changed");
+
 wheelSettings activeWheelSettings;
 
 #define WHEEL_SETTINGS_STORED 0x55
@@ -113,6 +170,11 @@ void setActiveWheelSettings(int leftDiam, int rightDiam, int spacing)
 void dumpActiveWheelSettings()
 {
   Serial.println(F("Wheel settings"));
+  Serial.print(F("Drive mode: "));
+  if (activeWheelSettings.driveMode == FULL_STEP_DRIVE)
+    Serial.println(F("full step"));
+  else
+    Serial.println(F("half step"));
   Serial.print(F("Left diameter: "));
   Serial.println(activeWheelSettings.leftWheelDiameter);
   Serial.print(F("Right diameter: "));
@@ -143,9 +205,13 @@ void loadActiveWheelSettings()
     activeWheelSettings.rightWheelDiameter = 69;
     activeWheelSettings.wheelSpacing = 110;
     activeWheelSettings.check = WHEEL_SETTINGS_STORED;
+    activeWheelSettings.driveMode = HALF_STEP_DRIVE;
     storeActiveWheelSettings();
   }
 
+  if (activeWheelSettings.driveMode != FULL_STEP_DRIVE)
+    activeWheelSettings.driveMode = HALF_STEP_DRIVE;
+
 #ifdef DEBUG_LOAD_ACTIVE_WHEEL_SETTINGS
   Serial.print(F("left radius: "));
   Serial.print(activeWheelSettings.leftWheelRadius);
@@ -159,8 +225,36 @@ void loadActiveWheelSettings()
 float leftWheelCircumference;
 float rightWheelCircumference;
 
+// The lowest interval between steps that is allowed
+// used to calculate timed moves. Set by the drive mode.
+
+uint32_t minInterruptIntervalInMicroSecs = 1200;
+
+// Fastest step rate for each drive mode. A full step moves the wheel twice as
+// far as a half step, but with two coils always on the motor can be stepped
+// at more than half the half step rate. The full step figure is a starting
+// point for the 28BYJ-48 at 5V and may need lowering for a heavy robot.
+
+const uint32_t minHalfStepIntervalInMicroSecs = 1200;
+const uint32_t minFullStepIntervalInMicroSecs = 1800;
+
 void setupWheelSettings()
 {
+  if (activeWheelSettings.driveMode == FULL_STEP_DRIVE)
+  {
+    countsperrev = 512 * 4;
+    waveformStepSize = 2;
+    waveformStartPos = 1;
+    minInterruptIntervalInMicroSecs = minFullStepIntervalInMicroSecs;
+  }
+  else
+  {
+    countsperrev = 512 * 8;
+    waveformStepSize = 1;
+    waveformStartPos = 0;
+    minInterruptIntervalInMicroSecs = minHalfStepIntervalInMicroSecs;
+  }
+
   leftWheelCircumference = PI * activeWheelSettings.leftWheelDiameter;
   rightWheelCircumference = PI * activeWheelSettings.rightWheelDiameter;
   turningCircle = activeWheelSettings.wheelSpacing * PI;
@@ -172,7 +266,7 @@ void setupWheelSettings()
 void setupMotors()
 {
   DDRD = 0xFF;
-  DDRB = 0x0F;
+  DDRB = 0x0F | MOTOR_ISR_PROBE_BIT;
 
   loadActiveWheelSettings();
 
@@ -181,7 +275,7 @@ void setupMotors()
   Timer1.initialize(1000);
 }
 
-inline unsigned long ulongDiff(unsigned long end, unsigned long start)
+inline uint32_t ulongDiff(uint32_t end, uint32_t start)
 {
   if (end >= start)
   {
@@ -189,15 +283,20 @@ inline unsigned long ulongDiff(unsigned long end, unsigned long start)
   }
   else
   {
-    return ULONG_MAX - start + end + 1;
+    return UINT32_MAX - start + end + 1;
   }
 }
 
-volatile unsigned long currentMicros;
-volatile unsigned long leftTimeSinceLastStep;
-volatile unsigned long rightTimeSinceLastStep;
-volatile unsigned long timeToLeft;
-volatile unsigned long timeToRight;
+volatile uint32_t currentMicros;
+volatile uint32_t leftTimeSinceLastStep;
+volatile uint32_t rightTimeSinceLastStep;
+volatile uint32_t timeToLeft;
+volatile uint32_t timeToRight;
+
+// Counts calls of motorUpdate(). Code outside the interrupt handler reads this
+// before and after copying the motor state. If it has changed the interrupt
+// handler ran during the copy and the copy is taken again. See getMotorSnapshot().
+volatile byte motorStateSequence = 0;
 
 
 // If we try to trigger an interrupt too soon after the current one
@@ -205,12 +304,55 @@ volatile unsigned long timeToRight;
 // this figure we act on it now and then add the latency to the time of the 
 // next tick
 
-const unsigned long interruptLatencyInMicroSecs = 150;
+const uint32_t interruptLatencyInMicroSecs = 150;
 
-// The lowest interval between steps that is allowed
-// used to calculate timed moves
+#ifdef MOTOR_DDA
+
+volatile uint32_t leftTimeSinceStep;
+volatile uint32_t rightTimeSinceStep;
+volatile uint32_t timeOfLastTick;
 
-const unsigned long minInterruptIntervalInMicroSecs = 1200;
+void motorUpdate()
+{
+  // This method runs on every timer tick
+  // The time since the last tick is measured rather than assumed so that
+  // ticks lost while interrupts were turned off are still counted
+
+  motorStateSequence++;
+
+  currentMicros = micros();
+
+  uint32_t tickTime = currentMicros - timeOfLastTick;
+  timeOfLastTick = currentMicros;
+
+  if (leftMotorWaveformDelta != 0)
+  {
+    leftTimeSinceStep += tickTime;
+    if (leftTimeSinceStep >= leftIntervalBetweenSteps)
+    {
+      leftStep();
+      leftTimeSinceStep -= leftIntervalBetweenSteps;
+    }
+  }
+
+  if (rightMotorWaveformDelta != 0)
+  {
+    rightTimeSinceStep += tickTime;
+    if (rightTimeSinceStep >= rightIntervalBetweenSteps)
+    {
+      rightStep();
+      rightTimeSinceStep -= rightIntervalBetweenSteps;
+    }
+  }
+
+  if ((leftMotorWaveformDelta == 0) & (rightMotorWaveformDelta == 0))
+  {
+    // both motors have stopped - turn off the tick until the next move
+    Timer1.detachInterrupt();
+  }
+}
+
+#else
 
 void motorUpdate()
 {
@@ -219,6 +361,8 @@ void motorUpdate()
   // The interrupt will be delayed if the time of the next one 
   // is less than the set latency 
 
+  motorStateSequence++;
+
   currentMicros = micros();
 
   if (leftMotorWaveformDelta != 0)
@@ -291,8 +435,27 @@ void motorUpdate()
   Timer1.detachInterrupt();
 }
 
-inline void startMotor(unsigned long stepLimit, unsigned long microSecsPerPulse, bool forward,
-  volatile unsigned long * motorStepLimit, volatile unsigned long * motorPulseInterval,
+#endif
+
+#ifdef MOTOR_ISR_PROBE
+
+void probedMotorUpdate()
+{
+  PORTB |= MOTOR_ISR_PROBE_BIT;
+  motorUpdate();
+  PORTB &= ~MOTOR_ISR_PROBE_BIT;
+}
+
+#define motorInterruptHandler probedMotorUpdate
+
+#else
+
+#define motorInterruptHandler motorUpdate
+
+#endif
+
+inline void startMotor(uint32_t stepLimit, uint32_t microSecsPerPulse, bool forward,
+  volatile uint32_t * motorStepLimit, volatile uint32_t * motorPulseInterval,
   volatile char * motorDelta, volatile char * motorPos)
 {
   // If we are not moving - set the delta to zero and return
@@ -309,21 +472,32 @@ inline void startMotor(unsigned long stepLimit, unsigned long microSecsPerPulse,
 
   if (forward)
   {
-    *motorDelta = 1;
+    *motorDelta = waveformStepSize;
   }
   else
   {
-    *motorDelta = -1;
+    *motorDelta = -waveformStepSize;
   }
 
-  *motorPos = 0;
+  *motorPos = waveformStartPos;
 }
 
 void startMotors(
-  unsigned long leftSteps, unsigned long rightSteps,
-  unsigned long leftMicroSecsPerPulse, unsigned long rightMicroSecsPerPulse,
+  uint32_t leftSteps, uint32_t rightSteps,
+  uint32_t leftMicroSecsPerPulse, uint32_t rightMicroSecsPerPulse,
   bool leftForward, bool rightForward)
 {
+  moveStagesPending = false;
+
+  // The steps of the previous move are read and the counters reset with
+  // the interrupts held off, so that no step falls between the two
+
+  byte oldSREG = SREG;
+  cli();
+
+  uint32_t leftCount = leftStepCounter;
+  uint32_t rightCount = rightStepCounter;
+
   // Set up the counters for the left and right motor moves
 
   startMotor(leftSteps, leftMicroSecsPerPulse, leftForward,
@@ -334,7 +508,7 @@ void startMotors(
 
   // Now set up the interrupts 
 
-  unsigned long microSecondsAtLastInterrupt = micros();
+  uint32_t microSecondsAtLastInterrupt = micros();
 
   leftTimeOfLastStep = microSecondsAtLastInterrupt;
   rightTimeOfLastStep = microSecondsAtLastInterrupt;
@@ -342,6 +516,26 @@ void startMotors(
   leftStepCounter = 0;
   rightStepCounter = 0;
 
+  SREG = oldSREG;
+
+  // Catch up with the steps from the previous move
+  updateOdometryTo(leftCount, rightCount);
+
+  startOdometryMove(leftForward, rightForward);
+
+#ifdef MOTOR_DDA
+
+  leftTimeSinceStep = 0;
+  rightTimeSinceStep = 0;
+  timeOfLastTick = microSecondsAtLastInterrupt;
+
+  if ((leftMotorWaveformDelta != 0) | (rightMotorWaveformDelta != 0))
+  {
+    Timer1.attachInterrupt(motorInterruptHandler, DDA_TICK_IN_MICROSECS);
+  }
+
+#else
+
   // These calculations might wrap round - but that's OK because the difference 
   // calculation in the interrupt handler will deal with this
 
@@ -352,11 +546,11 @@ void startMotors(
   {
     if (leftMicroSecsPerPulse < rightMicroSecsPerPulse)
     {
-      Timer1.attachInterrupt(motorUpdate, leftMicroSecsPerPulse);
+      Timer1.attachInterrupt(motorInterruptHandler, leftMicroSecsPerPulse);
     }
     else
     {
-      Timer1.attachInterrupt(motorUpdate, rightMicroSecsPerPulse);
+      Timer1.attachInterrupt(motorInterruptHandler, rightMicroSecsPerPulse);
     }
     return;
   }
@@ -364,18 +558,97 @@ void startMotors(
   {
     if (leftMotorWaveformDelta != 0)
     {
-      Timer1.attachInterrupt(motorUpdate, leftMicroSecsPerPulse);
+      Timer1.attachInterrupt(motorInterruptHandler, leftMicroSecsPerPulse);
       return;
     }
     else
     {
-      Timer1.attachInterrupt(motorUpdate, rightMicroSecsPerPulse);
+      Timer1.attachInterrupt(motorInterruptHandler, rightMicroSecsPerPulse);
       return;
     }
   }
+
+#endif
+}
+
+// A consistent copy of the state shared with motorUpdate()
+
+struct motorSnapshot
+{
+  uint32_t leftStepCounter;
+  uint32_t rightStepCounter;
+  uint32_t leftNumberOfStepsToMove;
+  uint32_t rightNumberOfStepsToMove;
+  uint32_t leftIntervalBetweenSteps;
+  uint32_t rightIntervalBetweenSteps;
+  // time of the most recent interrupt
+  uint32_t updateMicros;
+  char leftMotorWaveformDelta;
+  char rightMotorWaveformDelta;
+};
+
+// Number of times to try a copy before turning interrupts off to take it
+#define MOTOR_SNAPSHOT_ATTEMPTS 4
+
+inline void copyMotorState(motorSnapshot * snapshot)
+{
+  snapshot->leftStepCounter = leftStepCounter;
+  snapshot->rightStepCounter = rightStepCounter;
+  snapshot->leftNumberOfStepsToMove = leftNumberOfStepsToMove;
+  snapshot->rightNumberOfStepsToMove = rightNumberOfStepsToMove;
+  snapshot->leftIntervalBetweenSteps = leftIntervalBetweenSteps;
+  snapshot->rightIntervalBetweenSteps = rightIntervalBetweenSteps;
+  snapshot->updateMicros = currentMicros;
+  snapshot->leftMotorWaveformDelta = leftMotorWaveformDelta;
+  snapshot->rightMotorWaveformDelta = rightMotorWaveformDelta;
+}
+
+// Fills in the snapshot without holding off the motor interrupt, unless
+// the interrupt keeps landing in the middle of the copy.
+// A single byte sequence is enough because the interrupt handler can't be
+// interrupted by the reader, so the reader never sees half of an update.
+
+void getMotorSnapshot(motorSnapshot * snapshot)
+{
+  for (byte attempt = 0; attempt < MOTOR_SNAPSHOT_ATTEMPTS; attempt++)
+  {
+    byte sequence = motorStateSequence;
+
+    copyMotorState(snapshot);
+
+    if (sequence == motorStateSequence)
+      return;
+  }
+
+  byte oldSREG = SREG;
+  cli();
+  copyMotorState(snapshot);
+  SREG = oldSREG;
 }
 
-typedef enum MoveFailReason
+// Just the step counters, for code that reads them often
+
+void getMotorStepCounts(uint32_t * leftCount, uint32_t * rightCount)
+{
+  for (byte attempt = 0; attempt < MOTOR_SNAPSHOT_ATTEMPTS; attempt++)
+  {
+    byte sequence = motorStateSequence;
+
+    *leftCount = leftStepCounter;
+    *rightCount = rightStepCounter;
+
+    if (sequence == motorStateSequence)
+      return;
+  }
+
+  byte oldSREG = SREG;
+  cli();
+  *leftCount = leftStepCounter;
+  *rightCount = rightStepCounter;
+  SREG = oldSREG;
+}
+
+enum MoveFailReason
 {
   Move_OK,
   Left_Distance_Too_Large,
@@ -385,7 +658,7 @@ typedef enum MoveFailReason
 
 //#define DEBUG_TIMED_MOVE
 
-MoveFailReason timedMoveSteps(long leftStepsToMove, long rightStepsToMove, float timeToMoveInSeconds)
+MoveFailReason timedMoveSteps(int32_t leftStepsToMove, int32_t rightStepsToMove, float timeToMoveInSeconds)
 {
 #ifdef DEBUG_TIMED_MOVE
   Serial.println("timedMoveSteps");
@@ -397,22 +670,22 @@ MoveFailReason timedMoveSteps(long leftStepsToMove, long rightStepsToMove, float
   Serial.println(timeToMoveInSeconds);
 #endif
 
-  long leftInterruptIntervalInMicroSeconds;
+  uint32_t leftInterruptIntervalInMicroSeconds;
 
   if (leftStepsToMove != 0)
   {
-    leftInterruptIntervalInMicroSeconds = (long) ((timeToMoveInSeconds / (double)abs(leftStepsToMove)) * 1000000L + 0.5);
+    leftInterruptIntervalInMicroSeconds = (int32_t) ((timeToMoveInSeconds / (float)abs(leftStepsToMove)) * 1000000L + 0.5);
   }
   else
   {
     leftInterruptIntervalInMicroSeconds = minInterruptIntervalInMicroSecs;
   }
 
-  long rightInterruptIntervalInMicroseconds;
+  uint32_t rightInterruptIntervalInMicroseconds;
 
   if (rightStepsToMove != 0)
   {
-    rightInterruptIntervalInMicroseconds = (long)((timeToMoveInSeconds / (double)abs(rightStepsToMove)) * 1000000L +0.5);
+    rightInterruptIntervalInMicroseconds = (int32_t)((timeToMoveInSeconds / (float)abs(rightStepsToMove)) * 1000000L +0.5);
   }
   else
   {
@@ -455,7 +728,7 @@ MoveFailReason timedMoveSteps(long leftStepsToMove, long rightStepsToMove, float
 
 //#define DEBUG_FAST_MOVE_STEPS
 
-float fastMoveSteps(long leftStepsToMove, long rightStepsToMove)
+float fastMoveSteps(int32_t leftStepsToMove, int32_t rightStepsToMove)
 {
 
 #ifdef DEBUG_FAST_MOVE_STEPS
@@ -525,8 +798,8 @@ int timedMoveDistanceInMM(float leftMMs, float rightMMs, float timeToMoveInSecon
   Serial.println(timeToMoveInSeconds);
 #endif
 
-  long leftSteps = (long)(leftMMs * leftStepsPerMM + 0.5);
-  long rightSteps = (long)(rightMMs * rightStepsPerMM + 0.5);
+  int32_t leftSteps = (int32_t)(leftMMs * leftStepsPerMM + 0.5);
+  int32_t rightSteps = (int32_t)(rightMMs * rightStepsPerMM + 0.5);
 
 #ifdef TIMED_MOVE_MM_DEBUG
   Serial.print("    Left steps to move: ");
@@ -556,8 +829,8 @@ int fastMoveDistanceInMM(float leftMMs, float rightMMs)
 
 #endif
 
-  long leftSteps = (long)(leftMMs * leftStepsPerMM + 0.5);
-  long rightSteps = (long)(rightMMs * rightStepsPerMM + 0.5);
+  int32_t leftSteps = (int32_t)(leftMMs * leftStepsPerMM + 0.5);
+  int32_t rightSteps = (int32_t)(rightMMs * rightStepsPerMM + 0.5);
 
 #ifdef FAST_MOVE_MM_DEBUG
   Serial.print("    Left steps to move: ");
@@ -588,17 +861,53 @@ void leftStop()
 
 void motorStop()
 {
+  moveStagesPending = false;
+
+  byte oldSREG = SREG;
+  cli();
+
+  uint32_t leftCount = leftStepCounter;
+  uint32_t rightCount = rightStepCounter;
+
   leftStop();
   rightStop();
+
+  SREG = oldSREG;
+
+  updateOdometryTo(leftCount, rightCount);
+  resetOdometryStepCounts();
 }
 
-bool motorsMoving()
+// Changes between half and full step drive and stores the setting
+// Stops the robot, as the step counts of a move in progress would be wrong
+
+void setDriveMode(byte mode)
+{
+  motorStop();
+
+  activeWheelSettings.driveMode = mode;
+  storeActiveWheelSettings();
+
+  setupWheelSettings();
+  calculateOdometryStepSizes();
+}
+
+bool wheelsMoving()
 {
   if (rightMotorWaveformDelta != 0) return true;
   if (leftMotorWaveformDelta != 0) return true;
   return false;
 }
 
+// A move with more stages to run counts as moving even when the wheels
+// are stopped between stages
+
+bool motorsMoving()
+{
+  if (wheelsMoving()) return true;
+  return moveStagesPending;
+}
+
 void waitForMotorsStop()
 {
   while (motorsMoving())
@@ -0,0 +1,534 @@
+///////////////////////////////////////////////////////////
+/// Odometry
+///////////////////////////////////////////////////////////
+
+// Works out where the robot is by adding up the steps made by each wheel.
+// The pose is held in fixed point so that no floating point is used when it is updated.
+//
+// Position is measured in mm from where the robot was when the program started.
+// y is straight ahead and x is to the right. The heading is in centi-degrees and works
+// like a compass, increasing as the robot turns to the right, so it matches the turn command.
+// It runs from -18000 to 18000 so that it fits in a script value.
+
+// Sine of 0 to 90 degrees in one degree steps, scaled by 16384
+
+const int sineTable[91] PROGMEM = {
+  0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+  2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+  5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+  8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+  10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+  12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+  14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+  15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+  16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+  16384 };
+
+#define FIXED_POINT_SHIFT 14
+
+// Returns the sine of an angle given in centi-degrees, scaled by 16384
+// Values between the table entries are interpolated
+
+int fixedPointSin(int32_t centiDegrees)
+{
+  // bring the angle into the range 0 to 35999
+  centiDegrees = centiDegrees % 36000;
+  if (centiDegrees < 0)
+    centiDegrees += 36000;
+
+  // the second half of the wave is the first half upside down
+  bool negative = false;
+  if (centiDegrees >= 18000)
+  {
+    centiDegrees -= 18000;
+    negative = true;
+  }
+
+  // the second quarter is the first quarter backwards
+  if (centiDegrees > 9000)
+    centiDegrees = 18000 - centiDegrees;
+
+  int degrees = centiDegrees / 100;
+  int fraction = centiDegrees % 100;
+
+  int result = pgm_read_word_near(sineTable + degrees);
+
+  if (fraction != 0)
+  {
+    int next = pgm_read_word_near(sineTable + degrees + 1);
+    result += ((int32_t)(next - result) * fraction) / 100;
+  }
+
+  if (negative)
+    return -result;
+  else
+    return result;
+}
+
+int fixedPointCos(int32_t centiDegrees)
+{
+  return fixedPointSin(centiDegrees + 9000);
+}
+
+// Position is held in 1/65536ths of a mm
+#define POSITION_SHIFT 16
+
+// Heading is held in 1/1024ths of a centi-degree
+#define HEADING_SHIFT 10
+
+#define HALF_TURN_IN_HEADING_UNITS (18000L << HEADING_SHIFT)
+#define FULL_TURN_IN_HEADING_UNITS (36000L << HEADING_SHIFT)
+
+// Steps are added into the pose in pieces no larger than this, so that the
+// arithmetic can't overflow and the robot doesn't cut the corners of arcs
+
+#define ODOMETRY_MAX_STEPS_PER_UPDATE 256
+
+int32_t odometryX;
+int32_t odometryY;
+int32_t odometryHeading;
+
+// The distance moved by one step of each wheel in 1/65536ths of a mm
+int32_t leftMMPerStep;
+int32_t rightMMPerStep;
+
+// The change in heading from one step of each wheel in heading units
+int32_t leftHeadingPerStep;
+int32_t rightHeadingPerStep;
+
+// The values of the motor step counters the last time the pose was updated
+uint32_t odometryLeftCount;
+uint32_t odometryRightCount;
+
+// The directions of the current move
+bool odometryLeftForward;
+bool odometryRightForward;
+
+void resetOdometry()
+{
+  // Steps made before the reset are not part of the new pose
+  getMotorStepCounts(&odometryLeftCount, &odometryRightCount);
+
+  odometryX = 0;
+  odometryY = 0;
+  odometryHeading = 0;
+}
+
+// Works out the fixed point step sizes from the wheel settings
+// Must be called again when the drive mode changes
+
+void calculateOdometryStepSizes()
+{
+  leftMMPerStep = (int32_t)((leftWheelCircumference / countsperrev) * 65536.0 + 0.5);
+  rightMMPerStep = (int32_t)((rightWheelCircumference / countsperrev) * 65536.0 + 0.5);
+
+  // a step of one wheel turns the robot about the other wheel
+  float headingUnitsPerMM = (18000.0 / PI) * (1 << HEADING_SHIFT) / activeWheelSettings.wheelSpacing;
+
+  leftHeadingPerStep = (int32_t)((leftWheelCircumference / countsperrev) * headingUnitsPerMM + 0.5);
+  rightHeadingPerStep = (int32_t)((rightWheelCircumference / countsperrev) * headingUnitsPerMM + 0.5);
+}
+
+// Must be called after the motors have been set up
+
+void setupOdometry()
+{
+  calculateOdometryStepSizes();
+  resetOdometry();
+}
+
+void integrateOdometry(int32_t leftSteps, int32_t rightSteps)
+{
+  // distance moved by the middle of the robot in 1/256ths of a mm
+  int32_t distance = (leftSteps * leftMMPerStep + rightSteps * rightMMPerStep) >> 9;
+
+  int32_t headingChange = leftSteps * leftHeadingPerStep - rightSteps * rightHeadingPerStep;
+
+  // Use the heading half way through the move
+  int32_t centiDegrees = (odometryHeading + headingChange / 2) >> HEADING_SHIFT;
+
+  // distance is in 1/256ths, sin and cos are in 1/16384ths, position is in 1/65536ths
+  odometryX += (distance * fixedPointSin(centiDegrees)) >> (FIXED_POINT_SHIFT + 8 - POSITION_SHIFT);
+  odometryY += (distance * fixedPointCos(centiDegrees)) >> (FIXED_POINT_SHIFT + 8 - POSITION_SHIFT);
+
+  odometryHeading += headingChange;
+
+  if (odometryHeading >= HALF_TURN_IN_HEADING_UNITS)
+    odometryHeading -= FULL_TURN_IN_HEADING_UNITS;
+
+  if (odometryHeading < -HALF_TURN_IN_HEADING_UNITS)
+    odometryHeading += FULL_TURN_IN_HEADING_UNITS;
+}
+
+// Adds the steps up to the given step counter values into the pose
+// Used when the counters are read and reset together, see startMotors()
+
+void updateOdometryTo(uint32_t leftCount, uint32_t rightCount)
+{
+  int32_t leftSteps = leftCount - odometryLeftCount;
+  int32_t rightSteps = rightCount - odometryRightCount;
+
+  if (leftSteps == 0 & rightSteps == 0)
+    return;
+
+  odometryLeftCount = leftCount;
+  odometryRightCount = rightCount;
+
+  if (!odometryLeftForward)
+    leftSteps = -leftSteps;
+
+  if (!odometryRightForward)
+    rightSteps = -rightSteps;
+
+  int32_t largestSteps = max(abs(leftSteps), abs(rightSteps));
+
+  if (largestSteps <= ODOMETRY_MAX_STEPS_PER_UPDATE)
+  {
+    integrateOdometry(leftSteps, rightSteps);
+    return;
+  }
+
+  // Split the steps into equal pieces
+
+  int32_t pieces = largestSteps / ODOMETRY_MAX_STEPS_PER_UPDATE + 1;
+
+  int32_t leftDone = 0;
+  int32_t rightDone = 0;
+
+  for (int32_t i = 1; i <= pieces; i++)
+  {
+    int32_t leftTarget = (leftSteps * i) / pieces;
+    int32_t rightTarget = (rightSteps * i) / pieces;
+
+    integrateOdometry(leftTarget - leftDone, rightTarget - rightDone);
+
+    leftDone = leftTarget;
+    rightDone = rightTarget;
+  }
+}
+
+// Adds any steps made since the last update into the pose
+// Called from the main loop and whenever the pose is read
+
+void updateOdometry()
+{
+  uint32_t leftCount;
+  uint32_t rightCount;
+
+  getMotorStepCounts(&leftCount, &rightCount);
+  updateOdometryTo(leftCount, rightCount);
+}
+
+// Called by startMotors after the step counters have been reset for a new move
+
+void startOdometryMove(bool leftForward, bool rightForward)
+{
+  odometryLeftCount = 0;
+  odometryRightCount = 0;
+  odometryLeftForward = leftForward;
+  odometryRightForward = rightForward;
+}
+
+// Called when the motors are stopped and the step counters reset
+
+void resetOdometryStepCounts()
+{
+  odometryLeftCount = 0;
+  odometryRightCount = 0;
+}
+
+int getOdometryXInMM()
+{
+  updateOdometry();
+  return (int)((odometryX + (1L << (POSITION_SHIFT - 1))) >> POSITION_SHIFT);
+}
+
+int getOdometryYInMM()
+{
+  updateOdometry();
+  return (int)((odometryY + (1L << (POSITION_SHIFT - 1))) >> POSITION_SHIFT);
+}
+
+int getOdometryHeadingInCentiDegrees()
+{
+  updateOdometry();
+  return (int)(odometryHeading >> HEADING_SHIFT);
+}
+
+///////////////////////////////////////////////////////////
+/// Go to point
+///////////////////////////////////////////////////////////
+
+// Drives the robot to a point given in the same coordinates as the odometry.
+// If the point is nearly ahead the robot drives a single arc that ends on it,
+// otherwise it turns to face the point and then drives to it. The plan for the
+// second stage is made from the pose at the end of the turn, so any error in the
+// turn is taken out by the drive.
+
+// atan of 0 to 1 in steps of 1/32, in centi-degrees
+
+const int atanTable[33] PROGMEM = {
+  0, 179, 358, 536, 713, 888, 1062, 1234, 1404, 1571,
+  1735, 1897, 2056, 2211, 2363, 2511, 2657, 2798, 2936, 3070,
+  3201, 3327, 3451, 3571, 3687, 3800, 3909, 4016, 4119, 4218,
+  4315, 4409, 4500 };
+
+// Returns the atan of a ratio between 0 and 1 scaled by 16384, in centi-degrees
+
+int fixedPointAtanOfRatio(int32_t ratio)
+{
+  int index = ratio >> 9;
+
+  if (index >= 32)
+    return pgm_read_word_near(atanTable + 32);
+
+  int fraction = ratio & 0x1FF;
+
+  int result = pgm_read_word_near(atanTable + index);
+  int next = pgm_read_word_near(atanTable + index + 1);
+
+  return result + (((int32_t)(next - result) * fraction) >> 9);
+}
+
+// Returns the compass bearing of a point dx to the right and dy ahead, in centi-degrees
+// Also returns the distance to the point in 1/256ths of a mm
+// dx and dy must be within +-65535
+
+int fixedPointBearing(int32_t dx, int32_t dy, int32_t * distance)
+{
+  int32_t absX = abs(dx);
+  int32_t absY = abs(dy);
+
+  if (absX == 0 & absY == 0)
+  {
+    *distance = 0;
+    return 0;
+  }
+
+  // work out the angle away from the nearest axis, which is never more than 45 degrees
+  int32_t large = max(absX, absY);
+  int32_t small = min(absX, absY);
+
+  int angle = fixedPointAtanOfRatio((small << FIXED_POINT_SHIFT) / large);
+
+  // the distance is the length along the axis divided by the cos of the angle
+  // divided in two parts so that it can't overflow
+  int32_t scaled = large << FIXED_POINT_SHIFT;
+  int32_t cosine = fixedPointCos(angle);
+  *distance = ((scaled / cosine) << 8) + (((scaled % cosine) << 8) / cosine);
+
+  // now turn the angle into a bearing
+  if (absX > absY)
+    angle = 9000 - angle;
+
+  if (dy < 0)
+    angle = 18000 - angle;
+
+  if (dx < 0)
+    angle = -angle;
+
+  return angle;
+}
+
+// Multiplies a value by a fixed point factor without overflowing
+
+int32_t multiplyFixedPoint(int32_t value, int32_t factor)
+{
+  return (value >> FIXED_POINT_SHIFT) * factor + (((value & 0x3FFF) * factor) >> FIXED_POINT_SHIFT);
+}
+
+// Converts centi-degrees to radians scaled by 16384
+#define CENTI_DEGREES_TO_RADIANS(a) (((int32_t)(a) * 46851L + 8192) >> FIXED_POINT_SHIFT)
+
+// Converts a distance in 1/256ths of a mm into steps of a wheel
+
+int32_t distanceToSteps(int32_t distance, int32_t mmPerStep)
+{
+  bool negative = distance < 0;
+
+  if (negative)
+    distance = -distance;
+
+  int32_t steps = (distance / mmPerStep) << 8;
+  steps += (((distance % mmPerStep) << 8) + mmPerStep / 2) / mmPerStep;
+
+  if (negative)
+    return -steps;
+  else
+    return steps;
+}
+
+// Points closer than this (in 1/256ths of a mm) count as reached
+#define GOTO_TOLERANCE (2 * 256)
+
+// If the point is further round than this the robot turns to face it before driving
+// Set to 0 to always turn and then drive. Must be less than 9000.
+int gotoMaxArcAngleInCentiDegrees = 4500;
+
+// Below this angle the arc length is worked out from a series rather than the sine table
+#define GOTO_SMALL_ARC_ANGLE 1000
+
+enum GotoStage {
+  GOTO_TURNING,
+  GOTO_DRIVING
+};
+
+GotoStage gotoStage;
+
+int gotoTargetX;
+int gotoTargetY;
+
+// Time left for the move in milliseconds, 0 for as fast as possible
+int32_t gotoTimeLeftInMillis;
+
+// Works out how far the robot must turn to face the target and how far away it is
+
+int planGoto(int32_t * distance)
+{
+  updateOdometry();
+
+  int32_t dx = (int32_t)gotoTargetX - getOdometryXInMM();
+  int32_t dy = (int32_t)gotoTargetY - getOdometryYInMM();
+
+  int bearing = fixedPointBearing(dx, dy, distance);
+
+  int32_t turn = bearing - (odometryHeading >> HEADING_SHIFT);
+
+  if (turn > 18000)
+    turn -= 36000;
+
+  if (turn < -18000)
+    turn += 36000;
+
+  return turn;
+}
+
+// Hands a move of each wheel (in 1/256ths of a mm) to the motors
+
+MoveFailReason startGotoMove(int32_t leftDistance, int32_t rightDistance, int32_t timeInMillis)
+{
+  int32_t leftSteps = distanceToSteps(leftDistance, leftMMPerStep);
+  int32_t rightSteps = distanceToSteps(rightDistance, rightMMPerStep);
+
+  if (timeInMillis == 0)
+  {
+    fastMoveSteps(leftSteps, rightSteps);
+    return Move_OK;
+  }
+
+  return timedMoveSteps(leftSteps, rightSteps, timeInMillis / 1000.0);
+}
+
+// Drives an arc that starts along the current heading and ends on the target
+// turn is the bearing of the target relative to the heading
+
+MoveFailReason startGotoArc(int turn, int32_t distance, int32_t timeInMillis)
+{
+  if (turn == 0)
+    return startGotoMove(distance, distance, timeInMillis);
+
+  // The arc turns the robot through twice the angle to the target
+  // The middle of the robot moves distance * turn / sin(turn) along it
+  // and each wheel moves turn * wheelSpacing further or less than that
+
+  int32_t turnRadians = CENTI_DEGREES_TO_RADIANS(turn);
+
+  int32_t arcFactor;
+
+  if (abs(turn) < GOTO_SMALL_ARC_ANGLE)
+  {
+    // For small angles the table is not precise enough, so use turn / sin(turn) = 1 + turn^2 / 6
+    int32_t turnSquared = (turnRadians * turnRadians) >> FIXED_POINT_SHIFT;
+    arcFactor = (1L << FIXED_POINT_SHIFT) + turnSquared / 6;
+  }
+  else
+  {
+    arcFactor = (turnRadians << FIXED_POINT_SHIFT) / fixedPointSin(turn);
+  }
+
+  int32_t arcLength = multiplyFixedPoint(distance, arcFactor);
+
+  int32_t wheelDifference = (turnRadians * activeWheelSettings.wheelSpacing) >> (FIXED_POINT_SHIFT - 8);
+
+  return startGotoMove(arcLength + wheelDifference, arcLength - wheelDifference, timeInMillis);
+}
+
+MoveFailReason startGotoTurn(int turn, int32_t timeInMillis)
+{
+  int32_t wheelDistance = (CENTI_DEGREES_TO_RADIANS(turn) * activeWheelSettings.wheelSpacing) >> (FIXED_POINT_SHIFT + 1 - 8);
+
+  return startGotoMove(wheelDistance, -wheelDistance, timeInMillis);
+}
+
+// Starts a move to the given point
+// timeInMillis is the time for the whole move, 0 to move as fast as possible
+
+MoveFailReason startGoto(int x, int y, int32_t timeInMillis)
+{
+  gotoTargetX = x;
+  gotoTargetY = y;
+
+  int32_t distance;
+
+  int turn = planGoto(&distance);
+
+  if (distance < GOTO_TOLERANCE)
+  {
+    motorStop();
+    return Move_OK;
+  }
+
+  MoveFailReason result;
+
+  if (abs(turn) <= gotoMaxArcAngleInCentiDegrees)
+  {
+    result = startGotoArc(turn, distance, timeInMillis);
+    gotoStage = GOTO_DRIVING;
+  }
+  else
+  {
+    // share the time between the turn and the drive by the distance each wheel moves
+    int32_t turnDistance = (CENTI_DEGREES_TO_RADIANS(abs(turn)) * activeWheelSettings.wheelSpacing) >> (FIXED_POINT_SHIFT + 1 - 8);
+    int32_t turnTime = (int32_t)((float)timeInMillis * turnDistance / (turnDistance + distance));
+
+    result = startGotoTurn(turn, turnTime);
+    gotoTimeLeftInMillis = timeInMillis - turnTime;
+    gotoStage = GOTO_TURNING;
+  }
+
+  if (result == Move_OK & gotoStage == GOTO_TURNING)
+    moveStagesPending = true;
+
+  return result;
+}
+
+// Starts the next stage of a move when the previous one has finished
+// Called from the main loop
+
+void updateGoto()
+{
+  if (!moveStagesPending)
+    return;
+
+  if (wheelsMoving())
+    return;
+
+  moveStagesPending = false;
+
+  if (gotoStage == GOTO_TURNING)
+  {
+    int32_t distance;
+
+    int turn = planGoto(&distance);
+
+    if (distance < GOTO_TOLERANCE)
+      return;
+
+    gotoStage = GOTO_DRIVING;
+
+    // The turn can leave too little of the time for the drive, and the MG
+    // reply has already been sent, so the drive is made at full speed
+    if (startGotoArc(turn, distance, gotoTimeLeftInMillis) != Move_OK)
+      startGotoArc(turn, distance, 0);
+  }
+}
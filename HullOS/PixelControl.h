@@ -7,7 +7,7 @@
 
 #define TICK_INTERVAL 20
 
-unsigned long tickEnd;
+uint32_t tickEnd;
 
 #define NO_OF_GAPS 32
 
@@ -28,7 +28,7 @@ bool flickerActive;
 bool forceLightUpdate;
 
 
-typedef enum lightStates
+enum lightStates
 {
 	lightStateOff,
 	lightStateColourBounce,
@@ -134,8 +134,12 @@ void randomiseLights()
 	forceLightUpdate = true;
 }
 
+void stopAnimation();
+
 void setAllLightsOff()
 {
+	stopAnimation();
+
 	for (byte i = 0; i < NO_OF_LIGHTS; i++)
 	{
 		lights[i].lightState = lightStateOff;
@@ -178,6 +182,58 @@ void copyBlock(byte * dest, byte * src, int length)
 	}
 }
 
+// Define to correct the light levels for the way the eye sees brightness
+// so that fades look even. This changes the colours that are shown, so it
+// is left out and the pixels are driven linearly as they always have been.
+//#define LIGHT_GAMMA_CORRECTION
+
+#ifdef LIGHT_GAMMA_CORRECTION
+
+// Pixel level for each linear light level, gamma 2.2
+// Any light level above 0 gives at least 1 so that dim colours don't vanish
+const byte lightGammaTable[256] PROGMEM = {
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6,
+	6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 11, 11, 11, 12,
+	12, 13, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19,
+	20, 20, 21, 22, 22, 23, 23, 24, 25, 25, 26, 26, 27, 28, 28, 29,
+	30, 30, 31, 32, 33, 33, 34, 35, 35, 36, 37, 38, 39, 39, 40, 41,
+	42, 43, 43, 44, 45, 46, 47, 48, 49, 49, 50, 51, 52, 53, 54, 55,
+	56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+	73, 74, 75, 76, 77, 78, 79, 81, 82, 83, 84, 85, 87, 88, 89, 90,
+	91, 93, 94, 95, 97, 98, 99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+	113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+	137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+	163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+	192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+	223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255 };
+
+#define LIGHT_LEVEL(v) pgm_read_byte_near(lightGammaTable + (v))
+
+#else
+
+#define LIGHT_LEVEL(v) (v)
+
+#endif
+
+// Define to print the time taken to render the lights
+//#define LIGHT_RENDER_TIMING
+
+// Scales a colour channel by a fraction of 65536 and converts it to a pixel level
+#define SCALE_CHANNEL(c, scale) LIGHT_LEVEL((byte)(((uint32_t)(c) * (scale)) >> 16))
+
+// Works out the fraction of 65536 given by a flicker and brightness (both out of 255)
+// and a number of gaps (out of NO_OF_GAPS). Multiplying the flicker and brightness
+// product by 1 + 1/128 + 1/16384 turns 255 * 255 into 65536 without a division.
+
+inline uint32_t lightScale(byte flicker, byte brightness, byte gaps)
+{
+	uint32_t product = (unsigned int)flicker * brightness;
+	product += (product >> 7) + (product >> 14);
+	return (product * gaps) / NO_OF_GAPS;
+}
+
 void renderLight(int lightNo)
 {
 	if (lights[lightNo].lightState == lightStateOff) return;
@@ -187,10 +243,10 @@ void renderLight(int lightNo)
 	byte secondLight = firstLight + 1;
 	if (secondLight == PIXELS) secondLight = 0;
 	byte positionInGap = pos % NO_OF_GAPS;
-	float secondFactor = (float)positionInGap / NO_OF_GAPS;
-	float firstFactor = 1 - secondFactor;
-	float flickerFactor = (float)lights[lightNo].flickerBrightness / 255;
-	float brightnessFactor = (float)lightBrightness / 255;
+
+	// The scale for each pixel is worked out once so that each channel needs
+	// one multiply and one table lookup. The second pixel does not flicker.
+	uint32_t firstScale = lightScale(lights[lightNo].flickerBrightness, lightBrightness, NO_OF_GAPS - positionInGap);
 
 #ifdef DISPLAY_LIGHT_SETTINGS
 	Serial.print("Rendering Light ");
@@ -209,35 +265,28 @@ void renderLight(int lightNo)
 	Serial.println(lights[lightNo].pos);
 	Serial.print("positionInGap:  ");
 	Serial.println(positionInGap);
-	Serial.print("secondFactor:  ");
-	Serial.println(secondFactor);
-	Serial.print("firstFactor:  ");
-	Serial.println(firstFactor);
-	Serial.print("flickerFactor:  ");
-	Serial.println(flickerFactor);
-	byte rv = lights[lightNo].r*firstFactor*flickerFactor*brightnessFactor;
-	Serial.print("First factor: ");
-	Serial.print(firstFactor);
-	Serial.print("Flicker factor: ");
-	Serial.print(flickerFactor);
-	Serial.print("Brightness factor: ");
-	Serial.print(brightnessFactor);
-	Serial.print("Brightness: ");
-	Serial.println(rv);
+	Serial.print("Flicker brightness:  ");
+	Serial.println(lights[lightNo].flickerBrightness);
+	Serial.print("First scale: ");
+	Serial.print(firstScale);
+	Serial.print(" Brightness: ");
+	Serial.println(SCALE_CHANNEL(lights[lightNo].r, firstScale));
 	//delay(2000);
 
 #endif 
 
 	strip.setPixelColor(firstLight,
-		(byte)(lights[lightNo].r*firstFactor*flickerFactor*brightnessFactor),
-		(byte)(lights[lightNo].g*firstFactor*flickerFactor*brightnessFactor),
-		(byte)(lights[lightNo].b*firstFactor*flickerFactor*brightnessFactor));
+		SCALE_CHANNEL(lights[lightNo].r, firstScale),
+		SCALE_CHANNEL(lights[lightNo].g, firstScale),
+		SCALE_CHANNEL(lights[lightNo].b, firstScale));
 
 	if (positionInGap != 0) {
+		uint32_t secondScale = lightScale(255, lightBrightness, positionInGap);
+
 		strip.setPixelColor(secondLight,
-			(byte)(lights[lightNo].r*secondFactor*brightnessFactor),
-			(byte)(lights[lightNo].g*secondFactor*brightnessFactor),
-			(byte)(lights[lightNo].b*secondFactor*brightnessFactor));
+			SCALE_CHANNEL(lights[lightNo].r, secondScale),
+			SCALE_CHANNEL(lights[lightNo].g, secondScale),
+			SCALE_CHANNEL(lights[lightNo].b, secondScale));
 	}
 }
 
@@ -304,6 +353,10 @@ void flickerOff()
 
 void renderLights()
 {
+#ifdef LIGHT_RENDER_TIMING
+	uint32_t renderStart = micros();
+#endif
+
 	for (uint16_t i = 0; i < strip.numPixels(); i++) {
 		strip.setPixelColor(i, 0, 0, 0);
 	}
@@ -313,6 +366,15 @@ void renderLights()
 		renderLight(i);
 	}
 
+#ifdef LIGHT_RENDER_TIMING
+	uint32_t renderTime = micros() - renderStart;
+	if (tickCount % 50 == 0)
+	{
+		Serial.print(F("Render time: "));
+		Serial.println(renderTime);
+	}
+#endif
+
 	if (forceLightUpdate)
 	{
 		strip.show();
@@ -674,150 +736,96 @@ void startLightTransition(byte lightNo, byte speed, byte colourSpeed, byte r, by
 	}
 }
 
-/* Colour Codes
-
-Alice Blue,240,248,255,#f0f8ff
-Antique White,250,235,215,#faebd7
-Aqua,0,255,255,#00ffff
-Aquamarine,127,255,212,#7fffd4
-Azure,240,255,255,#f0ffff
-Beige,245,245,220,#f5f5dc
-Bisque,255,228,196,#ffe4c4
-Black* 0,0,0,#000000
-Blanched Almond,255,235,205,#ffebcd
-Blue*,0,0,255,#0000ff
-Blue-Violet,138,43,226,#8a2be2
-Brown,165,42,42,#a52a2a
-Burlywood,222,184,135,#deb887
-Cadet Blue,95,158,160,#5f9ea0
-Chartreuse,127,255,0,#7fff00
-Chocolate,210,105,30,#d2691e
-Coral,255,127,80,#ff7f50
-Cornflower Blue,100,149,237,#6495ed
-Cornsilk,255,248,220,#fff8dc
-Cyan,0,255,255,#00ffff
-Dark Blue,0,0,139,#00008b
-Dark Cyan,0,139,139,#008b8b
-Dark Goldenrod,184,134,11,#b8860b
-Dark Gray,169,169,169,#a9a9a9
-Dark Green,0,100,0,#006400
-Dark Khaki,189,183,107,#bdb76b
-Dark Magenta,139,0,139,#8b008b
-Dark Olive Green,85,107,47,#556b2f
-Dark Orange,255,140,0,#ff8c00
-Dark Orchid,153,50,204,#9932cc
-Dark Red,139,0,0,#8b0000
-Dark Salmon,233,150,122,#e9967a
-Dark Sea Green,143,188,143,#8fbc8f
-Dark Slate Blue,72,61,139,#483d8b
-Dark Slate Gray,47,79,79,#2f4f4f
-Dark Turquoise,0,206,209,#00ced1
-Dark Violet,148,0,211,#9400d3
-Deep Pink,255,20,147,#ff1493
-Deep Sky Blue,0,191,255,#00bfff
-Dim Gray,105,105,105,#696969
-Dodger Blue,30,144,255,#1e90ff
-Firebrick,178,34,34,#b22222
-Floral White,255,250,240,#fffaf0
-Forest Green,34,139,34,#228b22
-Fuschia* 255,0,255,#ff00ff
-Gainsboro,220,220,220,#dcdcdc
-Ghost White,255,250,250,#f8f8ff
-Gold,255,215,0,#ffd700
-Goldenrod,218,165,32,#daa520
-Gray*,128,128,128,#808080
-Green* 0,128,0,#008000
-Green-Yellow,173,255,47,#adff2f
-Honeydew,240,255,240,#f0fff0
-Hot Pink,255,105,180,#ff69b4
-Indian Red,205,92,92,#cd5c5c
-Ivory,255,255,240,#fffff0
-Khaki,240,230,140,#f0e68c
-Lavender,230,230,250,#e6e6fa
-Lavender Blush,255,240,245,#fff0f5
-Lawn Green,124,252,0,#7cfc00
-Lemon Chiffon,255,250,205,#fffacd
-Light Blue,173,216,230,#add8e6
-Light Coral,240,128,128,#f08080
-Light Cyan,224,255,255,#e0ffff
-Light Goldenrod,238,221,130,#eedd82
-Light Goldenrod Yellow,250,250,210,#fafad2
-Light Gray,211,211,211,#d3d3d3
-Light Green,144,238,144,#90ee90
-Light Pink,255,182,193,#ffb6c1
-Light Salmon,255,160,122,#ffa07a
-Light Sea Green,32,178,170,#20b2aa
-Light Sky Blue,135,206,250,#87cefa
-Light Slate Blue,132,112,255,#8470ff
-Light Slate Gray,119,136,153,#778899
-Light Steel Blue,176,196,222,#b0c4de
-Light Yellow,255,255,224,#ffffe0
-Lime*,0,255,0,#00ff00
-Lime Green,50,205,50,#32cd32
-Linen,250,240,230,#faf0e6
-Magenta,255,0,255,#ff00ff
-Maroon* 128,0,0,#800000
-Medium Aquamarine,102,205,170,#66cdaa
-Medium Blue,0,0,205,#0000cd
-Medium Orchid,186,85,211,#ba55d3
-Medium Purple,147,112,219,#9370db
-Medium Sea Green,60,179,113,#3cb371
-Medium Slate Blue,123,104,238,#7b68ee
-Medium Spring Green,0,250,154,#00fa9a
-Medium Turquoise,72,209,204,#48d1cc
-Medium Violet-Red,199,21,133,#c71585
-Midnight Blue,25,25,112,#191970
-Mint Cream,245,255,250,#f5fffa
-Misty Rose,255,228,225,#e1e4e1
-Moccasin,255,228,181,#ffe4b5
-Navajo White,255,222,173,#ffdead
-Navy*,0,0,128,#000080
-Old Lace,253,245,230,#fdf5e6
-Olive* 128,128,0,#808000
-Olive Drab,107,142,35,#6b8e23
-Orange,255,165,0,#ffa500
-Orange-Red,255,69,0,#ff4500
-Orchid,218,112,214,#da70d6
-Pale Goldenrod,238,232,170,#eee8aa
-Pale Green,152,251,152,#98fb98
-Pale Turquoise,175,238,238,#afeeee
-Pale Violet-Red,219,112,147,#db7093
-Papaya Whip,255,239,213,#ffefd5
-Peach Puff,255,218,185,#ffdab9
-Peru,205,133,63,#cd853f
-Pink,255,192,203,#ffc0cb
-Plum,221,160,221,#dda0dd
-Powder Blue,176,224,230,#b0e0e6
-Purple* 128,0,128,#800080
-Red*,255,0,0,#ff0000
-Rosy Brown,188,143,143,#bc8f8f
-Royal Blue,65,105,225,#4169e1
-Saddle Brown,139,69,19,#8b4513
-Salmon,250,128,114,#fa8072
-Sandy Brown,244,164,96,#f4a460
-Sea Green,46,139,87,#2e8b57
-Seashell,255,245,238,#fff5ee
-Sienna,160,82,45,#a0522d
-Silver* 192,192,192,#c0c0c0
-Sky Blue,135,206,235,#87ceeb
-Slate Blue,106,90,205,#6a5acd
-Slate Gray,112,128,144,#708090
-Snow,255,250,250,#fffafa
-Spring Green,0,255,127,#00ff7f
-Steel Blue,70,130,180,#4682b4
-Tan,210,180,140,#d2b48c
-Teal*,0,128,128,#008080
-Thistle,216,191,216,#d8bfd8
-Tomato,255,99,71,#ff6347
-Turquoise,64,224,208,#40e0d0
-Violet,238,130,238,#ee82ee
-Violet-Red,208,32,144,#d02090
-Wheat,245,222,179,#f5deb3
-White* 255,255,255,#ffffff
-White Smoke,245,245,245,#f5f5f5
-Yellow* 255,255,0,#ffff00
-Yellow-Green,154,205,50,#9acd32,
-*/
+// Named colours, the ones given in the HullOS specification. Their values
+// are the same as the single letter colours of the PN command. Names are
+// held in lower case with any spaces and hyphens removed, so "Red" and "red"
+// find the same entry. The table must be kept in strcmp order because
+// findNamedColour does a binary search over it.
+
+const char colourName0[] PROGMEM = "black";
+const char colourName1[] PROGMEM = "blue";
+const char colourName2[] PROGMEM = "cyan";
+const char colourName3[] PROGMEM = "green";
+const char colourName4[] PROGMEM = "magenta";
+const char colourName5[] PROGMEM = "red";
+const char colourName6[] PROGMEM = "white";
+const char colourName7[] PROGMEM = "yellow";
+
+struct namedColour
+{
+	const char * name;
+	byte r, g, b;
+};
+
+const namedColour namedColours[] PROGMEM = {
+	{ colourName0, 0, 0, 0 },
+	{ colourName1, 0, 0, 255 },
+	{ colourName2, 0, 255, 255 },
+	{ colourName3, 0, 255, 0 },
+	{ colourName4, 255, 0, 255 },
+	{ colourName5, 255, 0, 0 },
+	{ colourName6, 255, 255, 255 },
+	{ colourName7, 255, 255, 0 }
+};
+
+#define NO_OF_NAMED_COLOURS (sizeof(namedColours) / sizeof(namedColour))
+
+// Longest name in the table is "magenta", with room for a few spaces
+#define MAX_COLOUR_NAME_LENGTH 10
+
+// Converts a colour name typed by the user into the form held in the table
+// by removing spaces and hyphens and dropping to lower case. Works in place.
+
+void normaliseColourName(char * name)
+{
+	char * dest = name;
+
+	for (char * src = name; *src != 0; src++)
+	{
+		char ch = *src;
+
+		if (ch == ' ' || ch == '-')
+			continue;
+
+		if (ch >= 'A' && ch <= 'Z')
+			ch = ch - 'A' + 'a';
+
+		*dest++ = ch;
+	}
+	*dest = 0;
+}
+
+// Binary search of the named colour table for a normalised name.
+// Returns true and sets r, g, b if the colour is found
+
+bool findNamedColour(const char * name, byte *r, byte *g, byte *b)
+{
+	int low = 0;
+	int high = NO_OF_NAMED_COLOURS - 1;
+	namedColour entry;
+
+	while (low <= high)
+	{
+		int mid = (low + high) / 2;
+
+		memcpy_P(&entry, &namedColours[mid], sizeof(namedColour));
+
+		int result = strcmp_P(name, entry.name);
+
+		if (result == 0)
+		{
+			(*r) = entry.r; (*g) = entry.g; (*b) = entry.b;
+			return true;
+		}
+
+		if (result < 0)
+			high = mid - 1;
+		else
+			low = mid + 1;
+	}
+
+	return false;
+}
 
 enum lightColor
 {
@@ -836,174 +844,36 @@ enum lightColor
 	teal
 };
 
+// Colours used by selectColour and pickRandomColour, in lightColor order
+
+const byte paletteColours[][3] PROGMEM = {
+	{ 255, 0, 0 },		// red
+	{ 0, 0, 255 },		// blue
+	{ 0, 255, 0 },		// green
+	{ 220, 208, 255 },	// lilac
+	{ 0, 255, 255 },	// cyan
+	{ 255, 105, 180 },	// hot pink
+	{ 230, 230, 250 },	// lavender
+	{ 221, 160, 221 },	// plum
+	{ 50, 205, 50 },	// lime
+	{ 255, 165, 0 },	// orange
+	{ 176, 224, 230 },	// powder blue
+	{ 128, 0, 128 },	// purple
+	{ 0, 128, 128 }		// teal
+};
+
+#define NO_OF_PALETTE_COLOURS (sizeof(paletteColours) / sizeof(paletteColours[0]))
+
 void selectColour(lightColor color, byte *r, byte *g, byte *b)
 {
-	switch (color)
-	{
-	case red: // red
-#ifdef SERIAL_VERBOSE
-		Serial.println("Red");
-#endif
-		(*r) = 255; (*g) = 0; (*b) = 0;
-		break;
-	case blue: // blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("Blue");
-#endif
-		(*r) = 0; (*g) = 0; (*b) = 255;
-		break;
-	case green: // green
-#ifdef SERIAL_VERBOSE
-		Serial.println("Green");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 0;
-		break;
-	case lilac: // lilac
-#ifdef SERIAL_VERBOSE
-		Serial.println("Lilac");
-#endif
-		(*r) = 220; (*g) = 208; (*b) = 255;
-		break;
-	case cyan: // cyan
-#ifdef SERIAL_VERBOSE
-		Serial.println("cyan");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 255;
-		break;
-	case pink: // hot pink
-#ifdef SERIAL_VERBOSE
-		Serial.println("hot pink");
-#endif
-		(*r) = 255; (*g) = 105; (*b) = 180;
-		break;
-	case lavender: // lavender
-#ifdef SERIAL_VERBOSE
-		Serial.println("lavender");
-#endif
-		(*r) = 230; (*g) = 230; (*b) = 250;
-		break;
-	case plum: // plum
-#ifdef SERIAL_VERBOSE
-		Serial.println("plum");
-#endif
-		(*r) = 221; (*g) = 160; (*b) = 221;
-		break;
-	case lime: // lime
-#ifdef SERIAL_VERBOSE
-		Serial.println("lime");
-#endif
-		(*r) = 50; (*g) = 205; (*b) = 50;
-		break;
-	case orange: // orange
-#ifdef SERIAL_VERBOSE
-		Serial.println("orange");
-#endif
-		(*r) = 255; (*g) = 165; (*b) = 0;
-		break;
-	case powder_blue: // powder blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("powder blue");
-#endif
-		(*r) = 176; (*g) = 244; (*b) = 230;
-		break;
-	case purple: // purple
-#ifdef SERIAL_VERBOSE
-		Serial.println("purple");
-#endif
-		(*r) = 128; (*g) = 0; (*b) = 128;
-		break;
-	case teal: // teal
-#ifdef SERIAL_VERBOSE
-		Serial.println("teal");
-#endif
-		(*r) = 0; (*g) = 128; (*b) = 128;
-		break;
-	}
+	(*r) = pgm_read_byte(&paletteColours[color][0]);
+	(*g) = pgm_read_byte(&paletteColours[color][1]);
+	(*b) = pgm_read_byte(&paletteColours[color][2]);
 }
 
 void pickRandomColour(byte *r, byte *g, byte *b)
 {
-	switch (random(0, 13))
-	{
-	case 0: // red
-#ifdef SERIAL_VERBOSE
-		Serial.println("Red");
-#endif
-		(*r) = 255; (*g) = 0; (*b) = 0;
-		break;
-	case 1: // blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("Blue");
-#endif
-		(*r) = 0; (*g) = 0; (*b) = 255;
-		break;
-	case 2: // green
-#ifdef SERIAL_VERBOSE
-		Serial.println("Green");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 0;
-		break;
-	case 3: // lilac
-#ifdef SERIAL_VERBOSE
-		Serial.println("Lilac");
-#endif
-		(*r) = 220; (*g) = 208; (*b) = 255;
-		break;
-	case 4: // cyan
-#ifdef SERIAL_VERBOSE
-		Serial.println("cyan");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 255;
-		break;
-	case 5: // hot pink
-#ifdef SERIAL_VERBOSE
-		Serial.println("hot pink");
-#endif
-		(*r) = 255; (*g) = 105; (*b) = 180;
-		break;
-	case 6: // lavender
-#ifdef SERIAL_VERBOSE
-		Serial.println("lavender");
-#endif
-		(*r) = 230; (*g) = 230; (*b) = 250;
-		break;
-	case 7: // plum
-#ifdef SERIAL_VERBOSE
-		Serial.println("plum");
-#endif
-		(*r) = 221; (*g) = 160; (*b) = 221;
-		break;
-	case 8: // lime
-#ifdef SERIAL_VERBOSE
-		Serial.println("lime");
-#endif
-		(*r) = 50; (*g) = 205; (*b) = 50;
-		break;
-	case 9: // orange
-#ifdef SERIAL_VERBOSE
-		Serial.println("orange");
-#endif
-		(*r) = 255; (*g) = 165; (*b) = 0;
-		break;
-	case 10: // powder blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("powder blue");
-#endif
-		(*r) = 176; (*g) = 244; (*b) = 230;
-		break;
-	case 11: // purple
-#ifdef SERIAL_VERBOSE
-		Serial.println("purple");
-#endif
-		(*r) = 128; (*g) = 0; (*b) = 128;
-		break;
-	case 12: // teal
-#ifdef SERIAL_VERBOSE
-		Serial.println("teal");
-#endif
-		(*r) = 0; (*g) = 128; (*b) = 128;
-		break;
-	}
+	selectColour((lightColor)random(0, NO_OF_PALETTE_COLOURS), r, g, b);
 }
 
 
@@ -1137,12 +1007,246 @@ void updateLights()
 	renderLights();
 }
 
+// Keyframe animations
+// An animation is a list of frames. Each frame fades the lights picked by its mask
+// to a new colour over a number of ticks. The frames are played by updateAnimation()
+// from updateLightsAndDelay() so a running animation needs no script statements.
+// A frame with a mask of 0 just waits for its fade ticks. A frame with a fade of 0
+// sets its colour straight away and the next frame starts in the same tick.
+
+struct animationFrame {
+	byte r, g, b;
+	uint16_t lightMask;
+	byte fadeTicks;
+};
+
+#define ALL_LIGHTS 0x0FFF
+#define LEFT_LIGHTS 0x003F
+#define RIGHT_LIGHTS 0x0FC0
+#define EVEN_LIGHTS 0x0555
+#define ODD_LIGHTS 0x0AAA
+
+// 0 - breathe white
+const animationFrame breatheAnimation[] PROGMEM = {
+	{ 255, 255, 255, ALL_LIGHTS, 50 },
+	{ 0, 0, 0, ALL_LIGHTS, 50 } };
+
+// 1 - police lights
+const animationFrame policeAnimation[] PROGMEM = {
+	{ 255, 0, 0, LEFT_LIGHTS, 0 },
+	{ 0, 0, 0, RIGHT_LIGHTS, 0 },
+	{ 0, 0, 0, 0, 10 },
+	{ 0, 0, 0, LEFT_LIGHTS, 0 },
+	{ 0, 0, 255, RIGHT_LIGHTS, 0 },
+	{ 0, 0, 0, 0, 10 } };
+
+// 2 - green light chasing round the ring
+const animationFrame chaseAnimation[] PROGMEM = {
+	{ 0, 0, 0, ALL_LIGHTS, 0 },
+	{ 0, 255, 0, 0x0001, 4 }, { 0, 0, 0, 0x0001, 4 },
+	{ 0, 255, 0, 0x0002, 4 }, { 0, 0, 0, 0x0002, 4 },
+	{ 0, 255, 0, 0x0004, 4 }, { 0, 0, 0, 0x0004, 4 },
+	{ 0, 255, 0, 0x0008, 4 }, { 0, 0, 0, 0x0008, 4 },
+	{ 0, 255, 0, 0x0010, 4 }, { 0, 0, 0, 0x0010, 4 },
+	{ 0, 255, 0, 0x0020, 4 }, { 0, 0, 0, 0x0020, 4 },
+	{ 0, 255, 0, 0x0040, 4 }, { 0, 0, 0, 0x0040, 4 },
+	{ 0, 255, 0, 0x0080, 4 }, { 0, 0, 0, 0x0080, 4 },
+	{ 0, 255, 0, 0x0100, 4 }, { 0, 0, 0, 0x0100, 4 },
+	{ 0, 255, 0, 0x0200, 4 }, { 0, 0, 0, 0x0200, 4 },
+	{ 0, 255, 0, 0x0400, 4 }, { 0, 0, 0, 0x0400, 4 },
+	{ 0, 255, 0, 0x0800, 4 }, { 0, 0, 0, 0x0800, 4 } };
+
+// 3 - alternate lights twinkling between blue and purple
+const animationFrame twinkleAnimation[] PROGMEM = {
+	{ 0, 0, 255, EVEN_LIGHTS, 25 },
+	{ 128, 0, 128, ODD_LIGHTS, 25 },
+	{ 128, 0, 128, EVEN_LIGHTS, 25 },
+	{ 0, 0, 255, ODD_LIGHTS, 25 } };
+
+// 4 - traffic lights
+const animationFrame trafficAnimation[] PROGMEM = {
+	{ 255, 0, 0, ALL_LIGHTS, 0 },
+	{ 0, 0, 0, 0, 100 },
+	{ 255, 165, 0, ALL_LIGHTS, 0 },
+	{ 0, 0, 0, 0, 50 },
+	{ 0, 255, 0, ALL_LIGHTS, 0 },
+	{ 0, 0, 0, 0, 100 } };
+
+struct animation {
+	const animationFrame * frames;
+	byte noOfFrames;
+};
+
+#define ANIMATION_LENGTH(a) (sizeof(a) / sizeof(animationFrame))
+
+const animation animations[] PROGMEM = {
+	{ breatheAnimation, ANIMATION_LENGTH(breatheAnimation) },
+	{ policeAnimation, ANIMATION_LENGTH(policeAnimation) },
+	{ chaseAnimation, ANIMATION_LENGTH(chaseAnimation) },
+	{ twinkleAnimation, ANIMATION_LENGTH(twinkleAnimation) },
+	{ trafficAnimation, ANIMATION_LENGTH(trafficAnimation) } };
+
+#define NO_OF_ANIMATIONS (sizeof(animations) / sizeof(animation))
+
+// NULL when no animation is playing
+const animationFrame * animationFrames = NULL;
+
+byte animationLength;
+byte animationFrameNo;
+bool animationLoop;
+
+// The frame being played
+animationFrame currentAnimationFrame;
+byte animationTick;
+
+void stopAnimation()
+{
+	animationFrames = NULL;
+}
+
+// Starts animation number animationNo
+// Returns false if there is no animation with that number
+
+bool startAnimation(int animationNo, bool loop)
+{
+	if (animationNo < 0 | animationNo >= (int)NO_OF_ANIMATIONS)
+		return false;
+
+	animation a;
+	memcpy_P(&a, animations + animationNo, sizeof(animation));
+
+	animationFrames = a.frames;
+	animationLength = a.noOfFrames;
+	animationLoop = loop;
+	animationFrameNo = 0;
+	animationTick = 0;
+
+	return true;
+}
+
+// The lights in the mask are made steady and their current colour is saved
+// as the start of the fade. While a light is animated its Min values hold the
+// colour at the start of the fade and its Max values hold the target colour.
+
+void startAnimationFrame()
+{
+	memcpy_P(&currentAnimationFrame, animationFrames + animationFrameNo, sizeof(animationFrame));
+
+	for (byte i = 0; i < NO_OF_LIGHTS; i++)
+	{
+		if (currentAnimationFrame.lightMask & (1 << i))
+		{
+			struct Light * l = &lights[i];
+
+			if (l->lightState == lightStateOff)
+			{
+				l->r = 0;
+				l->g = 0;
+				l->b = 0;
+			}
+
+			steadyLight(i * NO_OF_GAPS, l);
+
+			l->rMin = l->r;
+			l->gMin = l->g;
+			l->bMin = l->b;
+			l->rMax = currentAnimationFrame.r;
+			l->gMax = currentAnimationFrame.g;
+			l->bMax = currentAnimationFrame.b;
+		}
+	}
+}
+
+inline byte fadeValue(byte start, byte end, byte tick, byte ticks)
+{
+	if (tick >= ticks)
+		return end;
+
+	return start + ((int)(end - start) * tick) / ticks;
+}
+
+// Moves on to the next frame
+// Returns false if the animation has finished
+
+bool nextAnimationFrame()
+{
+	animationTick = 0;
+	animationFrameNo++;
+
+	if (animationFrameNo < animationLength)
+		return true;
+
+	if (!animationLoop)
+	{
+		stopAnimation();
+		return false;
+	}
+
+	animationFrameNo = 0;
+	return true;
+}
+
+void updateAnimation()
+{
+	if (animationFrames == NULL)
+		return;
+
+	// Frames with no fade are all done in this tick - but don't go round
+	// a looping animation more than once
+	byte framesDone = 0;
+
+	while (true)
+	{
+		if (animationTick == 0)
+			startAnimationFrame();
+
+		animationTick++;
+
+		for (byte i = 0; i < NO_OF_LIGHTS; i++)
+		{
+			if (currentAnimationFrame.lightMask & (1 << i))
+			{
+				struct Light * l = &lights[i];
+				l->r = fadeValue(l->rMin, l->rMax, animationTick, currentAnimationFrame.fadeTicks);
+				l->g = fadeValue(l->gMin, l->gMax, animationTick, currentAnimationFrame.fadeTicks);
+				l->b = fadeValue(l->bMin, l->bMax, animationTick, currentAnimationFrame.fadeTicks);
+			}
+		}
+
+		if (currentAnimationFrame.lightMask != 0)
+			forceLightUpdate = true;
+
+		if (animationTick < currentAnimationFrame.fadeTicks)
+			return;
+
+		bool noFade = currentAnimationFrame.fadeTicks == 0;
+
+		if (!nextAnimationFrame())
+			return;
+
+		if (!noFade)
+			return;
+
+		framesDone++;
+
+		if (framesDone >= animationLength)
+			return;
+	}
+}
+
+bool animationPlaying()
+{
+	return animationFrames != NULL;
+}
+
 void updateLightsAndDelay(bool wantDelay)
 {
 	tickEnd = millis() + TICK_INTERVAL;
 
 	tickCount++;
 
+	updateAnimation();
+
 	updateLights();
 
 	if (transitionComplete())
@@ -1153,7 +1257,8 @@ void updateLightsAndDelay(bool wantDelay)
 
 	if (wantDelay)
 	{
-		while (millis() < tickEnd) {
+		// Compared as a difference so that the loop does not stall when millis() wraps
+		while ((int32_t)(millis() - tickEnd) < 0) {
 			delay(1);
 		}
 	}
@@ -45,11 +45,17 @@
 #define COMMAND_DURATION 38
 #define COMMAND_CONTINUE 39
 #define COMMAND_ANGLE 40
+#define COMMAND_GOTO 41
+#define COMMAND_ANIMATE 42
+#define COMMAND_PLAY 43
+#define COMMAND_DEF 44
+#define COMMAND_CALL 45
+#define COMMAND_ARRAY 46
 #define COMMAND_SYSTEM_COMMAND 100
 #define COMMAND_EMPTY_LINE 101
 
-// command numbers:                    0    1     2     3   4    5     6     7      8    9  10 11  12    13     14     15      16      17    18    19    20     21      22   23   24   25    26    27      28   29    30    31   32    33   34   35    36     37    38        39       40
-const char commandNames[] PROGMEM = "angry#happy#move#turn#arc#delay#colour#color#pixel#set#if#do#while#intime#endif#forever#endwhile#sound#until#clear#run#background#else#red#green#blue#yellow#magenta#cyan#white#black#wait#stop#begin#end#print#println#break#duration#continue#angle#"; // don't forget the # on the end
+// command numbers:                    0    1     2     3   4    5     6     7      8    9  10 11  12    13     14     15      16      17    18    19    20     21      22   23   24   25    26    27      28   29    30    31   32    33   34   35    36     37    38        39       40    41   42      43     44  45   46
+const char commandNames[] PROGMEM = "angry#happy#move#turn#arc#delay#colour#color#pixel#set#if#do#while#intime#endif#forever#endwhile#sound#until#clear#run#background#else#red#green#blue#yellow#magenta#cyan#white#black#wait#stop#begin#end#print#println#break#duration#continue#angle#goto#animate#play#def#call#array#"; // don't forget the # on the end
 
 #define SCRIPT_INPUT_BUFFER_LENGTH 80
 
@@ -165,7 +171,7 @@ void writeBytesFromBuffer(int length)
 	}
 }
 
-void writeMatchingStringFromBuffer(char * string)
+void writeMatchingStringFromBuffer(const char * string)
 {
 	while (*string)
 	{
@@ -260,8 +266,6 @@ int decodeCommandName()
 
 	while (true)
 	{
-		char * nameStart = bufferPos;
-
 		ScriptCompareCommandResult result = compareCommand();
 
 		switch (result)
@@ -327,6 +331,39 @@ void dumpByte(byte b)
 #endif
 
 
+int processSingleValue();
+
+// Copies an array index in square brackets into the instruction
+// Does nothing if the input is not at a [
+
+int processArrayIndex()
+{
+	if (*bufferPos != '[')
+	{
+		return ERROR_OK;
+	}
+
+	outputFunction('[');
+	bufferPos++;
+
+	int result = processSingleValue();
+
+	if (result != ERROR_OK)
+		return result;
+
+	skipInputSpaces();
+
+	if (*bufferPos != ']')
+	{
+		return ERROR_MISSING_CLOSE_BRACKET_IN_INDEX;
+	}
+
+	outputFunction(']');
+	bufferPos++;
+
+	return ERROR_OK;
+}
+
 int processSingleValue()
 {
 	skipInputSpaces();
@@ -350,7 +387,7 @@ int processSingleValue()
 			outputFunction(*bufferPos);
 			bufferPos++;
 		}
-		return ERROR_OK;
+		return processArrayIndex();
 	}
 
 	if (isdigit(*bufferPos) | (*bufferPos == '+') | (*bufferPos == '-'))
@@ -409,10 +446,114 @@ int processSingleValue()
 		}
 		return ERROR_OK;
 	}
+
+	return ERROR_INVALID_VALUE;
+}
+
+// Reads a number from the script text at pos without compiling it
+// Returns false if pos is not at a number
+
+bool scanLiteral(char ** pos, scriptValue * result)
+{
+	char * scanPos = *pos;
+	int sign = 1;
+
+	if (*scanPos == '-')
+	{
+		sign = -1;
+		scanPos++;
+	}
+	else if (*scanPos == '+')
+	{
+		scanPos++;
+	}
+
+	if (!isdigit(*scanPos))
+		return false;
+
+	scriptValue value = 0;
+
+	while (isdigit(*scanPos))
+	{
+		value = (value * 10) + (*scanPos - '0');
+		scanPos++;
+	}
+
+	*result = value * sign;
+	*pos = scanPos;
+	return true;
+}
+
+// Outputs a value as decimal digits, most significant first
+
+void outputDigits(uint32_t value)
+{
+	if (value >= 10)
+		outputDigits(value / 10);
+
+	outputFunction('0' + value % 10);
+}
+
+void outputScriptValue(scriptValue value)
+{
+	if (value < 0)
+	{
+		outputFunction('-');
+		outputDigits(-(uint32_t)(int32_t)value);
+	}
+	else
+	{
+		outputDigits(value);
+	}
+}
+
+// An expression made of two numbers, such as 2 * 50, is worked out
+// when it is compiled and only the result is stored in the program.
+// Division by zero is left for the program to find when it runs.
+// Returns false, leaving bufferPos where it was, if the value can't be folded
+
+bool foldConstantValue()
+{
+	char * pos = bufferPos;
+	scriptValue firstOperand;
+	scriptValue secondOperand;
+
+	if (!scanLiteral(&pos, &firstOperand))
+		return false;
+
+	while (*pos == ' ')
+		pos++;
+
+	op * foldOperator = findOperator(*pos);
+
+	if (foldOperator == NULL)
+		return false;
+
+	pos++;
+
+	while (*pos == ' ')
+		pos++;
+
+	if (!scanLiteral(&pos, &secondOperand))
+		return false;
+
+	if (secondOperand == 0 & (foldOperator == &divideOp | foldOperator == &modulusOp))
+		return false;
+
+	outputScriptValue(foldOperator->evaluator(firstOperand, secondOperand));
+
+	bufferPos = pos;
+
+	return true;
 }
 
 int processValue()
 {
+	skipInputSpaces();
+
+	if (foldConstantValue())
+		return ERROR_OK;
+
 	int result = processSingleValue();
 
 	if (result != ERROR_OK)
@@ -443,7 +584,7 @@ int processValue()
 	return ERROR_OK;
 }
 
-void sendCommand(const PROGMEM byte *command)
+void sendCommand(const char * command)
 {
 	int pos = 0;
 
@@ -459,6 +600,17 @@ void sendCommand(const PROGMEM byte *command)
 	}
 }
 
+// Outputs a value as decimal digits, most significant first
+
+void outputByteValue(byte value)
+{
+	if (value >= 100)
+		outputFunction('0' + value / 100);
+	if (value >= 10)
+		outputFunction('0' + (value / 10) % 10);
+	outputFunction('0' + value % 10);
+}
+
 void endCommand()
 {
 	outputFunction(STATEMENT_TERMINATOR);
@@ -644,6 +796,59 @@ int compileArc()
 	return handleValueIntimeAndBackground();
 }
 
+const char gotoCommand[] PROGMEM = "MG";
+
+// goto x, y - drive to the point x mm right and y mm ahead of the start position
+
+int compileGoto()
+{
+#ifdef SCRIPT_DEBUG
+	Serial.print(F("Compiling goto: "));
+#endif // SCRIPT_DEBUG
+
+	// Not allowed to indent after a goto
+	previousStatementStartedBlock = false;
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_NO_X_IN_GOTO;
+	}
+
+	sendCommand(gotoCommand);
+
+	int result = processValue();
+
+	if (result != ERROR_OK)
+		return result;
+
+	skipInputSpaces();
+
+	if (*bufferPos != ',')
+	{
+		return ERROR_NO_Y_IN_GOTO;
+	}
+
+	outputFunction(',');
+
+	bufferPos++;
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_NO_Y_IN_GOTO;
+	}
+
+	result = processValue();
+
+	if (result != ERROR_OK)
+		return result;
+
+	return handleInTime();
+}
+
 const char delayCommand[] PROGMEM = "CD";
 
 int compileDelay()
@@ -686,6 +891,43 @@ int compileColour()
 
 	sendCommand(colourCommand);
 
+	// A colour name (colour magenta) is resolved here so that the
+	// program contains the constant red, green and blue values. Anything
+	// with a comma in it is a list of three values.
+
+	if (isalpha(*bufferPos) && strchr(bufferPos, ',') == NULL)
+	{
+		char name[MAX_COLOUR_NAME_LENGTH + 1];
+		byte nameLength = 0;
+
+		while (*bufferPos != 0)
+		{
+			if (nameLength == MAX_COLOUR_NAME_LENGTH)
+			{
+				return ERROR_UNKNOWN_COLOUR_NAME;
+			}
+			name[nameLength++] = *bufferPos++;
+		}
+		name[nameLength] = 0;
+
+		normaliseColourName(name);
+
+		byte r, g, b;
+
+		if (!findNamedColour(name, &r, &g, &b))
+		{
+			return ERROR_UNKNOWN_COLOUR_NAME;
+		}
+
+		outputByteValue(r);
+		outputFunction(',');
+		outputByteValue(g);
+		outputFunction(',');
+		outputByteValue(b);
+
+		return ERROR_OK;
+	}
+
 	int result = processValue();
 
 	if (result != ERROR_OK)
@@ -780,6 +1022,110 @@ int compilePixel()
 	return ERROR_NOT_IMPLEMENTED;
 }
 
+const char animateCommand[] PROGMEM = "PK";
+const char animateLoopOption[] PROGMEM = ",1";
+
+// animate n         - play light animation n once
+// animate n forever - play light animation n over and over
+// animate stop      - stop the animation
+
+int compileAnimate()
+{
+#ifdef SCRIPT_DEBUG
+	Serial.print(F("Compiling animate: "));
+#endif // SCRIPT_DEBUG
+
+	// Not allowed to indent after an animate
+	previousStatementStartedBlock = false;
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_MISSING_VALUE_IN_ANIMATE;
+	}
+
+	sendCommand(animateCommand);
+
+	if (decodeCommandName() == COMMAND_STOP)
+	{
+		return ERROR_OK;
+	}
+
+	int result = processValue();
+
+	if (result != ERROR_OK)
+		return result;
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_OK;
+	}
+
+	if (decodeCommandName() != COMMAND_FOREVER)
+	{
+		return ERROR_INVALID_OPTION_IN_ANIMATE;
+	}
+
+	sendCommand(animateLoopOption);
+
+	return ERROR_OK;
+}
+
+const char playCommand[] PROGMEM = "SP";
+
+// play n         - play tune n in the background
+// play n forever - play tune n over and over
+// play stop      - stop the tune
+
+int compilePlay()
+{
+#ifdef SCRIPT_DEBUG
+	Serial.print(F("Compiling play: "));
+#endif // SCRIPT_DEBUG
+
+	// Not allowed to indent after a play
+	previousStatementStartedBlock = false;
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_MISSING_VALUE_IN_PLAY;
+	}
+
+	sendCommand(playCommand);
+
+	if (decodeCommandName() == COMMAND_STOP)
+	{
+		return ERROR_OK;
+	}
+
+	int result = processValue();
+
+	if (result != ERROR_OK)
+		return result;
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_OK;
+	}
+
+	if (decodeCommandName() != COMMAND_FOREVER)
+	{
+		return ERROR_INVALID_OPTION_IN_PLAY;
+	}
+
+	// same loop option as animate
+	sendCommand(animateLoopOption);
+
+	return ERROR_OK;
+}
+
 const char soundCommand[] PROGMEM = "ST";
 const char defaultSoundDuration[] PROGMEM = "500";
 
@@ -904,6 +1250,11 @@ int compileAssignment()
 
 	writeBytesFromBuffer(getVariableNameLength(position));
 
+	int result = processArrayIndex();
+
+	if (result != ERROR_OK)
+		return result;
+
 	skipInputSpaces();
 
 	if (*bufferPos != '=')
@@ -919,10 +1270,57 @@ int compileAssignment()
 	return processValue();
 }
 
+const char arrayCommand[] PROGMEM = "VA";
+
+// array name length - declare an array of length elements, all zero
+// Elements are used as name[index], with the first element at index 0
+
+int compileArray()
+{
+#ifdef SCRIPT_DEBUG
+	Serial.print(F("Compiling array: "));
+#endif // SCRIPT_DEBUG
+
+	// Not allowed to indent after an array
+	previousStatementStartedBlock = false;
+
+	skipInputSpaces();
+
+	if (checkIdentifier(bufferPos) != VARIABLE_NAME_OK)
+		return ERROR_INVALID_ARRAY_NAME;
+
+	int position;
+
+	if (findVariable(bufferPos, &position) == VARIABLE_NOT_FOUND)
+	{
+		if (createVariable(bufferPos, &position) == NO_ROOM_FOR_VARIABLE)
+		{
+			return ERROR_TOO_MANY_VARIABLES;
+		}
+	}
+
+	sendCommand(arrayCommand);
+
+	writeBytesFromBuffer(getVariableNameLength(position));
+
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_MISSING_LENGTH_IN_ARRAY;
+	}
+
+	outputFunction(',');
+
+	return processValue();
+}
+
 struct stackItem {
 	byte constructionType;
 	int count;
 	byte indentLevel;
+	// set when a break jumps to the label after a loop
+	bool exitLabelUsed;
 };
 
 #define STACK_SIZE 10
@@ -935,9 +1333,24 @@ int operationStackPointer;
 #define IF_CONSTRUCTION_STACK_ITEM 1
 #define WHILE_CONSTRUCTION_STACK_ITEM 3
 #define FOREVER_CONSTRUCTION_STACK_ITEM 4
+#define DEF_CONSTRUCTION_STACK_ITEM 5
 
 int labelCounter;
 
+// Subroutine names seen so far in the program being compiled. The position
+// of a name in the table is the number of the subroutine in the program.
+// Names are only stored while the program is being compiled.
+
+#define MAX_SUBROUTINE_NAME_LENGTH 8
+
+// not zero terminated if the name fills the space
+char subroutineNames[MAX_SUBROUTINES][MAX_SUBROUTINE_NAME_LENGTH];
+byte noOfSubroutines;
+
+// Bit set for each subroutine that has a def, one bit for each of
+// the MAX_SUBROUTINES
+byte subroutinesDefined;
+
 void dropValue(int value)
 {
 	while (true)
@@ -960,6 +1373,7 @@ void push_operation(byte type, byte count)
 	operation[operationStackPointer].constructionType = type;
 	operation[operationStackPointer].count = count;
 	operation[operationStackPointer].indentLevel = currentIndentLevel;
+	operation[operationStackPointer].exitLabelUsed = false;
 	operationStackPointer++;
 }
 
@@ -997,6 +1411,11 @@ byte top_operation_indent_level()
 	return operation[operationStackPointer - 1].indentLevel;
 }
 
+bool top_operation_exit_label_used()
+{
+	return operation[operationStackPointer - 1].exitLabelUsed;
+}
+
 // Get the top value on the operation stack
 int pop_operation_count()
 {
@@ -1045,16 +1464,23 @@ void resetScriptLine()
 	scriptInputBufferPos = 0;
 }
 
+// The peephole optimiser, see peepholeOutput
+void resetPeephole();
+void storeHeldLabels(bool all);
+
 void beginCompilingStatements()
 {
 	currentIndentLevel = 0;
 	previousStatementStartedBlock = false;
 	operationStackPointer = 0;
 	labelCounter = 0;
+	noOfSubroutines = 0;
+	subroutinesDefined = 0;
 	resetScriptLine();
 	scriptLineNumber = 1; // start at the first line
 	programError = false; // indicate that no errors were detected
 	compilingProgram = true; // indicate that we are compiling a program
+	resetPeephole();
 }
 
 
@@ -1064,6 +1490,23 @@ const char failedCommandText[] PROGMEM = "RA";
 
 void endCompilingStatements()
 {
+	// Any labels held back go before the end of the program
+	storeHeldLabels(true);
+
+	for (byte i = 0; i < noOfSubroutines; i++)
+	{
+		if (!(subroutinesDefined & (1 << i)))
+		{
+			Serial.print("Error: ");
+			Serial.print(ERROR_SUBROUTINE_NOT_DEFINED);
+			Serial.print(" ");
+			for (byte j = 0; j < MAX_SUBROUTINE_NAME_LENGTH && subroutineNames[i][j]; j++)
+				Serial.print(subroutineNames[i][j]);
+			Serial.println();
+			programError = true;
+		}
+	}
+
 	if (programError)
 	{
 		sendCommand(failedCommandText);
@@ -1236,7 +1679,7 @@ int compileForever()
 
 #define NO_LABEL_FOR_LOOP_ON_STACK -1
 
-int findTopLoopConstructionLabel()
+int findTopLoopConstruction()
 {
 	// Start the search at the top of the stack
 	// Rememver that
@@ -1254,8 +1697,8 @@ int findTopLoopConstructionLabel()
 		if ((constructionType == WHILE_CONSTRUCTION_STACK_ITEM) || (constructionType == FOREVER_CONSTRUCTION_STACK_ITEM))
 		{
 			// found a loop construction
-			// return the label from that loop
-			return operation[searchStackPointer].count;
+			// return its position on the stack
+			return searchStackPointer;
 		}
 	}
 
@@ -1280,15 +1723,17 @@ int compileBreak()
 		return ERROR_BREAK_CANNOT_BE_USED_OUTSIDE_A_PROGRAM;
 	}
 
-	int operation_label = findTopLoopConstructionLabel();
+	int loopPos = findTopLoopConstruction();
 
-	if (operation_label == NO_LABEL_FOR_LOOP_ON_STACK)
+	if (loopPos == NO_LABEL_FOR_LOOP_ON_STACK)
 		return ERROR_NO_LABEL_FOR_LOOP_ON_STACK_IN_BREAK;
 
 	// first label value is the jump for the loop repeat
 	// next label value is the label after the end of the loop
 
-	dropJump(operation_label + 1);
+	operation[loopPos].exitLabelUsed = true;
+
+	dropJump(operation[loopPos].count + 1);
 	return ERROR_OK;
 }
 
@@ -1308,18 +1753,149 @@ int compileContinue()
 		return ERROR_CONTINUE_CANNOT_BE_USED_OUTSIDE_A_PROGRAM;
 	}
 
-	int operation_label = findTopLoopConstructionLabel();
+	int loopPos = findTopLoopConstruction();
 
-	if (operation_label == NO_LABEL_FOR_LOOP_ON_STACK)
+	if (loopPos == NO_LABEL_FOR_LOOP_ON_STACK)
 		return ERROR_NO_LABEL_FOR_LOOP_ON_STACK_IN_CONTINUE;
 
 	// first label value is the jump for the loop repeat
 
-	dropJump(operation_label);
+	dropJump(operation[loopPos].count);
+
+	return ERROR_OK;
+}
+
+
+// Reads the subroutine name at bufferPos and finds its number, giving it
+// a new number if it has not been seen before
+
+int getSubroutineNo(byte * result)
+{
+	skipInputSpaces();
+
+	if (!isVariableNameStart(bufferPos))
+	{
+		return ERROR_INVALID_SUBROUTINE_NAME;
+	}
+
+	char name[MAX_SUBROUTINE_NAME_LENGTH];
+
+	memset(name, 0, MAX_SUBROUTINE_NAME_LENGTH);
+
+	byte length = 0;
+
+	while (isVariableNameChar(bufferPos))
+	{
+		if (length == MAX_SUBROUTINE_NAME_LENGTH)
+		{
+			return ERROR_SUBROUTINE_NAME_TOO_LONG;
+		}
+
+		name[length++] = *bufferPos;
+		bufferPos++;
+	}
+
+	for (byte i = 0; i < noOfSubroutines; i++)
+	{
+		if (memcmp(subroutineNames[i], name, MAX_SUBROUTINE_NAME_LENGTH) == 0)
+		{
+			*result = i;
+			return ERROR_OK;
+		}
+	}
+
+	if (noOfSubroutines == MAX_SUBROUTINES)
+	{
+		return ERROR_TOO_MANY_SUBROUTINES;
+	}
+
+	memcpy(subroutineNames[noOfSubroutines], name, MAX_SUBROUTINE_NAME_LENGTH);
+	*result = noOfSubroutines++;
+	return ERROR_OK;
+}
+
+const char subroutineEntryCommand[] PROGMEM = "CE";
+
+// def name - the indented statements that follow are subroutine name
+// The subroutine is skipped over when the program runs into it and
+// ends with a return
+
+int compileDef()
+{
+#ifdef SCRIPT_DEBUG
+	Serial.print(F("Compiling def: "));
+#endif // SCRIPT_DEBUG
+
+	if (!compilingProgram)
+	{
+		return ERROR_DEF_CANNOT_BE_USED_OUTSIDE_A_PROGRAM;
+	}
+
+	if (!operation_stack_empty())
+	{
+		return ERROR_DEF_CANNOT_BE_INSIDE_ANOTHER_STATEMENT;
+	}
+
+	byte subroutineNo;
+
+	int result = getSubroutineNo(&subroutineNo);
+
+	if (result != ERROR_OK)
+		return result;
+
+	if (subroutinesDefined & (1 << subroutineNo))
+	{
+		return ERROR_SUBROUTINE_ALREADY_DEFINED;
+	}
+
+	subroutinesDefined |= (1 << subroutineNo);
+
+	// jump past the subroutine to the label dropped when it ends
+
+	labelCounter++;
+
+	push_operation(DEF_CONSTRUCTION_STACK_ITEM, labelCounter);
+
+	dropJumpCommand(labelCounter);
+
+	sendCommand(subroutineEntryCommand);
+	dropValue(subroutineNo);
+
+	previousStatementStartedBlock = true;
+
+	return ERROR_OK;
+}
+
+const char callCommand[] PROGMEM = "CP";
+
+int compileCall()
+{
+#ifdef SCRIPT_DEBUG
+	Serial.print(F("Compiling call: "));
+#endif // SCRIPT_DEBUG
+
+	// Not allowed to indent after a call
+	previousStatementStartedBlock = false;
+
+	if (!compilingProgram)
+	{
+		return ERROR_CALL_CANNOT_BE_USED_OUTSIDE_A_PROGRAM;
+	}
+
+	byte subroutineNo;
+
+	int result = getSubroutineNo(&subroutineNo);
+
+	if (result != ERROR_OK)
+		return result;
+
+	sendCommand(callCommand);
+	dropValue(subroutineNo);
 
 	return ERROR_OK;
 }
 
+const char returnCommand[] PROGMEM = "CR";
 
 /// Program control commands - not part of the script
 //
@@ -1343,6 +1919,20 @@ int clearProgram()
 	return ERROR_OK;
 }
 
+// Adds the optional program slot number after begin or run
+
+int compileProgramSlotNo()
+{
+	skipInputSpaces();
+
+	if (*bufferPos == 0)
+	{
+		return ERROR_OK;
+	}
+
+	return processValue();
+}
+
 const char runCommand[] PROGMEM = "RS";
 
 int runProgram()
@@ -1358,7 +1948,7 @@ int runProgram()
 
 	sendCommand(runCommand);
 
-	return ERROR_OK;
+	return compileProgramSlotNo();
 }
 
 const char waitCommand[] PROGMEM = "CA";
@@ -1390,7 +1980,6 @@ int compileStop()
 	return ERROR_OK;
 }
 
-const char clearCommand[] PROGMEM = "RC";
 const char beginCommand[] PROGMEM = "RM";
 
 int compileBegin()
@@ -1404,10 +1993,8 @@ int compileBegin()
 	}
 
 	beginCompilingStatements();
-	sendCommand(clearCommand);
-	endCommand();
 	sendCommand(beginCommand);
-	return ERROR_OK;
+	return compileProgramSlotNo();
 }
 
 int compileEnd()
@@ -1520,6 +2107,24 @@ int processCommand(byte commandNo)
 	case COMMAND_ARC:// arc
 		return compileArc();
 
+	case COMMAND_GOTO:// goto
+		return compileGoto();
+
+	case COMMAND_ANIMATE:// animate
+		return compileAnimate();
+
+	case COMMAND_PLAY:// play
+		return compilePlay();
+
+	case COMMAND_DEF:// def
+		return compileDef();
+
+	case COMMAND_CALL:// call
+		return compileCall();
+
+	case COMMAND_ARRAY:// array
+		return compileArray();
+
 	case COMMAND_DELAY:// delay
 		return compileDelay();
 
@@ -1615,6 +2220,7 @@ int indentOutToNewIndentLevel(byte indent, int commandNo)
 {
 	int result;
 	int labelNo;
+	bool exitLabelUsed;
 
 #ifdef SCRIPT_DEBUG_INDENT_OUT
 	Serial.println("Indent out to new indent level");
@@ -1684,6 +2290,13 @@ int indentOutToNewIndentLevel(byte indent, int commandNo)
 
 					labelNo = pop_operation_count();
 
+					// Now need to push a label number for the endif to use
+					// to create the destination label for the jump past the 
+					// else code. This is done first so that the jump below
+					// is seen to go to a label still to come.
+
+					push_operation(IF_CONSTRUCTION_STACK_ITEM, labelNo + 1);
+
 					// drop a jump to the next label number
 					// this number was reserved when the if was created
 					// this is the position which will mark the end of the 
@@ -1697,12 +2310,6 @@ int indentOutToNewIndentLevel(byte indent, int commandNo)
 
 					dropLabel(labelNo);  // drop the label that is jumped
 
-												  // Now need to push a label number for the endif to use
-												  // to create the destination label for the jump past the 
-												  // else code
-
-					push_operation(IF_CONSTRUCTION_STACK_ITEM, labelNo + 1);
-
 					// Allow statements after this one to indent
 					previousStatementStartedBlock = true;
 				}
@@ -1726,11 +2333,26 @@ int indentOutToNewIndentLevel(byte indent, int commandNo)
 
 			case FOREVER_CONSTRUCTION_STACK_ITEM:
 
+				// The only way out of a forever loop is a break, so the
+				// label after the loop is left out if there are none
+				exitLabelUsed = top_operation_exit_label_used();
+
 				labelNo = pop_operation_count();
 
 				dropJumpCommand(labelNo);
 
-				dropLabelStatement(labelNo + 1);
+				if (exitLabelUsed)
+					dropLabelStatement(labelNo + 1);
+				break;
+
+			case DEF_CONSTRUCTION_STACK_ITEM:
+
+				labelNo = pop_operation_count();
+
+				sendCommand(returnCommand);
+				endCommand();
+
+				dropLabelStatement(labelNo);
 				break;
 
 			default:
@@ -1754,6 +2376,253 @@ int indentOutToNewIndentLevel(byte indent, int commandNo)
 
 }
 
+// Peephole optimisation of compiled programs
+// Each statement is held back until it is clear what it is. Waits, labels
+// and jumps are short, so a statement too long to be one of them is passed
+// on as soon as that is clear.
+//
+// A wait (CA) statement straight after another one does nothing, as the
+// motors have already stopped. This happens when a wait follows a move or
+// turn, which always waits for itself, and the repeated wait is left out.
+//
+// Jumps are threaded here rather than when the program runs. Labels that
+// come together are stored as one label statement, such as CLl8,l6. A
+// label followed by a jump to a label still to come only leads on to that
+// label, so it is held back and stored with it. A jump then takes a single
+// label lookup to get where it is going.
+
+#define PEEPHOLE_BUFFER_LENGTH 6
+#define MAX_HELD_LABELS 8
+
+void(*peepholeDestination) (byte);
+
+char peepholeBuffer[PEEPHOLE_BUFFER_LENGTH];
+byte peepholeLength;
+// set when the statement is too long to hold back
+bool peepholePassing;
+// The RM statement at the start of each program clears this
+bool peepholeAfterWait;
+
+// Labels held back, and the label each one leads on to, or 0 if it is
+// stored with the next statement
+byte heldLabels[MAX_HELD_LABELS];
+byte heldLabelTargets[MAX_HELD_LABELS];
+byte noOfHeldLabels;
+
+void resetPeephole()
+{
+	peepholeLength = 0;
+	peepholePassing = false;
+	peepholeAfterWait = false;
+	noOfHeldLabels = 0;
+}
+
+// Returns the label number in a compiled label or jump statement held in
+// the buffer, or 0 if it isn't one. Label numbers are written least
+// significant digit first, see dropValue.
+
+int peepholeLabelNo(char commandCh)
+{
+	if (peepholeLength < 4 | peepholeBuffer[0] != 'C' | peepholeBuffer[1] != commandCh |
+		peepholeBuffer[2] != 'l')
+		return 0;
+
+	int labelNo = 0;
+	int scale = 1;
+
+	for (byte i = 3; i < peepholeLength; i++)
+	{
+		if (!isdigit(peepholeBuffer[i]))
+			return 0;
+
+		labelNo += (peepholeBuffer[i] - '0') * scale;
+		scale *= 10;
+	}
+
+	if (labelNo > 255)
+		return 0;
+
+	return labelNo;
+}
+
+// True if the label will be dropped by a construction that is still open
+// The label at the top of a loop has already been dropped.
+
+bool labelStillToCome(int labelNo)
+{
+	for (byte i = 0; i < operationStackPointer; i++)
+	{
+		byte constructionType = operation[i].constructionType;
+		int count = operation[i].count;
+
+		if ((constructionType == WHILE_CONSTRUCTION_STACK_ITEM) || (constructionType == FOREVER_CONSTRUCTION_STACK_ITEM))
+			count++;
+
+		if (labelNo == count)
+			return true;
+	}
+
+	return false;
+}
+
+void storeLabelName(byte labelNo)
+{
+	peepholeDestination('l');
+
+	while (true)
+	{
+		peepholeDestination('0' + (labelNo % 10));
+		labelNo = labelNo / 10;
+		if (labelNo == 0)
+			break;
+	}
+}
+
+// Stores the held labels as one label statement, leaving any that lead on
+// to a label still to come unless all of them are to be stored
+
+void storeHeldLabels(bool all)
+{
+	byte kept = 0;
+	bool stored = false;
+
+	for (byte i = 0; i < noOfHeldLabels; i++)
+	{
+		if (heldLabelTargets[i] != 0 & !all)
+		{
+			heldLabels[kept] = heldLabels[i];
+			heldLabelTargets[kept] = heldLabelTargets[i];
+			kept++;
+			continue;
+		}
+
+		if (stored)
+		{
+			peepholeDestination(',');
+		}
+		else
+		{
+			peepholeDestination('C');
+			peepholeDestination('L');
+		}
+
+		storeLabelName(heldLabels[i]);
+		stored = true;
+	}
+
+	if (stored)
+	{
+		peepholeDestination(STATEMENT_TERMINATOR);
+		peepholeAfterWait = false;
+	}
+
+	noOfHeldLabels = kept;
+}
+
+void holdLabel(byte labelNo)
+{
+	// labels that lead on to this one are now in the same place
+	for (byte i = 0; i < noOfHeldLabels; i++)
+	{
+		if (heldLabelTargets[i] == labelNo)
+			heldLabelTargets[i] = 0;
+	}
+
+	if (noOfHeldLabels == MAX_HELD_LABELS)
+		storeHeldLabels(false);
+
+	if (noOfHeldLabels == MAX_HELD_LABELS)
+	{
+		// all of them are waiting for other labels, so store this one now
+		peepholeDestination('C');
+		peepholeDestination('L');
+		storeLabelName(labelNo);
+		peepholeDestination(STATEMENT_TERMINATOR);
+		peepholeAfterWait = false;
+		return;
+	}
+
+	heldLabels[noOfHeldLabels] = labelNo;
+	heldLabelTargets[noOfHeldLabels] = 0;
+	noOfHeldLabels++;
+}
+
+void peepholeStatementEnd()
+{
+	int labelNo = peepholeLabelNo('L');
+
+	if (labelNo != 0)
+	{
+		holdLabel(labelNo);
+		return;
+	}
+
+	labelNo = peepholeLabelNo('J');
+
+	if (labelNo != 0 && labelStillToCome(labelNo))
+	{
+		for (byte i = 0; i < noOfHeldLabels; i++)
+		{
+			if (heldLabelTargets[i] == 0)
+				heldLabelTargets[i] = labelNo;
+		}
+	}
+
+	storeHeldLabels(false);
+
+	bool isWait = (peepholeLength == 2) & (peepholeBuffer[0] == 'C') & (peepholeBuffer[1] == 'A');
+
+	if (!(isWait & peepholeAfterWait))
+	{
+		for (byte i = 0; i < peepholeLength; i++)
+			peepholeDestination(peepholeBuffer[i]);
+		peepholeDestination(STATEMENT_TERMINATOR);
+	}
+
+	peepholeAfterWait = isWait;
+}
+
+void peepholeOutput(byte b)
+{
+	// The end of a program is stored as it arrives
+	if (!compilingProgram & peepholeLength == 0)
+	{
+		peepholeDestination(b);
+		return;
+	}
+
+	if (peepholePassing)
+	{
+		peepholeDestination(b);
+		peepholePassing = (b != STATEMENT_TERMINATOR);
+		return;
+	}
+
+	if (b == STATEMENT_TERMINATOR)
+	{
+		peepholeStatementEnd();
+		peepholeLength = 0;
+		return;
+	}
+
+	if (peepholeLength == PEEPHOLE_BUFFER_LENGTH)
+	{
+		// too long to be a wait, a label or a jump
+		storeHeldLabels(false);
+		peepholeAfterWait = false;
+
+		for (byte i = 0; i < peepholeLength; i++)
+			peepholeDestination(peepholeBuffer[i]);
+		peepholeDestination(b);
+
+		peepholeLength = 0;
+		peepholePassing = true;
+		return;
+	}
+
+	peepholeBuffer[peepholeLength++] = b;
+}
+
 int decodeScriptLine(char * input, void(*output) (byte))
 {
 
@@ -1761,7 +2630,9 @@ int decodeScriptLine(char * input, void(*output) (byte))
 	bufferPos = input;
 
 	// Set the output function to point to the statement being output
-	outputFunction = output;
+	// Everything goes through the peephole optimiser on the way
+	peepholeDestination = output;
+	outputFunction = peepholeOutput;
 
 	int result;
 
@@ -9,7 +9,170 @@ void setupSound()
   noTone(A0);
 }
 
-void playTone(int frequency, unsigned long duration)
+void stopTune();
+
+void playTone(int frequency, uint32_t duration)
 {
+  // A single tone replaces any tune that is playing
+  stopTune();
   tone(A0, frequency, duration);
 }
+
+// Note sequencer
+// A tune is a list of notes held in PROGMEM. updateTune() is called from the main
+// loop and starts each note when the previous one has finished, so the program keeps
+// running while the tune plays. tone() does the actual sound generation in the background.
+// Pitches are MIDI note numbers (60 is middle C) and times are in TUNE_TICK_MILLIS units.
+
+//#define TUNE_DEBUG
+
+#define TUNE_TICK_MILLIS 10
+
+// A note with this pitch is silent for its duration
+#define TUNE_REST 0
+
+struct tuneNote {
+  byte pitch;
+  byte duration;
+  byte rest;
+};
+
+// Frequencies of the notes in the octave starting at MIDI note 108 (C8).
+// Lower octaves are found by halving.
+const uint16_t topOctaveFrequencies[] PROGMEM = {
+  4186, 4435, 4699, 4978, 5274, 5588, 5920, 6272, 6645, 7040, 7459, 7902 };
+
+#define TOP_OCTAVE 9
+#define HIGHEST_TUNE_PITCH 119
+
+unsigned int noteFrequency(byte pitch)
+{
+  return pgm_read_word(&topOctaveFrequencies[pitch % 12]) >> (TOP_OCTAVE - pitch / 12);
+}
+
+// 0 - rising scale
+const tuneNote scaleTune[] PROGMEM = {
+  { 60, 20, 5 }, { 62, 20, 5 }, { 64, 20, 5 }, { 65, 20, 5 },
+  { 67, 20, 5 }, { 69, 20, 5 }, { 71, 20, 5 }, { 72, 40, 5 } };
+
+// 1 - happy
+const tuneNote happyTune[] PROGMEM = {
+  { 72, 12, 3 }, { 76, 12, 3 }, { 79, 12, 3 }, { 84, 30, 5 } };
+
+// 2 - sad
+const tuneNote sadTune[] PROGMEM = {
+  { 67, 40, 10 }, { 66, 40, 10 }, { 65, 40, 10 }, { 64, 90, 10 } };
+
+// 3 - charge
+const tuneNote chargeTune[] PROGMEM = {
+  { 67, 15, 2 }, { 72, 15, 2 }, { 76, 15, 2 }, { 79, 25, 5 },
+  { 76, 10, 2 }, { 79, 50, 5 } };
+
+// 4 - twinkle twinkle
+const tuneNote twinkleTune[] PROGMEM = {
+  { 60, 25, 5 }, { 60, 25, 5 }, { 67, 25, 5 }, { 67, 25, 5 },
+  { 69, 25, 5 }, { 69, 25, 5 }, { 67, 50, 10 },
+  { 65, 25, 5 }, { 65, 25, 5 }, { 64, 25, 5 }, { 64, 25, 5 },
+  { 62, 25, 5 }, { 62, 25, 5 }, { 60, 50, 10 },
+  { TUNE_REST, 50, 0 } };
+
+struct tune {
+  const tuneNote * notes;
+  byte noOfNotes;
+};
+
+#define TUNE_LENGTH(t) (sizeof(t) / sizeof(tuneNote))
+
+const tune tunes[] PROGMEM = {
+  { scaleTune, TUNE_LENGTH(scaleTune) },
+  { happyTune, TUNE_LENGTH(happyTune) },
+  { sadTune, TUNE_LENGTH(sadTune) },
+  { chargeTune, TUNE_LENGTH(chargeTune) },
+  { twinkleTune, TUNE_LENGTH(twinkleTune) } };
+
+#define NO_OF_TUNES (sizeof(tunes) / sizeof(tune))
+
+// NULL when no tune is playing
+const tuneNote * tuneNotes = NULL;
+
+byte tuneLength;
+byte tuneNoteNo;
+bool tuneLoop;
+
+// Time the next note is due. Each note is timed from when the previous
+// one was due rather than from when it was started so the tempo does not drift.
+uint32_t tuneNextNoteTime;
+
+void stopTune()
+{
+  if (tuneNotes == NULL)
+    return;
+
+  tuneNotes = NULL;
+  noTone(A0);
+}
+
+void updateTune()
+{
+  if (tuneNotes == NULL)
+    return;
+
+  if ((int32_t)(millis() - tuneNextNoteTime) < 0)
+    return;
+
+  if (tuneNoteNo == tuneLength)
+  {
+    if (!tuneLoop)
+    {
+      tuneNotes = NULL;
+      return;
+    }
+    tuneNoteNo = 0;
+  }
+
+  tuneNote note;
+  memcpy_P(&note, tuneNotes + tuneNoteNo, sizeof(tuneNote));
+  tuneNoteNo++;
+
+  unsigned int duration = note.duration * TUNE_TICK_MILLIS;
+
+  if (note.pitch != TUNE_REST & note.pitch <= HIGHEST_TUNE_PITCH)
+  {
+#ifdef TUNE_DEBUG
+    Serial.print(F(".**note: "));
+    Serial.print(note.pitch);
+    Serial.print(F(" freq: "));
+    Serial.println(noteFrequency(note.pitch));
+#endif
+    tone(A0, noteFrequency(note.pitch), duration);
+  }
+
+  tuneNextNoteTime += duration + note.rest * TUNE_TICK_MILLIS;
+}
+
+// Starts tune number tuneNo
+// Returns false if there is no tune with that number
+
+bool startTune(int tuneNo, bool loop)
+{
+  if (tuneNo < 0 | tuneNo >= (int)NO_OF_TUNES)
+    return false;
+
+  tune t;
+  memcpy_P(&t, tunes + tuneNo, sizeof(tune));
+
+  tuneNotes = t.notes;
+  tuneLength = t.noOfNotes;
+  tuneLoop = loop;
+  tuneNoteNo = 0;
+  tuneNextNoteTime = millis();
+
+  updateTune();
+
+  return true;
+}
+
+bool tunePlaying()
+{
+  return tuneNotes != NULL;
+}
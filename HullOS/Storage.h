@@ -1,9 +1,13 @@
+#include <stddef.h>
+
 #define EEPROM_SIZE 1000
-#define STORED_PROGRAM_OFFSET 20
 
 #define PROGRAM_STATUS_BYTE_OFFSET 0
 #define PROGRAM_STORED_VALUE1 0xaa
-#define PROGRAM_STORED_VALUE2 0x55
+// Was 0x55 when the store held a single program at offset 20, and 0x56
+// before program images had a label table. Changed so that a store in an
+// old layout is not taken for a program directory.
+#define PROGRAM_STORED_VALUE2 0x57
 
 #define WHEEL_SETTINGS_OFFSET 2
 
@@ -49,6 +53,17 @@ bool storeBlockIntoEEPROM(uint8_t * blockStart, int length, int pos)
   return true;
 }
 
+int readIntFromEEPROM(int pos)
+{
+  return EEPROM.read(pos) | (EEPROM.read(pos + 1) << 8);
+}
+
+void storeIntIntoEEPROM(int value, int pos)
+{
+  storeByteIntoEEPROM(value & 0xFF, pos);
+  storeByteIntoEEPROM((value >> 8) & 0xFF, pos + 1);
+}
+
 bool loadBlockFromEEPROM(uint8_t * blockStart, int length, int pos)
 {
   for (int i = 0; i < length; i++)
@@ -87,12 +102,6 @@ void setProgramStored()
   storeByteIntoEEPROM(PROGRAM_STORED_VALUE2, PROGRAM_STATUS_BYTE_OFFSET + 1);
 }
 
-void clearProgramStoredFlag()
-{
-  storeByteIntoEEPROM(0, PROGRAM_STATUS_BYTE_OFFSET);
-  storeByteIntoEEPROM(0, PROGRAM_STATUS_BYTE_OFFSET + 1);
-}
-
 bool isProgramStored()
 {
   if ((EEPROM.read(PROGRAM_STATUS_BYTE_OFFSET) == PROGRAM_STORED_VALUE1) &
@@ -102,4 +111,276 @@ bool isProgramStored()
     return false;
 }
 
+// CRC-16 with the 0xA001 polynomial, the same as _crc16_update in avr-libc
+
+unsigned int crc16Update(unsigned int crc, byte b)
+{
+  crc ^= b;
+
+  for (byte i = 0; i < 8; i++)
+  {
+    if (crc & 1)
+      crc = (crc >> 1) ^ 0xA001;
+    else
+      crc = (crc >> 1);
+  }
+
+  return crc;
+}
+
+unsigned int crc16OfEEPROM(int pos, int length)
+{
+  unsigned int crc = 0xFFFF;
+
+  for (int i = 0; i < length; i++)
+  {
+    crc = crc16Update(crc, EEPROM.read(pos + i));
+  }
+
+  return crc;
+}
+
+// Program slots
+// The program store holds up to NO_OF_PROGRAM_SLOTS programs. A directory at
+// PROGRAM_DIRECTORY_OFFSET gives the name, position, length and CRC of each
+// one, so any of them can be started straight away. Programs are packed
+// together after the directory with no gaps between them. When a slot is
+// replaced or cleared the programs stored after it are moved down to close
+// the gap, so all the free space is at the end of the store.
+//
+// Each program image is the program statements, ending with the program
+// terminator, followed by a label table. The table holds the position of
+// every label (CL) and subroutine entry (CE) statement, two bytes each,
+// counted from the start of the image. The CRC covers the whole image.
+
+//#define PROGRAM_SLOT_DEBUG
+
+#define NO_OF_PROGRAM_SLOTS 4
+#define PROGRAM_NAME_LENGTH 8
+
+// Changed whenever the layout of a program image or its statements changes
+#define PROGRAM_FORMAT_VERSION 1
+
+// Held in the format of a slot while its program is being patched, so that
+// a patch cut short by a reset can be found at power up
+#define PROGRAM_FORMAT_PATCHING 0xFE
+
+// Slots are copied to and from the EEPROM as they are laid out in memory, so
+// the fields have fixed sizes and no padding, the same on any build
+
+struct __attribute__((packed)) programSlot
+{
+  // not zero terminated if the name fills the space
+  char name[PROGRAM_NAME_LENGTH];
+  int16_t offset;
+  // whole image, zero for an empty slot
+  int16_t length;
+  uint16_t crc;
+  byte format;
+  // statements and the program terminator, the label table follows
+  int16_t programLength;
+};
+
+static_assert(sizeof(struct programSlot) == 17, "program slot layout has changed");
+
+// The slot that is started at power up, followed by the slots
+#define PROGRAM_DIRECTORY_OFFSET 20
+#define PROGRAM_START_SLOT_OFFSET PROGRAM_DIRECTORY_OFFSET
+#define PROGRAM_SLOTS_OFFSET (PROGRAM_DIRECTORY_OFFSET + 1)
+#define PROGRAM_AREA_OFFSET (PROGRAM_SLOTS_OFFSET + (NO_OF_PROGRAM_SLOTS * sizeof(struct programSlot)))
+
+void loadProgramSlot(byte slot, programSlot * result)
+{
+  loadBlockFromEEPROM((uint8_t *)result, sizeof(struct programSlot),
+    PROGRAM_SLOTS_OFFSET + (slot * sizeof(struct programSlot)));
+}
+
+void storeProgramSlot(byte slot, programSlot * source)
+{
+  storeBlockIntoEEPROM((uint8_t *)source, sizeof(struct programSlot),
+    PROGRAM_SLOTS_OFFSET + (slot * sizeof(struct programSlot)));
+}
+
+// Writes just the format byte of a slot. A single byte write either happens
+// or doesn't, so this is used to mark the moment a patched program is whole.
+
+void storeProgramSlotFormat(byte slot, byte format)
+{
+  storeByteIntoEEPROM(format,
+    PROGRAM_SLOTS_OFFSET + (slot * sizeof(struct programSlot)) + offsetof(struct programSlot, format));
+}
+
+byte getStartProgramSlot()
+{
+  byte slot = EEPROM.read(PROGRAM_START_SLOT_OFFSET);
+
+  if (slot >= NO_OF_PROGRAM_SLOTS)
+    return 0;
+
+  return slot;
+}
+
+void setStartProgramSlot(byte slot)
+{
+  storeByteIntoEEPROM(slot, PROGRAM_START_SLOT_OFFSET);
+}
+
+// Offset of the first byte after the last stored program
+
+int programStoreEnd()
+{
+  int end = PROGRAM_AREA_OFFSET;
+
+  for (byte slot = 0; slot < NO_OF_PROGRAM_SLOTS; slot++)
+  {
+    programSlot entry;
+    loadProgramSlot(slot, &entry);
+
+    if (entry.length > 0 && entry.offset + entry.length > end)
+      end = entry.offset + entry.length;
+  }
+
+  return end;
+}
+
+int programStoreFree()
+{
+  return EEPROM_SIZE - programStoreEnd();
+}
+
+// Number of bytes that have to be moved to close the gap when the program
+// in a slot is removed
+
+int programBytesAfter(byte slot)
+{
+  programSlot entry;
+  loadProgramSlot(slot, &entry);
+
+  if (entry.length == 0)
+    return 0;
+
+  return programStoreEnd() - (entry.offset + entry.length);
+}
+
+// Empties a slot and moves the programs stored after it down over the space
+
+void removeProgramFromStore(byte slot)
+{
+  programSlot removed;
+  loadProgramSlot(slot, &removed);
+
+  int removedLength = removed.length;
+  int storeEnd = programStoreEnd();
+
+  memset(&removed.name, 0, PROGRAM_NAME_LENGTH);
+  removed.length = 0;
+  storeProgramSlot(slot, &removed);
+
+  if (removedLength == 0)
+    return;
+
+#ifdef PROGRAM_SLOT_DEBUG
+  Serial.print(F(".Removing program length: "));
+  Serial.println(removedLength);
+#endif
+
+  // Everything after the removed program moves down, working upwards so
+  // that no byte is written over before it has been moved
+  for (int pos = removed.offset + removedLength; pos < storeEnd; pos++)
+  {
+    EEPROM.update(pos - removedLength, EEPROM.read(pos));
+  }
+
+  for (byte i = 0; i < NO_OF_PROGRAM_SLOTS; i++)
+  {
+    programSlot entry;
+    loadProgramSlot(i, &entry);
+
+    if (entry.length > 0 && entry.offset > removed.offset)
+    {
+      entry.offset -= removedLength;
+      storeProgramSlot(i, &entry);
+    }
+  }
+}
+
+// Moves the programs down, lowest first, so that they are packed together
+// from the start of the program area. Used to close the gaps left when
+// slots are emptied without moving the programs after them.
+// A program that overlaps the one before it can't be moved and is dropped.
+
+void compactProgramStore()
+{
+  int end = PROGRAM_AREA_OFFSET;
+  byte placed = 0;
 
+  for (byte n = 0; n < NO_OF_PROGRAM_SLOTS; n++)
+  {
+    int lowest = -1;
+    programSlot lowestEntry;
+
+    for (byte slot = 0; slot < NO_OF_PROGRAM_SLOTS; slot++)
+    {
+      if (placed & (1 << slot))
+        continue;
+
+      programSlot entry;
+      loadProgramSlot(slot, &entry);
+
+      if (entry.length > 0 && (lowest == -1 || entry.offset < lowestEntry.offset))
+      {
+        lowest = slot;
+        lowestEntry = entry;
+      }
+    }
+
+    if (lowest == -1)
+      return;
+
+    placed |= 1 << lowest;
+
+    if (lowestEntry.offset < end)
+    {
+      memset(&lowestEntry.name, 0, PROGRAM_NAME_LENGTH);
+      lowestEntry.length = 0;
+      storeProgramSlot(lowest, &lowestEntry);
+      continue;
+    }
+
+    if (lowestEntry.offset > end)
+    {
+      for (int i = 0; i < lowestEntry.length; i++)
+      {
+        EEPROM.update(end + i, EEPROM.read(lowestEntry.offset + i));
+      }
+
+      lowestEntry.offset = end;
+      storeProgramSlot(lowest, &lowestEntry);
+    }
+
+    end += lowestEntry.length;
+  }
+}
+
+void clearProgramStore()
+{
+  programSlot empty;
+
+  memset(&empty, 0, sizeof(struct programSlot));
+
+  for (byte slot = 0; slot < NO_OF_PROGRAM_SLOTS; slot++)
+  {
+    storeProgramSlot(slot, &empty);
+  }
+
+  setStartProgramSlot(0);
+  setProgramStored();
+}
+
+// Sets up an empty directory if the store has never held one
+
+void setupProgramStore()
+{
+  if (!isProgramStored())
+    clearProgramStore();
+}
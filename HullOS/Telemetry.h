@@ -0,0 +1,265 @@
+// Binary telemetry
+// When telemetry is turned on a fixed layout frame of robot state is sent
+// at regular intervals. Frames are only written when the serial transmit buffer
+// has room for the whole frame, so sending telemetry never holds up the main loop.
+// A frame that doesn't fit is dropped; the sequence number still counts up so
+// the receiver can see the gap.
+//
+// Frame layout, multi-byte values are little endian:
+//
+//  0  start byte 0xA5
+//  1  length of the whole frame in bytes
+//  2  sequence number
+//  3  millis (4 bytes)
+//  7  programState
+//  8  programCounter (2 bytes)
+// 10  left step counter (4 bytes)
+// 14  right step counter (4 bytes)
+// 18  distance in mm (2 bytes)
+// 20  light level (2 bytes)
+// 22  number of variables that follow
+// 23  variable values, 2 bytes each, or 4 bytes each when the robot is built
+//     with SCRIPT_VALUES_32BIT. The receiver can tell which from the length.
+//     checksum - all the bytes after the start byte add up to zero
+//
+// Arrays can't be sent. A variable that has become an array since telemetry
+// was turned on is sent as zero.
+
+//#define TELEMETRY_DEBUG
+
+#define TELEMETRY_FRAME_START 0xA5
+
+#define TELEMETRY_MAX_VARIABLES 4
+
+#define TELEMETRY_HEADER_SIZE 23
+
+#ifdef SCRIPT_VALUES_32BIT
+#define TELEMETRY_VALUE_SIZE 4
+#else
+#define TELEMETRY_VALUE_SIZE 2
+#endif
+
+#define TELEMETRY_MAX_FRAME_SIZE (TELEMETRY_HEADER_SIZE + (TELEMETRY_VALUE_SIZE * TELEMETRY_MAX_VARIABLES) + 1)
+
+// Interval between frames in milliseconds, 0 when telemetry is off
+unsigned int telemetryIntervalInMillis = 0;
+
+uint32_t telemetryNextFrameTime;
+
+byte telemetrySequence;
+
+// Slots in the variable store of the variables sent in each frame
+byte telemetryVariables[TELEMETRY_MAX_VARIABLES];
+byte telemetryNoOfVariables;
+
+byte telemetryFrame[TELEMETRY_MAX_FRAME_SIZE];
+byte telemetryFramePos;
+
+void putTelemetryByte(byte b)
+{
+	telemetryFrame[telemetryFramePos++] = b;
+}
+
+void putTelemetryInt(int value)
+{
+	putTelemetryByte(value & 0xFF);
+	putTelemetryByte((value >> 8) & 0xFF);
+}
+
+void putTelemetryLong(uint32_t value)
+{
+	putTelemetryInt(value & 0xFFFF);
+	putTelemetryInt(value >> 16);
+}
+
+void putTelemetryVariable(byte slot)
+{
+	scriptValue value = 0;
+
+	if (!variables[slot].arrayLength)
+		value = getVariable(slot);
+
+#ifdef SCRIPT_VALUES_32BIT
+	putTelemetryLong(value);
+#else
+	putTelemetryInt(value);
+#endif
+}
+
+void buildTelemetryFrame()
+{
+	motorSnapshot motors;
+
+	getMotorSnapshot(&motors);
+
+	telemetryFramePos = 0;
+
+	putTelemetryByte(TELEMETRY_FRAME_START);
+	putTelemetryByte(TELEMETRY_HEADER_SIZE + (TELEMETRY_VALUE_SIZE * telemetryNoOfVariables) + 1);
+	putTelemetryByte(telemetrySequence);
+	putTelemetryLong(millis());
+	putTelemetryByte(programState);
+	putTelemetryInt(programCounter);
+	putTelemetryLong(motors.leftStepCounter);
+	putTelemetryLong(motors.rightStepCounter);
+	putTelemetryInt(getDistanceValueInt());
+	putTelemetryInt(readLight());
+	putTelemetryByte(telemetryNoOfVariables);
+
+	for (byte i = 0; i < telemetryNoOfVariables; i++)
+	{
+		putTelemetryVariable(telemetryVariables[i]);
+	}
+
+	byte checksum = 0;
+
+	for (byte i = 1; i < telemetryFramePos; i++)
+	{
+		checksum += telemetryFrame[i];
+	}
+
+	putTelemetryByte(-checksum);
+}
+
+void updateTelemetry()
+{
+	if (telemetryIntervalInMillis == 0)
+		return;
+
+	uint32_t now = millis();
+
+	if ((int32_t)(now - telemetryNextFrameTime) < 0)
+		return;
+
+	telemetryNextFrameTime += telemetryIntervalInMillis;
+
+	// If we have fallen a long way behind, start again from now
+	if ((int32_t)(now - telemetryNextFrameTime) > (int32_t)telemetryIntervalInMillis)
+		telemetryNextFrameTime = now + telemetryIntervalInMillis;
+
+	byte frameSize = TELEMETRY_HEADER_SIZE + (TELEMETRY_VALUE_SIZE * telemetryNoOfVariables) + 1;
+
+	if (Serial.availableForWrite() >= frameSize)
+	{
+		buildTelemetryFrame();
+		Serial.write(telemetryFrame, telemetryFramePos);
+	}
+
+	telemetrySequence++;
+}
+
+// Command ITinterval,var,var... - send a telemetry frame every interval milliseconds
+// including up to four variables, given by name or by slot number
+// Command IT - turn telemetry off
+// Return OK
+
+void remoteTelemetry()
+{
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+		telemetryIntervalInMillis = 0;
+
+#ifdef DIAGNOSTICS_ACTIVE
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("ITOK"));
+		}
+#endif
+		return;
+	}
+
+	int interval;
+
+	if (!getValue(&interval))
+	{
+		return;
+	}
+
+	byte noOfVariables = 0;
+
+	while (*decodePos != STATEMENT_TERMINATOR & decodePos != decodeLimit)
+	{
+		decodePos++; // move past the separator
+
+		if (noOfVariables == TELEMETRY_MAX_VARIABLES)
+		{
+#ifdef DIAGNOSTICS_ACTIVE
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("ITFail: too many variables"));
+			}
+#endif
+			return;
+		}
+
+		int slot;
+
+		if (isVariableNameStart(decodePos))
+		{
+			if (findVariable(decodePos, &slot) != OPERAND_OK)
+			{
+#ifdef DIAGNOSTICS_ACTIVE
+				if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+				{
+					Serial.println(F("ITFail: variable not found"));
+				}
+#endif
+				return;
+			}
+
+			decodePos += getVariableNameLength(slot);
+		}
+		else
+		{
+			if (!getValue(&slot))
+			{
+				return;
+			}
+
+			if (slot < 0 | slot >= NUMBER_OF_VARIABLES)
+			{
+#ifdef DIAGNOSTICS_ACTIVE
+				if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+				{
+					Serial.println(F("ITFail: invalid variable slot"));
+				}
+#endif
+				return;
+			}
+		}
+
+		if (variables[slot].arrayLength)
+		{
+#ifdef DIAGNOSTICS_ACTIVE
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("ITFail: arrays can't be sent"));
+			}
+#endif
+			return;
+		}
+
+		telemetryVariables[noOfVariables++] = slot;
+	}
+
+#ifdef TELEMETRY_DEBUG
+	Serial.print(F(".**telemetry interval: "));
+	Serial.print(interval);
+	Serial.print(F(" variables: "));
+	Serial.println(noOfVariables);
+#endif
+
+#ifdef DIAGNOSTICS_ACTIVE
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("ITOK"));
+	}
+#endif
+
+	if (interval < 0)
+		interval = 0;
+
+	telemetryNoOfVariables = noOfVariables;
+	telemetryIntervalInMillis = interval;
+	telemetryNextFrameTime = millis();
+}
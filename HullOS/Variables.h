@@ -22,45 +22,84 @@ enum parseOperandResult {
 	INVALID_OPERATOR=13,
 	SECOND_VARIABLE_NOT_FOUND=14,
 	SECOND_VARIABLE_USED_BEFORE_DEFINITION=15,
+	NOT_AN_ARRAY=16,
+	ARRAY_NEEDS_INDEX=17,
+	ARRAY_INDEX_OUT_OF_RANGE=18,
+	MISSING_CLOSE_BRACKET_IN_INDEX=19,
 };
 
 //#define VAR_DEBUG
 
+// Define to make script variables and arithmetic 32 bit instead of 16 bit.
+// Products of distances and step counts, times in milliseconds and odometry
+// totals then fit without overflowing, at the cost of two more bytes for each
+// variable and array element and slower arithmetic.
+//#define SCRIPT_VALUES_32BIT
+
+#ifdef SCRIPT_VALUES_32BIT
+typedef int32_t scriptValue;
+#else
+typedef int16_t scriptValue;
+#endif
+
 struct op
 {
 	char operatorCh;
-	int(*evaluator) (int, int);
+	scriptValue(*evaluator) (scriptValue, scriptValue);
 };
 
-int evaluatePlus(int op1, int op2)
+#ifdef SCRIPT_VALUES_32BIT
+
+// Most values in scripts still fit in 16 bits. Working on these as ints lets
+// the compiler use the 16 bit multiply and divide routines, which are several
+// times faster on the AVR than the 32 bit ones. -32768 is left out so that
+// dividing it by -1 can't overflow.
+
+inline bool fitsInInt(scriptValue value)
+{
+	return value >= -32767 & value <= 32767;
+}
+
+#endif
+
+scriptValue evaluatePlus(scriptValue op1, scriptValue op2)
 {
 	return op1 + op2;
 }
 
 struct op addOp = { '+', evaluatePlus };
 
-int evaluateMinus(int op1, int op2)
+scriptValue evaluateMinus(scriptValue op1, scriptValue op2)
 {
 	return op1 - op2;
 }
 
 struct op minusOp = { '-', evaluateMinus };
 
-int evaluateTimes(int op1, int op2)
+scriptValue evaluateTimes(scriptValue op1, scriptValue op2)
 {
+#ifdef SCRIPT_VALUES_32BIT
+	// 16 by 16 bit multiply giving a 32 bit result
+	if (fitsInInt(op1) & fitsInInt(op2))
+		return (int32_t)(int16_t)op1 * (int16_t)op2;
+#endif
 	return op1 * op2;
 }
 
 struct op timesOp = { '*', evaluateTimes };
 
-int evaluateDivide(int op1, int op2)
+scriptValue evaluateDivide(scriptValue op1, scriptValue op2)
 {
+#ifdef SCRIPT_VALUES_32BIT
+	if (fitsInInt(op1) & fitsInInt(op2))
+		return (int16_t)op1 / (int16_t)op2;
+#endif
 	return op1 / op2;
 }
 
 struct op divideOp = { '/', evaluateDivide };
 
-int evaluateModulus(int op1, int op2)
+scriptValue evaluateModulus(scriptValue op1, scriptValue op2)
 {
 	return op1 % op2;
 }
@@ -93,46 +132,46 @@ op * findOperator(char ch)
 
 struct logicalOp
 {
-	char * operatorCh;
-	bool(*evaluator) (int, int);
+	const char * operatorCh;
+	bool(*evaluator) (scriptValue, scriptValue);
 };
 
-bool equalsOp(int op1, int op2)
+bool equalsOp(scriptValue op1, scriptValue op2)
 {
 	return op1 == op2;
 }
 
 struct logicalOp logicEquals = { "==",equalsOp };
 
-bool notEqualsOp(int op1, int op2)
+bool notEqualsOp(scriptValue op1, scriptValue op2)
 {
 	return op1 != op2;
 }
 
 struct logicalOp logicNotEquals = { "!=",notEqualsOp };
 
-bool lessThanOp(int op1, int op2)
+bool lessThanOp(scriptValue op1, scriptValue op2)
 {
 	return op1 < op2;
 }
 
 struct logicalOp logicLessThan = { "<",lessThanOp };
 
-bool greaterThanOp(int op1, int op2)
+bool greaterThanOp(scriptValue op1, scriptValue op2)
 {
 	return op1 > op2;
 }
 
 struct logicalOp logicGreaterThan = { ">",greaterThanOp };
 
-bool lessThanEqualsOp(int op1, int op2)
+bool lessThanEqualsOp(scriptValue op1, scriptValue op2)
 {
 	return op1 <= op2;
 }
 
 struct logicalOp logicLessThanEquals = { "<=",lessThanEqualsOp };
 
-bool greaterThanEqualsOp(int op1, int op2)
+bool greaterThanEqualsOp(scriptValue op1, scriptValue op2)
 {
 	return op1 >= op2;
 }
@@ -145,13 +184,13 @@ struct logicalOp * logicalOps[NUMBER_OF_LOGICAL_OPERATORS] = { &logicEquals, &lo
   &logicLessThan, &logicGreaterThan,
   &logicLessThanEquals, &logicGreaterThanEquals };
 
-struct logicalOp * findLogicalOp(char * text)
+struct logicalOp * findLogicalOp(statementCursor text)
 {
 	// Some logical operators are two character
 	// If they are, the second character is always equals
 
-	char * firstChar = text;
-	char * secondChar = text + 1;
+	statementCursor firstChar = text;
+	statementCursor secondChar = text + 1;
 
 	for (int i = 0; i < NUMBER_OF_LOGICAL_OPERATORS; i++)
 	{
@@ -186,7 +225,7 @@ struct logicalOp * findLogicalOp(char * text)
 }
 
 struct reading {
-	char * name;
+	const char * name;
 	int(*reader)(void);
 };
 
@@ -201,12 +240,12 @@ int readLight()
 	return analogRead(A2);
 }
 
-inline bool isReadingNameStart(char * ch)
+inline bool isReadingNameStart(statementCursor ch)
 {
 	return (isalpha(*ch));
 }
 
-inline bool isReadingNameChar(char * ch)
+inline bool isReadingNameChar(statementCursor ch)
 {
 	return (isAlphaNumeric(*ch));
 }
@@ -234,11 +273,48 @@ int readRandom()
 
 struct reading randomReading = { "random", readRandom };
 
-#define NO_OF_HARDWARE_READERS 4
+// Position in mm from where the program started, worked out by Odometry.h
+
+int readX()
+{
+	return getOdometryXInMM();
+}
+
+struct reading xReading = { "x", readX };
+
+int readY()
+{
+	return getOdometryYInMM();
+}
+
+struct reading yReading = { "y", readY };
 
-struct reading * readers[NO_OF_HARDWARE_READERS] = { &distance, &light, &moving, &randomReading };
+// Heading in centi-degrees, positive to the right
 
-bool validReadingz(char * text)
+int readHeading()
+{
+	return getOdometryHeadingInCentiDegrees();
+}
+
+struct reading heading = { "heading", readHeading };
+
+// 1 while a tune started by play is still playing
+
+int readPlaying()
+{
+	if (tunePlaying())
+		return 1;
+	else
+		return 0;
+}
+
+struct reading playing = { "playing", readPlaying };
+
+#define NO_OF_HARDWARE_READERS 8
+
+struct reading * readers[NO_OF_HARDWARE_READERS] = { &distance, &light, &moving, &randomReading, &xReading, &yReading, &heading, &playing };
+
+bool validReadingz(statementCursor text)
 {
 	if (!isReadingNameStart(text))
 	{
@@ -246,15 +322,15 @@ bool validReadingz(char * text)
 		{
 			Serial.println(F("Reading name first character not valid"));
 		}
-		return;
+		return false;
 	}
 
 	for (int i = 0; i < NO_OF_HARDWARE_READERS; i++)
 	{
 		struct reading * currentReader = readers[i];
 
-		char * currentChar = text;
-		char * nameChar = currentReader->name;
+		statementCursor currentChar = text;
+		const char * nameChar = currentReader->name;
 
 		while (true)
 		{
@@ -284,7 +360,7 @@ bool validReadingz(char * text)
 	return false;
 }
 
-struct reading * getReading(char * text)
+struct reading * getReading(statementCursor text)
 {
 	if (!isReadingNameStart(text))
 	{
@@ -299,8 +375,8 @@ struct reading * getReading(char * text)
 	{
 		struct reading * currentReader = readers[i];
 
-		char * currentChar = text;
-		char * nameChar = currentReader->name;
+		statementCursor currentChar = text;
+		const char * nameChar = currentReader->name;
 
 		while (true)
 		{
@@ -338,16 +414,31 @@ struct variable
 	bool unassigned;
 	// add one to the end for the terminating zero
 	char name[MAX_VARIABLE_NAME_LENGTH + 1];
-	int value;
+	// for an array this is the position of the first element in arrayPool
+	scriptValue value;
+	// zero if the variable is not an array
+	byte arrayLength;
 };
 
 variable variables[NUMBER_OF_VARIABLES];
 
+// Arrays
+// The elements of all the arrays are kept together in arrayPool, in the
+// order the arrays were declared. An array variable holds the position of
+// its first element and the number of elements, so finding an element
+// and checking the index don't need any searching.
+
+#define ARRAY_POOL_SIZE 32
+
+scriptValue arrayPool[ARRAY_POOL_SIZE];
+int arrayPoolUsed;
+
 void clearVariableSlot(int position)
 {
 	variables[position].empty = true;
 	variables[position].unassigned = true;
 	variables[position].value = 0;
+	variables[position].arrayLength = 0;
 	variables[position].name[0] = 0;
 }
 
@@ -360,6 +451,7 @@ void clearVariables()
 		clearVariableSlot(i);
 	}
 
+	arrayPoolUsed = 0;
 }
 
 void setupVariables()
@@ -367,13 +459,13 @@ void setupVariables()
 	clearVariables();
 }
 
-void setVariable(int position, int value)
+void setVariable(int position, scriptValue value)
 {
 	variables[position].value = value;
 	variables[position].unassigned = false;
 }
 
-int getVariable(int position)
+scriptValue getVariable(int position)
 {
 	return variables[position].value;
 }
@@ -383,12 +475,12 @@ bool isAssigned(int position)
 	return !variables[position].unassigned;
 }
 
-inline bool isVariableNameStart(char * ch)
+inline bool isVariableNameStart(statementCursor ch)
 {
 	return (isalpha(*ch));
 }
 
-inline bool isVariableNameChar(char * ch)
+inline bool isVariableNameChar(statementCursor ch)
 {
 	return (isAlphaNumeric(*ch));
 }
@@ -398,7 +490,7 @@ inline bool variableSlotEmpty(int position)
 	return variables[position].empty;
 }
 
-int checkIdentifier(char * var)
+int checkIdentifier(statementCursor var)
 {
 	if (!isVariableNameStart(var))
 		return INVALID_VARIABLE_NAME;
@@ -419,7 +511,7 @@ int checkIdentifier(char * var)
 	return VARIABLE_NAME_OK;
 }
 
-bool matchVariable(int position, char * text)
+bool matchVariable(int position, statementCursor text)
 {
 #ifdef VAR_DEBUG
 	Serial.print(F("Match variable: "));
@@ -467,6 +559,9 @@ bool matchVariable(int position, char * text)
 
 		text++;
 	}
+
+	// the name fills the whole slot, so it matches if the text ends here
+	return !isVariableNameChar(text);
 }
 
 // returns the length of the variable name at the given position in the variable store
@@ -488,7 +583,7 @@ int getVariableNameLength(int position)
 // have ended when a non-text/digit character is found
 //
 
-parseOperandResult findVariable(char * name, int *position)
+parseOperandResult findVariable(statementCursor name, int *position)
 {
 #ifdef VAR_DEBUG
 	Serial.println(F("Finding variable"));
@@ -538,11 +633,11 @@ parseOperandResult findVariableSlot(int * result)
 // returns NO_ROOM_FOR_VARIABLE if the variable cannot be stored
 // returns VARIABLE_NAME_TOO_LONG if the name of the variable is longer than the store length
 
-parseOperandResult createVariable(char * namePos, int * varPos)
+parseOperandResult createVariable(statementCursor namePos, int * varPos)
 {
 	// Start position for the decode process
 
-	char * decodePos = namePos;
+	statementCursor decodePos = namePos;
 	int position;
 
 #ifdef VAR_DEBUG
@@ -610,13 +705,13 @@ parseOperandResult createVariable(char * namePos, int * varPos)
 
 //#define READ_INTEGER_DEBUG
 
-bool readInteger(int * result)
+bool readInteger(scriptValue * result)
 {
 #ifdef READ_INTEGER_DEBUG
 	Serial.println(".**readInteger");
 #endif
 	int sign = 1;
-	int resultValue = 0;
+	scriptValue resultValue = 0;
 	bool gotDigit = false;
 
 	if (*decodePos == '-')
@@ -687,7 +782,42 @@ void skipCodeSpaces(void)
 	}
 }
 
-parseOperandResult parseOperand(int * result)
+parseOperandResult parseOperand(scriptValue * result);
+
+// decodePos is at the [ after the name of the array in the given position
+// Sets element to the element selected by the index and moves past the ]
+
+parseOperandResult findArrayElement(int position, scriptValue ** element)
+{
+	decodePos++; // move past the [
+
+	scriptValue index;
+
+	parseOperandResult result = parseOperand(&index);
+
+	if (result != OPERAND_OK)
+	{
+		return result;
+	}
+
+	if (*decodePos != ']')
+	{
+		return MISSING_CLOSE_BRACKET_IN_INDEX;
+	}
+
+	decodePos++;
+
+	if (index < 0 | index >= variables[position].arrayLength)
+	{
+		return ARRAY_INDEX_OUT_OF_RANGE;
+	}
+
+	*element = &arrayPool[variables[position].value + index];
+
+	return OPERAND_OK;
+}
+
+parseOperandResult parseOperand(scriptValue * result)
 {
 #ifdef VAR_DEBUG
 	Serial.println(F("Get operand"));
@@ -711,6 +841,32 @@ parseOperandResult parseOperand(int * result)
 		// move down to the end of the name
 		decodePos = decodePos + getVariableNameLength(position);
 
+		if (variables[position].arrayLength)
+		{
+			if (*decodePos != '[')
+			{
+				return ARRAY_NEEDS_INDEX;
+			}
+
+			scriptValue * element;
+
+			parseOperandResult elementResult = findArrayElement(position, &element);
+
+			if (elementResult != OPERAND_OK)
+			{
+				return elementResult;
+			}
+
+			*result = *element;
+
+			return OPERAND_OK;
+		}
+
+		if (*decodePos == '[')
+		{
+			return NOT_AN_ARRAY;
+		}
+
 		if (!isAssigned(position))
 		{
 			return USING_UNASSIGNED_VARIABLE;
@@ -761,7 +917,7 @@ parseOperandResult parseOperand(int * result)
 	return INVALID_OPERAND;
 }
 
-bool getOperand(int * result)
+bool getOperand(scriptValue * result)
 {
 	parseOperandResult getResult = parseOperand(result);
 
@@ -777,11 +933,11 @@ bool getOperand(int * result)
 // decodepos points to the first character of a value sequence
 // It is either a literal, variable or two operand expression
 
-bool getValue(int * result)
+bool getScriptValue(scriptValue * result)
 {
 	// Now we are at the start of a value to parse
 
-	int firstOperand;
+	scriptValue firstOperand;
 
 	if (!getOperand(&firstOperand))
 	{
@@ -810,7 +966,7 @@ bool getValue(int * result)
 
 	decodePos++;
 
-	int secondOperand;
+	scriptValue secondOperand;
 
 	if (!getOperand(&secondOperand))
 	{
@@ -827,6 +983,23 @@ bool getValue(int * result)
 	return true;
 }
 
+// Gets a value for a command that works in ints, such as a distance or
+// a colour. Only the bottom 16 bits are kept when values are 32 bit.
+
+bool getValue(int * result)
+{
+	scriptValue value;
+
+	if (!getScriptValue(&value))
+	{
+		return false;
+	}
+
+	*result = value;
+
+	return true;
+}
+
 // called from the command processor
 // the global variable decodePos holds the position in the decode array (first character
 // of the variable name) and the global variable decodeLimit the end of the array
@@ -836,7 +1009,7 @@ bool getValue(int * result)
 bool testCondition(bool * result)
 {
 
-	int firstOperand;
+	scriptValue firstOperand;
 
 	if (!getOperand(&firstOperand))
 	{
@@ -861,7 +1034,7 @@ bool testCondition(bool * result)
 
 	decodePos = decodePos + strlen(op->operatorCh);
 
-	int secondOperand;
+	scriptValue secondOperand;
 
 	if (!getOperand(&secondOperand))
 	{
@@ -912,8 +1085,6 @@ void setVariable()
 		return;
 	}
 
-	char * variableStart = decodePos;
-
 	// First see if we can find the variable in the store
 
 	int position;
@@ -951,6 +1122,31 @@ void setVariable()
 
 	decodePos = decodePos + getVariableNameLength(position);
 
+	// Set when an element of an array is being assigned
+	scriptValue * element = NULL;
+
+	if (variables[position].arrayLength | *decodePos == '[')
+	{
+		parseOperandResult elementResult;
+
+		if (*decodePos != '[')
+			elementResult = ARRAY_NEEDS_INDEX;
+		else if (!variables[position].arrayLength)
+			elementResult = NOT_AN_ARRAY;
+		else
+			elementResult = findArrayElement(position, &element);
+
+		if (elementResult != OPERAND_OK)
+		{
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.print(F("VS array element error: "));
+				Serial.println(elementResult);
+			}
+			return;
+		}
+	}
+
 	if (*decodePos != '=')
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -962,14 +1158,17 @@ void setVariable()
 
 	decodePos++;
 
-	int result;
+	scriptValue result;
 
-	if (!getValue(&result))
+	if (!getScriptValue(&result))
 	{
 		return;
 	}
 
-	setVariable(position, result);
+	if (element != NULL)
+		*element = result;
+	else
+		setVariable(position, result);
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
@@ -989,7 +1188,17 @@ void viewVariable()
 		}
 	}
 
-	if (!isAssigned(position))
+	if (variables[position].arrayLength)
+	{
+		for (int i = 0; i < variables[position].arrayLength; i++)
+		{
+			if (i > 0)
+				Serial.print(',');
+			Serial.print(arrayPool[variables[position].value + i]);
+		}
+		Serial.println();
+	}
+	else if (!isAssigned(position))
 	{
 		Serial.println(F("Unassigned"));
 	}
@@ -998,3 +1207,175 @@ void viewVariable()
 		Serial.println(getVariable(position));
 	}
 }
+
+// Command VAname,length - create an array of length elements, all zero
+// If the array already exists with the same length its elements are set
+// back to zero, so a declaration can be obeyed more than once
+
+void declareArray()
+{
+	if (checkIdentifier(decodePos) != VARIABLE_NAME_OK)
+	{
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("VA invalid array name"));
+		}
+		return;
+	}
+
+	statementCursor nameStart = decodePos;
+
+	while (isVariableNameChar(decodePos))
+	{
+		decodePos++;
+	}
+
+	if (*decodePos != ',')
+	{
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("VA missing length"));
+		}
+		return;
+	}
+
+	decodePos++;
+
+	int length;
+
+	if (!getValue(&length))
+	{
+		return;
+	}
+
+	int position;
+
+	bool found = findVariable(nameStart, &position) == OPERAND_OK;
+
+	if (!found || variables[position].arrayLength != length)
+	{
+		// The script compiler creates names as it meets them, so an
+		// unassigned variable can still be made into an array
+		if (found && (variables[position].arrayLength | isAssigned(position)))
+		{
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("VA name already in use"));
+			}
+			return;
+		}
+
+		if (length < 1 | length > ARRAY_POOL_SIZE - arrayPoolUsed)
+		{
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("VA no room for array"));
+			}
+			return;
+		}
+
+		if (!found && createVariable(nameStart, &position) != OPERAND_OK)
+		{
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+			{
+				Serial.println(F("VA no room for variable"));
+			}
+			return;
+		}
+
+		variables[position].value = arrayPoolUsed;
+		variables[position].arrayLength = length;
+		variables[position].unassigned = false;
+		arrayPoolUsed += length;
+	}
+
+	for (int i = 0; i < length; i++)
+	{
+		arrayPool[variables[position].value + i] = 0;
+	}
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("VAOK"));
+	}
+}
+
+#ifdef ARITHMETIC_BENCHMARK
+
+// Times the arithmetic and prints the average nanoseconds for each
+// operation, first for the operator on its own and then for a whole value
+// being decoded from a statement. Build with and without SCRIPT_VALUES_32BIT
+// to compare the two.
+
+#define ARITHMETIC_BENCHMARK_PASSES 1000
+
+void benchmarkOperator(op * activeOperator, scriptValue op1, scriptValue op2)
+{
+	// volatile so the calls can't be worked out when the code is compiled
+	volatile scriptValue first = op1;
+	volatile scriptValue second = op2;
+	volatile scriptValue result;
+
+	uint32_t start = micros();
+
+	for (int i = 0; i < ARITHMETIC_BENCHMARK_PASSES; i++)
+	{
+		result = activeOperator->evaluator(first, second);
+	}
+
+	// microseconds for 1000 passes is nanoseconds for one
+	uint32_t time = micros() - start;
+
+	Serial.print(op1);
+	Serial.print(activeOperator->operatorCh);
+	Serial.print(op2);
+	Serial.print(F(" = "));
+	Serial.print(result);
+	Serial.print(F(" ns each: "));
+	Serial.println(time);
+}
+
+void benchmarkStatement(const char * statement)
+{
+	scriptValue result;
+
+	uint32_t start = micros();
+
+	for (int i = 0; i < ARITHMETIC_BENCHMARK_PASSES; i++)
+	{
+		// only read, so the cast is safe
+		decodePos = (char *)statement;
+		decodeLimit = (char *)statement + strlen(statement) + 1;
+		getScriptValue(&result);
+	}
+
+	uint32_t time = micros() - start;
+
+	Serial.print(statement);
+	Serial.print(F(" = "));
+	Serial.print(result);
+	Serial.print(F(" ns each: "));
+	Serial.println(time);
+}
+
+void benchmarkScriptArithmetic()
+{
+	Serial.print(F("Arithmetic benchmark, value bytes: "));
+	Serial.println(sizeof(scriptValue));
+
+	benchmarkOperator(&addOp, 1234, 567);
+	benchmarkOperator(&timesOp, 123, 45);
+	benchmarkOperator(&divideOp, 12345, 67);
+	benchmarkOperator(&modulusOp, 12345, 67);
+
+#ifdef SCRIPT_VALUES_32BIT
+	benchmarkOperator(&timesOp, 100000, 30);
+	benchmarkOperator(&divideOp, 1000000, 7);
+#endif
+
+	benchmarkStatement("1234+567\r");
+	benchmarkStatement("123*45\r");
+	benchmarkStatement("12345/67\r");
+}
+
+#endif